@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "grid_fusion.h"
+
+// Default parameter values.
+const int WORKLOAD_SENSORS = 12;                // 4 front, 4 rear and 2 on each side.
+const float WORKLOAD_FOV = 1.0f;                // [rad].
+const float WORKLOAD_MAX_RANGE = 5.0f;          // [m].
+const float WORKLOAD_NO_ECHO_RATIO = 0.3f;      // Echoes at max_range, i.e. no obstacle.
+const double WORKLOAD_PATH_RADIUS = 8.0;        // The vehicle drives on a circle around the map center [m].
+const double WORKLOAD_STEP = 0.05;              // Vehicle travel per frame [m], 1m/s at 20Hz.
+const uint32_t WORKLOAD_SEED = 42;
+
+struct WorkloadSensor
+{
+    Eigen::Vector3d mount_pose;     // (x [m], y [m], yaw [rad]) in the vehicle frame.
+    float fov;
+    float max_range;
+};
+
+struct WorkloadFrame
+{
+    Eigen::Vector3d vehicle_pose;   // (x [m], y [m], yaw [rad]) relative to the map center.
+    std::vector<GridEcho> echoes;   // One echo per sensor.
+};
+
+// Reproducible synthetic ultrasonic traffic: a car with the usual 12 sensor ring driving a circle,
+// the ranges drawn from a fixed seed.
+struct EchoWorkload
+{
+    std::vector<WorkloadSensor> sensors;
+    std::vector<WorkloadFrame> frames;
+
+    // Map frame pose of the sensor of an echo of frame, the vehicle poses are shifted by center.
+    Eigen::Vector3d sensor_pose(const WorkloadFrame& frame, int sensor_id,
+        const Eigen::Vector2d & center = Eigen::Vector2d::Zero()) const
+    {
+        const Eigen::Vector3d& mount = sensors[sensor_id].mount_pose;
+        const Eigen::Vector3d& vehicle = frame.vehicle_pose;
+        const double c = std::cos(vehicle.z());
+        const double s = std::sin(vehicle.z());
+        return Eigen::Vector3d(center.x() + vehicle.x() + c * mount.x() - s * mount.y(),
+            center.y() + vehicle.y() + s * mount.x() + c * mount.y(),
+            vehicle.z() + mount.z());
+    }
+};
+
+inline EchoWorkload make_echo_workload(int frames, uint32_t seed = WORKLOAD_SEED)
+{
+    EchoWorkload workload;
+    // Half length and half width of the bumper ring [m].
+    const double lx = 2.4;
+    const double ly = 0.95;
+    const double mounts[WORKLOAD_SENSORS][3] = {
+        {lx, -0.7, -0.35}, {lx, -0.25, -0.1}, {lx, 0.25, 0.1}, {lx, 0.7, 0.35},
+        {-lx, -0.7, M_PI + 0.35}, {-lx, -0.25, M_PI + 0.1}, {-lx, 0.25, M_PI - 0.1}, {-lx, 0.7, M_PI - 0.35},
+        {1.5, ly, 0.5 * M_PI}, {-1.5, ly, 0.5 * M_PI}, {1.5, -ly, -0.5 * M_PI}, {-1.5, -ly, -0.5 * M_PI}};
+    for (int i = 0; i < WORKLOAD_SENSORS; i++) {
+        workload.sensors.push_back(WorkloadSensor{Eigen::Vector3d(mounts[i][0], mounts[i][1], mounts[i][2]),
+            WORKLOAD_FOV, WORKLOAD_MAX_RANGE});
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int f = 0; f < frames; f++) {
+        const double angle = f * WORKLOAD_STEP / WORKLOAD_PATH_RADIUS;
+        WorkloadFrame frame;
+        frame.vehicle_pose = Eigen::Vector3d(WORKLOAD_PATH_RADIUS * std::cos(angle),
+            WORKLOAD_PATH_RADIUS * std::sin(angle), angle + 0.5 * M_PI);
+        for (int i = 0; i < WORKLOAD_SENSORS; i++) {
+            float range = uniform(rng) < WORKLOAD_NO_ECHO_RATIO ? WORKLOAD_MAX_RANGE
+                : 0.3f + uniform(rng) * (WORKLOAD_MAX_RANGE - 0.3f);
+            frame.echoes.push_back(GridEcho{i, range});
+        }
+        workload.frames.push_back(frame);
+    }
+    return workload;
+}
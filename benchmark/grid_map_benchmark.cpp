@@ -0,0 +1,501 @@
+#include <benchmark/benchmark.h>
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "echo_workload.h"
+#include "grid_delta.h"
+#include "grid_footprint.h"
+#include "grid_fusion.h"
+#include "grid_ingest.h"
+#include "grid_layers.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_occupancy.h"
+#include "grid_sensor.h"
+
+// Every map benchmark runs at the default 300 x 300 cells and at 1000 x 1000 cells.
+const int WORKLOAD_FRAMES = 2000;
+
+static const EchoWorkload& workload()
+{
+    static EchoWorkload echo_workload = make_echo_workload(WORKLOAD_FRAMES);
+    return echo_workload;
+}
+
+static void map_sizes(benchmark::internal::Benchmark* bench)
+{
+    bench->Arg(WIDTH)->Arg(1000);
+}
+
+static GridMap make_map(int size)
+{
+    return GridMap(RESOLUTION, size, size, Eigen::Vector3d::Zero());
+}
+
+// Map with the first frames of the workload integrated, so classification sees a realistic mix.
+static GridMap make_observed_map(int size)
+{
+    GridMap map = make_map(size);
+    GridSensor sensor;
+    const EchoWorkload& echo_workload = workload();
+    for (const WorkloadFrame& frame : echo_workload.frames) {
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            sensor.integrate_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range);
+        }
+    }
+    return map;
+}
+
+static void BM_CellUpdate(benchmark::State& state)
+{
+    std::vector<GridCell> cells(4096);
+    GridSensor sensor;
+    for (auto _ : state) {
+        for (size_t i = 0; i < cells.size(); i++) {
+            cells[i].update(i % 3 == 0 ? sensor._hit_increment : sensor._miss_increment);
+        }
+        benchmark::DoNotOptimize(cells.data());
+    }
+    state.SetItemsProcessed(state.iterations() * cells.size());
+}
+BENCHMARK(BM_CellUpdate);
+
+// Per-echo update throughput of GridSensor::integrate_echo.
+static void BM_IntegrateEcho(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    GridSensor sensor;
+    const EchoWorkload& echo_workload = workload();
+    size_t f = 0;
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            sensor.integrate_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+}
+BENCHMARK(BM_IntegrateEcho)->Apply(map_sizes);
+
+// Same echoes through the range and angle dependent sensor model.
+static void BM_IntegrateWeightedEcho(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    GridSensor sensor;
+    sensor.set_model(GridSensorModel(WORKLOAD_FOV, WORKLOAD_MAX_RANGE));
+    const EchoWorkload& echo_workload = workload();
+    size_t f = 0;
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            sensor.integrate_weighted_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+}
+BENCHMARK(BM_IntegrateWeightedEcho)->Apply(map_sizes);
+
+// Same echoes through the footprint cache, warmed up by the first pass over the workload.
+static void BM_FootprintEcho(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    GridSensor sensor;
+    BeamFootprintCache cache;
+    const EchoWorkload& echo_workload = workload();
+    for (int i = 0; i < WORKLOAD_SENSORS; i++) {
+        cache.set_sensor(i, echo_workload.sensors[i].fov, echo_workload.sensors[i].max_range);
+    }
+    size_t f = 0;
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            cache.integrate_echo(map, sensor, echo.sensor_id, echo_workload.sensor_pose(frame, echo.sensor_id),
+                echo.range);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+    state.counters["hit_ratio"] = static_cast<double>(cache.stats().hits)
+        / std::max<size_t>(1, cache.stats().hits + cache.stats().misses);
+}
+BENCHMARK(BM_FootprintEcho)->Apply(map_sizes);
+
+// Same echoes into a layered map, range(1) selects the attribute planes, 0 leaves only log odds.
+static void BM_LayeredEcho(benchmark::State& state)
+{
+    const int size = state.range(0);
+    LayeredGridMap map(RESOLUTION, size, size, Eigen::Vector3d::Zero(), static_cast<uint32_t>(state.range(1)));
+    GridSensor sensor;
+    const EchoWorkload& echo_workload = workload();
+    size_t f = 0;
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            map.integrate_echo(sensor, echo.sensor_id, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range, static_cast<uint32_t>(f + 1));
+        }
+        f++;
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+}
+BENCHMARK(BM_LayeredEcho)->ArgsProduct({{WIDTH, 1000}, {0, GRID_LAYER_HIT_COUNT, GRID_LAYER_ALL}});
+
+// Whole frames through the parallel frame fusion, range(1) threads.
+static void BM_FrameFusion(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    GridSensor sensor;
+    GridFrameFusion fusion(state.range(1));
+    const EchoWorkload& echo_workload = workload();
+    for (int i = 0; i < WORKLOAD_SENSORS; i++) {
+        const WorkloadSensor& mount = echo_workload.sensors[i];
+        fusion.set_sensor(i, mount.mount_pose, mount.fov, mount.max_range);
+    }
+    size_t f = 0;
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        fusion.integrate_frame(map, sensor, frame.vehicle_pose, frame.echoes);
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+}
+BENCHMARK(BM_FrameFusion)->ArgsProduct({{WIDTH, 1000}, {1, 4}})->UseRealTime();
+
+// One frame of timestamped echoes and its odometry through the ingest queues, drained by process
+// on the calling thread, with the echo stamps spread over the frame.
+static void BM_IngestFrame(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    GridSensor sensor;
+    const EchoWorkload& echo_workload = workload();
+    GridEchoIngest ingest(map, sensor);
+    for (int i = 0; i < WORKLOAD_SENSORS; i++) {
+        const WorkloadSensor& mount = echo_workload.sensors[i];
+        ingest.fusion().set_sensor(i, mount.mount_pose, mount.fov, mount.max_range);
+    }
+    const double frame_period = 0.05;
+    size_t f = 0;
+    ingest.push_odometry(GridOdometrySample{0.0, echo_workload.frames[0].vehicle_pose});
+    for (auto _ : state) {
+        const WorkloadFrame& frame = echo_workload.frames[f % echo_workload.frames.size()];
+        const WorkloadFrame& next = echo_workload.frames[(f + 1) % echo_workload.frames.size()];
+        ingest.push_odometry(GridOdometrySample{(f + 1) * frame_period, next.vehicle_pose});
+        for (const GridEcho& echo : frame.echoes) {
+            ingest.push_echo(GridTimedEcho{(f + echo.sensor_id / double(WORKLOAD_SENSORS)) * frame_period,
+                echo.sensor_id, echo.range});
+        }
+        ingest.process();
+        f++;
+    }
+    state.SetItemsProcessed(state.iterations() * WORKLOAD_SENSORS);
+}
+BENCHMARK(BM_IngestFrame)->Apply(map_sizes);
+
+static void BM_Classify(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    GridBitmask occupied;
+    GridBitmask free;
+    for (auto _ : state) {
+        map.classify(occupied, free);
+        benchmark::DoNotOptimize(occupied.row(0));
+    }
+    state.SetItemsProcessed(state.iterations() * map.width() * map.height());
+}
+BENCHMARK(BM_Classify)->Apply(map_sizes);
+
+// The per cell conversion the occupancy export replaces, log_odds_to_prob into a new vector.
+static void BM_OccupancyReference(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    for (auto _ : state) {
+        std::vector<int8_t> data(map.width() * map.height());
+        for (int y = 0; y < map.height(); y++) {
+            for (int x = 0; x < map.width(); x++) {
+                float log_odds = map(x, y).log_odds();
+                data[y * map.width() + x] = log_odds == 0.0f ? -1
+                    : static_cast<int8_t>(std::lround(100.0f * GridCell::log_odds_to_prob(log_odds)));
+            }
+        }
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations() * map.width() * map.height());
+}
+BENCHMARK(BM_OccupancyReference)->Apply(map_sizes);
+
+static void BM_OccupancyExport(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    GridOccupancyExporter exporter;
+    std::vector<int8_t> data(map.width() * map.height());
+    for (auto _ : state) {
+        exporter.export_map(map, data.data(), data.size());
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations() * map.width() * map.height());
+}
+BENCHMARK(BM_OccupancyExport)->Apply(map_sizes);
+
+// Dirty-only refresh after each frame of the workload, the window following the vehicle.
+static void BM_OccupancyExportChanged(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    map.set_rolling(true);
+    GridSensor sensor;
+    GridOccupancyExporter exporter;
+    GridOccupancyStamp stamp = {};
+    std::vector<int8_t> data(map.width() * map.height());
+    exporter.export_changed(map, data.data(), data.size(), stamp);
+    const EchoWorkload& echo_workload = workload();
+    size_t f = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            sensor.integrate_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range);
+        }
+        map.recenter_to(frame.vehicle_pose);
+        state.ResumeTiming();
+        exporter.export_changed(map, data.data(), data.size(), stamp);
+        benchmark::DoNotOptimize(data.data());
+    }
+}
+BENCHMARK(BM_OccupancyExportChanged)->Apply(map_sizes);
+
+// Messages of the delta encoder between workload frames, the window following the vehicle and the
+// keyframes included. bytes_per_frame compares with the raw map size.
+static void BM_DeltaEncode(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    map.set_rolling(true);
+    GridSensor sensor;
+    GridDeltaEncoder encoder;
+    std::vector<uint8_t> message;
+    encoder.encode(map, message);
+    const EchoWorkload& echo_workload = workload();
+    size_t f = 0;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        const WorkloadFrame& frame = echo_workload.frames[f++ % echo_workload.frames.size()];
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            sensor.integrate_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range);
+        }
+        map.recenter_to(frame.vehicle_pose);
+        state.ResumeTiming();
+        encoder.encode(map, message);
+        bytes += message.size();
+    }
+    state.counters["bytes_per_frame"] = static_cast<double>(bytes) / state.iterations();
+    state.counters["raw_bytes"] = static_cast<double>(sizeof(GridCell)) * map.width() * map.height();
+}
+BENCHMARK(BM_DeltaEncode)->Apply(map_sizes);
+
+// Receiver side of BM_DeltaEncode, the messages are recorded first.
+static void BM_DeltaApply(benchmark::State& state)
+{
+    const int frames = 200;
+    GridMap map = make_observed_map(state.range(0));
+    map.set_rolling(true);
+    GridSensor sensor;
+    GridDeltaEncoder encoder(DEFAULT_DELTA_QUANT_STEP, frames + 1);
+    std::vector<std::vector<uint8_t> > messages(frames + 1);
+    encoder.encode(map, messages[0]);
+    const EchoWorkload& echo_workload = workload();
+    for (int f = 1; f <= frames; f++) {
+        const WorkloadFrame& frame = echo_workload.frames[f];
+        for (const GridEcho& echo : frame.echoes) {
+            const WorkloadSensor& mount = echo_workload.sensors[echo.sensor_id];
+            sensor.integrate_echo(map, echo_workload.sensor_pose(frame, echo.sensor_id), echo.range,
+                mount.fov, mount.max_range);
+        }
+        map.recenter_to(frame.vehicle_pose);
+        encoder.encode(map, messages[f]);
+    }
+
+    GridMap receiver = make_map(state.range(0));
+    GridDeltaDecoder decoder;
+    decoder.apply(messages[0].data(), messages[0].size(), receiver);
+    size_t f = 1;
+    for (auto _ : state) {
+        if (f > static_cast<size_t>(frames)) {
+            state.PauseTiming();
+            decoder.apply(messages[0].data(), messages[0].size(), receiver);
+            f = 1;
+            state.ResumeTiming();
+        }
+        decoder.apply(messages[f].data(), messages[f].size(), receiver);
+        f++;
+    }
+}
+BENCHMARK(BM_DeltaApply)->Apply(map_sizes);
+
+// extend_map in direction range(1), on a shifted map when range(2) is 0 and a rolling one otherwise.
+static void BM_ExtendMap(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    map.set_rolling(state.range(2) != 0);
+    const uint8_t direction = static_cast<uint8_t>(state.range(1));
+    for (auto _ : state) {
+        map.extend_map(direction);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * map.storage_size() * sizeof(GridCell));
+}
+BENCHMARK(BM_ExtendMap)->ArgsProduct({{WIDTH, 1000},
+    {ExtZoneType::TOP, ExtZoneType::LEFT, ExtZoneType::DOWN, ExtZoneType::RIGHT}, {0, 1}});
+
+// extend_map of a layered map with all planes, shifted when range(1) is 0 and rolling otherwise.
+static void BM_LayeredExtendMap(benchmark::State& state)
+{
+    const int size = state.range(0);
+    LayeredGridMap map(RESOLUTION, size, size, Eigen::Vector3d::Zero());
+    map.set_rolling(state.range(1) != 0);
+    for (auto _ : state) {
+        map.extend_map(ExtZoneType::RIGHT);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_LayeredExtendMap)->ArgsProduct({{WIDTH, 1000}, {0, 1}});
+
+// recenter_to following a vehicle that drives half a cell per step on a rolling map.
+static void BM_RecenterTo(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    map.set_rolling(true);
+    Eigen::Vector3d pose(0.0, 0.0, 0.0);
+    const double step = 0.5 * RESOLUTION;
+    for (auto _ : state) {
+        pose.x() += step;
+        map.recenter_to(pose);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_RecenterTo)->Apply(map_sizes);
+
+static void BM_Copy(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    for (auto _ : state) {
+        GridMap copy(map);
+        benchmark::DoNotOptimize(&copy(0));
+    }
+    state.SetBytesProcessed(state.iterations() * map.storage_size() * sizeof(GridCell));
+}
+BENCHMARK(BM_Copy)->Apply(map_sizes);
+
+static void BM_Assign(benchmark::State& state)
+{
+    GridMap map = make_observed_map(state.range(0));
+    GridMap copy = make_map(state.range(0));
+    for (auto _ : state) {
+        copy = map;
+        benchmark::DoNotOptimize(&copy(0));
+    }
+    state.SetBytesProcessed(state.iterations() * map.storage_size() * sizeof(GridCell));
+}
+BENCHMARK(BM_Assign)->Apply(map_sizes);
+
+// Random points over the map and a margin around it, half of them outside.
+static Eigen::Matrix2Xd make_points(const GridMap& map, int n)
+{
+    std::mt19937 rng(WORKLOAD_SEED);
+    std::uniform_real_distribution<double> uniform(-0.7 * map.width() * map.resolution(),
+        0.7 * map.width() * map.resolution());
+    Eigen::Matrix2Xd points(2, n);
+    for (int i = 0; i < n; i++) {
+        points.col(i) << uniform(rng), uniform(rng);
+    }
+    return points;
+}
+
+const int CONVERSION_POINTS = 4096;
+const Eigen::Vector3d CONVERSION_FRAME(1.2, -0.4, 0.3);     // Vehicle pose the points are measured in.
+
+// Per point vehicle to map transform and xy_to_idx, the way echo points used to be projected.
+static void BM_XyToIdx(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    const Eigen::Matrix2Xd points = make_points(map, CONVERSION_POINTS);
+    const double c = std::cos(CONVERSION_FRAME.z());
+    const double s = std::sin(CONVERSION_FRAME.z());
+    Eigen::Matrix2Xi indices(2, CONVERSION_POINTS);
+    std::vector<uint8_t> in_border(CONVERSION_POINTS);
+    for (auto _ : state) {
+        for (int i = 0; i < CONVERSION_POINTS; i++) {
+            double x = CONVERSION_FRAME.x() + c * points(0, i) - s * points(1, i);
+            double y = CONVERSION_FRAME.y() + s * points(0, i) + c * points(1, i);
+            in_border[i] = map.xy_to_idx(x, y, indices(0, i), indices(1, i));
+        }
+        benchmark::DoNotOptimize(indices.data());
+    }
+    state.SetItemsProcessed(state.iterations() * CONVERSION_POINTS);
+}
+BENCHMARK(BM_XyToIdx)->Apply(map_sizes);
+
+static void BM_PointsToIndices(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    const Eigen::Matrix2Xd points = make_points(map, CONVERSION_POINTS);
+    Eigen::Matrix2Xi indices;
+    std::vector<uint8_t> in_border;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.points_to_indices(points, CONVERSION_FRAME, indices, in_border));
+    }
+    state.SetItemsProcessed(state.iterations() * CONVERSION_POINTS);
+}
+BENCHMARK(BM_PointsToIndices)->Apply(map_sizes);
+
+static void BM_IndicesToPoints(benchmark::State& state)
+{
+    GridMap map = make_map(state.range(0));
+    Eigen::Matrix2Xi indices;
+    std::vector<uint8_t> in_border;
+    map.points_to_indices(make_points(map, CONVERSION_POINTS), Eigen::Vector3d::Zero(), indices, in_border);
+    Eigen::Matrix2Xd points;
+    for (auto _ : state) {
+        map.indices_to_points(indices, points);
+        benchmark::DoNotOptimize(points.data());
+    }
+    state.SetItemsProcessed(state.iterations() * CONVERSION_POINTS);
+}
+BENCHMARK(BM_IndicesToPoints)->Apply(map_sizes);
+
+// Cost of one instrumented event when GRID_MAP_METRICS is on, for a timer period of range(0).
+static void BM_MetricsTimer(benchmark::State& state)
+{
+    grid_metrics().set_timer_period(static_cast<uint32_t>(state.range(0)));
+    for (auto _ : state) {
+        GridScopedTimer timer(GridPhase::EXTRACT);
+        benchmark::ClobberMemory();
+    }
+    grid_metrics().set_timer_period(DEFAULT_METRICS_TIMER_PERIOD);
+    grid_metrics().reset();
+}
+BENCHMARK(BM_MetricsTimer)->Arg(1)->Arg(DEFAULT_METRICS_TIMER_PERIOD);
+
+static void BM_MetricsHistogram(benchmark::State& state)
+{
+    GridHistogram histogram;
+    uint64_t value = 1;
+    for (auto _ : state) {
+        histogram.record(value);
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+        benchmark::DoNotOptimize(histogram.count);
+    }
+}
+BENCHMARK(BM_MetricsHistogram);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Default parameter values.
+const size_t GRID_STORAGE_ALIGNMENT = 64;   // Cache line, also a multiple of the widest SIMD register.
+
+// Source of the cell buffers of maps, see BasicGridMap::set_allocator.
+// allocate returns GRID_STORAGE_ALIGNMENT aligned memory or nullptr, it must not throw.
+class GridAllocator
+{
+public:
+    virtual ~GridAllocator() {}
+    virtual void* allocate(size_t bytes) = 0;
+    virtual void deallocate(void* ptr, size_t bytes) = 0;
+};
+
+// The default allocator, aligned nothrow operator new.
+class GridHeapAllocator : public GridAllocator
+{
+public:
+    void* allocate(size_t bytes) override
+    {
+        return ::operator new(bytes, std::align_val_t(GRID_STORAGE_ALIGNMENT), std::nothrow);
+    }
+
+    void deallocate(void* ptr, size_t) override
+    {
+        ::operator delete(ptr, std::align_val_t(GRID_STORAGE_ALIGNMENT));
+    }
+};
+
+inline GridAllocator* grid_default_allocator()
+{
+    static GridHeapAllocator allocator;
+    return &allocator;
+}
+
+// Bump allocator over a caller owned region, e.g. a static array or huge page backed memory mapped at
+// startup, so maps never reach the heap. Only the most recent block is given back by deallocate,
+// the others stay used until reset(). Not thread-safe.
+class GridArenaAllocator : public GridAllocator
+{
+public:
+    GridArenaAllocator(void* memory, size_t bytes)
+    {
+        _memory = static_cast<uint8_t*>(memory);
+        _capacity = bytes;
+        _used = 0;
+        _last = 0;
+    }
+
+    void* allocate(size_t bytes) override
+    {
+        // Blocks start aligned relative to the absolute address, not to the arena start.
+        uintptr_t base = reinterpret_cast<uintptr_t>(_memory);
+        size_t begin = ((base + _used + GRID_STORAGE_ALIGNMENT - 1) & ~(GRID_STORAGE_ALIGNMENT - 1)) - base;
+        if (begin > _capacity || bytes > _capacity - begin) return nullptr;
+        _last = _used;
+        _used = begin + bytes;
+        return _memory + begin;
+    }
+
+    void deallocate(void* ptr, size_t bytes) override
+    {
+        uint8_t* block = static_cast<uint8_t*>(ptr);
+        if (block + bytes == _memory + _used) {
+            _used = _last;
+        }
+    }
+
+    void reset()
+    {
+        _used = 0;
+        _last = 0;
+    }
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _used; }
+
+private:
+    uint8_t* _memory;
+    size_t _capacity;   // [bytes].
+    size_t _used;       // Bytes up to the end of the last block.
+    size_t _last;       // _used before the last block.
+};
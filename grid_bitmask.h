@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One bit per cell of a width x height grid in logical row-major order.
+// Every row starts at a 64-bit word boundary, so rows can be filled and scanned independently.
+class GridBitmask
+{
+public:
+    GridBitmask(int width = 0, int height = 0)
+    {
+        resize(width, height);
+    }
+
+    void resize(int width, int height)
+    {
+        _width = width;
+        _height = height;
+        _words_per_row = (width + 63) / 64;
+        _words.assign(static_cast<size_t>(_words_per_row) * height, 0);
+    }
+
+    void clear()
+    {
+        _words.assign(_words.size(), 0);
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int words_per_row() const { return _words_per_row; }
+
+    bool test(int idx_x, int idx_y) const
+    {
+        return (row(idx_y)[idx_x >> 6] >> (idx_x & 63)) & 1u;
+    }
+
+    void set(int idx_x, int idx_y)
+    {
+        row(idx_y)[idx_x >> 6] |= uint64_t(1) << (idx_x & 63);
+    }
+
+    void reset(int idx_x, int idx_y)
+    {
+        row(idx_y)[idx_x >> 6] &= ~(uint64_t(1) << (idx_x & 63));
+    }
+
+    uint64_t* row(int idx_y) { return &_words[static_cast<size_t>(idx_y) * _words_per_row]; }
+    const uint64_t* row(int idx_y) const { return &_words[static_cast<size_t>(idx_y) * _words_per_row]; }
+
+    // Number of set bits.
+    int count() const
+    {
+        int n = 0;
+        for (uint64_t word : _words) {
+            n += __builtin_popcountll(word);
+        }
+        return n;
+    }
+
+    // ORs the low nbits (<= 57) of bits into the row starting at bit pos.
+    static void or_bits(uint64_t* words, int pos, uint64_t bits, int nbits)
+    {
+        int shift = pos & 63;
+        words[pos >> 6] |= bits << shift;
+        if (shift + nbits > 64) {
+            words[(pos >> 6) + 1] |= bits >> (64 - shift);
+        }
+    }
+
+    // Reads nbits (<= 57) bits of the row starting at bit pos.
+    static uint64_t read_bits(const uint64_t* words, int pos, int nbits)
+    {
+        int shift = pos & 63;
+        uint64_t bits = words[pos >> 6] >> shift;
+        if (shift + nbits > 64) {
+            bits |= words[(pos >> 6) + 1] << (64 - shift);
+        }
+        return bits & ((uint64_t(1) << nbits) - 1);
+    }
+
+private:
+    int _width;                     // Grid width [cells].
+    int _height;                    // Grid height [cells].
+    int _words_per_row;             // Row stride [64-bit words].
+    std::vector<uint64_t> _words;
+};
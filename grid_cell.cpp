@@ -1,5 +1,7 @@
 #include "grid_cell.h"
 
-const float GridCell::s_log_odds_occupied_thre = GridCell::prob_to_log_odds(0.97f);
-const float GridCell::s_log_odds_free_thre = GridCell::prob_to_log_odds(0.10f);
+constexpr float GridCellTraits<float>::scale;
 
+template class BasicGridCell<float>;
+template class BasicGridCell<int16_t>;
+template class BasicGridCell<int8_t>;
@@ -1,17 +1,88 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
+
+constexpr float LOG_ODDS_LIMIT = 50.0f;    // Updates stop pushing a cell further once it passes +/-LOG_ODDS_LIMIT.
+
+// Occupancy thresholds, prob_to_log_odds(0.97f) and prob_to_log_odds(0.10f) folded at compile time.
+constexpr float LOG_ODDS_OCCUPIED_THRE = 3.4760987f;
+constexpr float LOG_ODDS_FREE_THRE = -2.1972246f;
+
+// Storage traits of a cell value type, scale is the number of raw units per log odds unit.
+template <typename T>
+struct GridCellTraits;
+
+template <>
+struct GridCellTraits<float>
+{
+    static constexpr float scale = 1.0f;
+
+    static constexpr float to_raw(float log_odds)
+    {
+        return log_odds;
+    }
+
+    static void update(float & val, float mea_log_odds)
+    {
+        // It will be too big, so it`s meaningless for cal probability
+        if ((mea_log_odds > 0.0f && val < LOG_ODDS_LIMIT)
+            || (mea_log_odds < 0.0f && val > -LOG_ODDS_LIMIT)) {
+            val += mea_log_odds;
+        }
+    }
+};
+
+// Fixed-point log odds with Scale raw units per log odds unit, saturating at +/-LOG_ODDS_LIMIT.
+template <typename T, int Scale>
+struct FixedPointCellTraits
+{
+    static constexpr float scale = static_cast<float>(Scale);
+    static constexpr int limit = static_cast<int>(LOG_ODDS_LIMIT * Scale);
+
+    static constexpr T to_raw(float log_odds)
+    {
+        return log_odds * Scale >= limit ? static_cast<T>(limit)
+            : log_odds * Scale <= -limit ? static_cast<T>(-limit)
+            : static_cast<T>(log_odds >= 0.0f ? log_odds * Scale + 0.5f : log_odds * Scale - 0.5f);
+    }
+
+    static void update(T & val, T mea_log_odds)
+    {
+        int sum = val + mea_log_odds;
+        sum = sum > limit ? limit : sum;
+        sum = sum < -limit ? -limit : sum;
+        val = static_cast<T>(sum);
+    }
+};
+
+template <typename T, int Scale>
+constexpr float FixedPointCellTraits<T, Scale>::scale;
+template <typename T, int Scale>
+constexpr int FixedPointCellTraits<T, Scale>::limit;
+
+template <>
+struct GridCellTraits<int16_t> : FixedPointCellTraits<int16_t, 256> {};    // Q8.8, 1/256 log odds per unit.
+
+template <>
+struct GridCellTraits<int8_t> : FixedPointCellTraits<int8_t, 2> {};        // 1/2 log odds per unit.
 
 // Provides a log odds of occupancy probability representation for cells in a occupancy grid map.
-class GridCell
+// T is the storage type of the log odds, float or a fixed-point int16_t/int8_t, see GridCellTraits.
+// Raw values and update increments are in the fixed-point scale of T, see to_raw.
+template <typename T>
+class BasicGridCell
 {
 public:
-    float _log_odds_val; // The log odds representation of occupancy probability.
+    typedef T value_type;
+    typedef GridCellTraits<T> traits_type;
+
+    T _log_odds_val; // The log odds representation of occupancy probability.
 
 public:
     // Reset Cell to prior probability.
     void reset_value()
     {
-        _log_odds_val = 0.0f;
+        _log_odds_val = 0;
     }
 
     bool is_occupied() const
@@ -24,13 +95,36 @@ public:
         return _log_odds_val < s_log_odds_free_thre;
     }
 
-    void update(float mea_log_odds)
+    void update(T mea_log_odds)
     {
-        // It will be too big, so it`s meaningless for cal probability
-        if ((mea_log_odds > 0.0f && _log_odds_val < 50.0f) 
-            || (mea_log_odds < 0.0f && _log_odds_val > -50.0f)) {   
-            _log_odds_val += mea_log_odds;
-        }
+        traits_type::update(_log_odds_val, mea_log_odds);
+    }
+
+    // Same as update, but safe against update_atomic calls on the same cell from other threads.
+    // A compare-and-swap loop keeps the saturation of update, plain accesses must not race with it.
+    void update_atomic(T mea_log_odds)
+    {
+        T expected;
+        T desired;
+        __atomic_load(&_log_odds_val, &expected, __ATOMIC_RELAXED);
+        do {
+            desired = expected;
+            traits_type::update(desired, mea_log_odds);
+            if (desired == expected) return;
+        } while (!__atomic_compare_exchange(&_log_odds_val, &expected, &desired, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    // The log odds value in log odds units.
+    float log_odds() const
+    {
+        return _log_odds_val * (1.0f / traits_type::scale);
+    }
+
+    // Converts a log odds value to the storage scale of the cell.
+    static constexpr T to_raw(float log_odds)
+    {
+        return traits_type::to_raw(log_odds);
     }
 
     static float prob_to_log_odds(float prob)
@@ -44,9 +138,25 @@ public:
         float odds = std::exp(log_odds);
         return odds / (odds + 1.0f);
     }
-    
+
+    static T log_odds_occupied_thre() { return s_log_odds_occupied_thre; }
+    static T log_odds_free_thre() { return s_log_odds_free_thre; }
+
 private:
-    static const float s_log_odds_occupied_thre;
-    static const float s_log_odds_free_thre;
+    static constexpr T s_log_odds_occupied_thre = traits_type::to_raw(LOG_ODDS_OCCUPIED_THRE);
+    static constexpr T s_log_odds_free_thre = traits_type::to_raw(LOG_ODDS_FREE_THRE);
 };
 
+template <typename T>
+constexpr T BasicGridCell<T>::s_log_odds_occupied_thre;
+template <typename T>
+constexpr T BasicGridCell<T>::s_log_odds_free_thre;
+
+typedef BasicGridCell<float> GridCell;
+typedef BasicGridCell<int16_t> GridCell16;
+typedef BasicGridCell<int8_t> GridCell8;
+
+// Instantiated once in grid_cell.cpp.
+extern template class BasicGridCell<float>;
+extern template class BasicGridCell<int16_t>;
+extern template class BasicGridCell<int8_t>;
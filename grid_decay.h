@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_simd.h"
+
+// Default parameter values.
+const float DEFAULT_DECAY_TIME_CONSTANT = 10.0f;    // Log odds fall to 1/e of their value in 10s without measurements.
+const int DEFAULT_DECAY_TILES_PER_STEP = 32;        // A 300x300 map of 16x16 tiles is swept in 12 steps.
+
+// Amortized forgetting of a map toward the prior, so ghost echoes and moved obstacles fade out.
+// Every step decays the next tiles_per_step layout tiles in round-robin order by exp(-dt / time_constant),
+// dt being the time since the tile was decayed last, so the result does not depend on the sweep rate,
+// for fixed-point cells in expectation, see GridKernel::scale. Decayed tiles are marked dirty.
+template <typename CellT = GridCell>
+class BasicGridDecay
+{
+public:
+    BasicGridDecay(float time_constant = DEFAULT_DECAY_TIME_CONSTANT,
+        int tiles_per_step = DEFAULT_DECAY_TILES_PER_STEP)
+    {
+        _time_constant = time_constant;
+        _tiles_per_step = tiles_per_step;
+        _next_tile = 0;
+        _dither = 0;
+    }
+
+    void set_time_constant(float time_constant) { _time_constant = time_constant; }
+    void set_tiles_per_step(int tiles_per_step) { _tiles_per_step = tiles_per_step; }
+    float time_constant() const { return _time_constant; }
+    int tiles_per_step() const { return _tiles_per_step; }
+
+    // Decays the next tiles of map, now is the current time [s]. The first step of a map only
+    // starts the tile clocks. Tile clocks stay with the tile position when the window moves, which
+    // shifts the decay of moved cells by at most one sweep.
+    void step(BasicGridMap<CellT>& map, double now)
+    {
+        GRID_METRICS_TIMER(GridPhase::DECAY);
+        const int tiles = map.tiles_x() * map.tiles_y();
+        if (static_cast<int>(_tile_time.size()) != tiles) {
+            _tile_time.assign(tiles, now);
+            _next_tile = 0;
+            return;
+        }
+
+        const int count = std::min(_tiles_per_step, tiles);
+        for (int i = 0; i < count; i++) {
+            int tile = _next_tile;
+            _next_tile = _next_tile + 1 < tiles ? _next_tile + 1 : 0;
+
+            double dt = now - _tile_time[tile];
+            _tile_time[tile] = now;
+            if (dt <= 0.0) continue;
+
+            float factor = static_cast<float>(std::exp(-dt / _time_constant));
+            GridRegion region = map.tile_region(tile % map.tiles_x(), tile / map.tiles_x());
+            map.dirty().mark_region(region.x_begin, region.y_begin, region.x_end, region.y_end);
+            map.for_each_run(region, [&](CellT* cell, int, int, int run) {
+                _dither = _dither * 1664525u + 1013904223u;
+                GridKernel::scale(&cell->_log_odds_val, run, factor, _dither >> 16);
+            });
+        }
+    }
+
+    // Forgets the tile clocks, the next step restarts them.
+    void reset()
+    {
+        _tile_time.clear();
+        _next_tile = 0;
+    }
+
+private:
+    float _time_constant;               // Decay time constant [s].
+    int _tiles_per_step;                // Tiles decayed per step.
+    int _next_tile;                     // Next tile of the sweep, row-major tile index.
+    std::vector<double> _tile_time;     // Time each tile was decayed last [s].
+    uint32_t _dither;                   // LCG of the fixed-point rounding, its upper bits start each run.
+};
+
+typedef BasicGridDecay<GridCell> GridDecay;
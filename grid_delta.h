@@ -0,0 +1,376 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+
+// Default parameter values.
+const int GRID_DELTA_VERSION = 1;
+const float DEFAULT_DELTA_QUANT_STEP = 0.5f;        // Log odds per quantization step, +/-LOG_ODDS_LIMIT fits int8.
+const int DEFAULT_DELTA_KEYFRAME_INTERVAL = 50;     // Messages per keyframe, the first message is always one.
+const uint64_t GRID_DELTA_MAX_CELLS = 1u << 26;     // Largest width x height a message may describe.
+
+// Message header, host byte order. The regions follow, each as a GridDeltaRegion and its cells.
+struct GridDeltaHeader
+{
+    char magic[4];              // "UGDL".
+    uint16_t version;
+    uint8_t keyframe;           // 1 when the message holds every cell and needs no base.
+    uint8_t reserved0;
+    uint32_t sequence;          // Number of the message, 1 for the first one.
+    uint32_t base;              // Sequence the receiver must hold to apply a delta.
+    float resolution;           // [m/cell].
+    float quant_step;           // Log odds per quantized unit.
+    int32_t width;              // [cells].
+    int32_t height;             // [cells].
+    int32_t shift_x;            // Window shift since base [cells], applied before the regions.
+    int32_t shift_y;
+    uint32_t regions;
+    double origin_x;            // Left-down corner of cell (0, 0) after the shift [m].
+    double origin_y;
+};
+static_assert(sizeof(GridDeltaHeader) == 64, "The header layout is part of the message format.");
+
+// Logical region of a message, its cells follow in row-major order as a PackBits stream of int8
+// quantized log odds: a control byte c < 128 is followed by c + 1 literals, c >= 128 by one value
+// repeated c - 125 times.
+struct GridDeltaRegion
+{
+    int32_t x_begin;
+    int32_t y_begin;
+    int32_t x_end;
+    int32_t y_end;
+    uint32_t bytes;             // Size of the PackBits stream.
+};
+static_assert(sizeof(GridDeltaRegion) == 20, "The region layout is part of the message format.");
+
+// Encodes a map as a stream of messages for a receiver holding a copy of it: periodic keyframes with
+// all cells, and in between deltas with the dirty tiles since the previous message and the window
+// shift, which the receiver replays instead of receiving the moved cells again. Cells are quantized
+// to int8 steps of quant_step log odds and sent as absolute values, so quantization never drifts.
+// Encode from the thread writing the map.
+template <typename CellT = GridCell>
+class BasicGridDeltaEncoder
+{
+public:
+    explicit BasicGridDeltaEncoder(float quant_step = DEFAULT_DELTA_QUANT_STEP,
+        int keyframe_interval = DEFAULT_DELTA_KEYFRAME_INTERVAL)
+    {
+        _quant_step = quant_step;
+        _keyframe_interval = std::max(1, keyframe_interval);
+        _sequence = 0;
+        _since_keyframe = 0;
+        _force_keyframe = true;
+        _epoch = 0;
+        _shift_x = 0;
+        _shift_y = 0;
+        _width = 0;
+        _height = 0;
+        _resolution = 0.0f;
+    }
+
+    uint32_t sequence() const { return _sequence; }
+
+    // The next message is a keyframe, e.g. after the receiver lost one.
+    void request_keyframe() { _force_keyframe = true; }
+
+    // Writes the next message for map to out, returns whether it is a keyframe.
+    bool encode(const BasicGridMap<CellT>& map, std::vector<uint8_t>& out)
+    {
+        const GridDirtyTracker& dirty = map.dirty();
+        const long long dx = dirty.shift_x() - _shift_x;
+        const long long dy = dirty.shift_y() - _shift_y;
+        const bool keyframe = _force_keyframe || _since_keyframe + 1 >= _keyframe_interval
+            || map.width() != _width || map.height() != _height || map.resolution() != _resolution
+            || std::llabs(dx) >= map.width() || std::llabs(dy) >= map.height();
+
+        GridDeltaHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "UGDL", 4);
+        header.version = GRID_DELTA_VERSION;
+        header.keyframe = keyframe;
+        header.sequence = _sequence + 1;
+        header.base = keyframe ? 0 : _sequence;
+        header.resolution = map.resolution();
+        header.quant_step = _quant_step;
+        header.width = map.width();
+        header.height = map.height();
+        header.shift_x = keyframe ? 0 : static_cast<int32_t>(dx);
+        header.shift_y = keyframe ? 0 : static_cast<int32_t>(dy);
+        header.origin_x = map.origin().x();
+        header.origin_y = map.origin().y();
+
+        out.assign(sizeof(header), 0);
+        const uint32_t now = dirty.checkpoint();
+        if (keyframe) {
+            append_region(map, GridRegion{0, 0, map.width(), map.height()}, out);
+            header.regions = 1;
+        } else {
+            dirty.for_each_changed(_epoch, [&](const GridRegion& region) {
+                append_region(map, region, out);
+                header.regions++;
+            });
+        }
+        std::memcpy(out.data(), &header, sizeof(header));
+
+        _sequence++;
+        _since_keyframe = keyframe ? 0 : _since_keyframe + 1;
+        _force_keyframe = false;
+        _epoch = now;
+        _shift_x = dirty.shift_x();
+        _shift_y = dirty.shift_y();
+        _width = map.width();
+        _height = map.height();
+        _resolution = map.resolution();
+        return keyframe;
+    }
+
+private:
+    float _quant_step;
+    int _keyframe_interval;
+    uint32_t _sequence;             // Sequence of the last message.
+    int _since_keyframe;            // Deltas since the last keyframe.
+    bool _force_keyframe;
+    uint32_t _epoch;                // Dirty epoch covered by the last message.
+    long long _shift_x;             // Window shift at the last message.
+    long long _shift_y;
+    int _width;                     // Geometry of the last message.
+    int _height;
+    float _resolution;
+    std::vector<int8_t> _quantized; // Cells of the region being encoded.
+
+    void append_region(const BasicGridMap<CellT>& map, const GridRegion& region, std::vector<uint8_t>& out)
+    {
+        const int w = region.x_end - region.x_begin;
+        _quantized.resize(static_cast<size_t>(w) * (region.y_end - region.y_begin));
+        const float inv_step = 1.0f / _quant_step;
+        map.for_each_run(region, [&](const CellT* cell, int x, int y, int run) {
+            int8_t* dst = &_quantized[static_cast<size_t>(y - region.y_begin) * w + x - region.x_begin];
+            for (int i = 0; i < run; i++) {
+                float q = std::nearbyint(cell[i].log_odds() * inv_step);
+                dst[i] = static_cast<int8_t>(std::max(-127.0f, std::min(127.0f, q)));
+            }
+        });
+
+        const size_t at = out.size();
+        out.resize(at + sizeof(GridDeltaRegion));
+        pack_bits(_quantized.data(), _quantized.size(), out);
+        GridDeltaRegion header = {region.x_begin, region.y_begin, region.x_end, region.y_end,
+            static_cast<uint32_t>(out.size() - at - sizeof(GridDeltaRegion))};
+        std::memcpy(&out[at], &header, sizeof(header));
+    }
+
+    static void pack_bits(const int8_t* data, size_t n, std::vector<uint8_t>& out)
+    {
+        size_t i = 0;
+        while (i < n) {
+            size_t run = 1;
+            while (i + run < n && run < 130 && data[i + run] == data[i]) run++;
+            if (run >= 3) {
+                out.push_back(static_cast<uint8_t>(run + 125));
+                out.push_back(static_cast<uint8_t>(data[i]));
+                i += run;
+                continue;
+            }
+            // Literals up to the next run of 3 or 128 values.
+            size_t end = i;
+            while (end < n && end - i < 128
+                && !(end + 2 < n && data[end] == data[end + 1] && data[end] == data[end + 2])) {
+                end++;
+            }
+            out.push_back(static_cast<uint8_t>(end - i - 1));
+            out.insert(out.end(), reinterpret_cast<const uint8_t*>(data + i), reinterpret_cast<const uint8_t*>(data + end));
+            i = end;
+        }
+    }
+};
+
+// Applies the messages of a BasicGridDeltaEncoder to a receiver map. A delta only applies on top of
+// the message it was encoded against, after a lost message apply fails until the next keyframe.
+// Malformed, duplicate and older messages, keyframes included, are refused without touching the map
+// or the state.
+// The cells written are marked dirty, so consumers of the receiver map see the updates.
+template <typename CellT = GridCell>
+class BasicGridDeltaDecoder
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    BasicGridDeltaDecoder()
+    {
+        _sequence = 0;
+        _table_step = 0.0f;
+    }
+
+    // Sequence of the last applied message, 0 while a keyframe is needed.
+    uint32_t sequence() const { return _sequence; }
+    bool needs_keyframe() const { return _sequence == 0; }
+
+    // Forgets the applied messages, so the next keyframe applies whatever its sequence, e.g. after
+    // the encoder restarted.
+    void reset() { _sequence = 0; }
+
+    bool apply(const uint8_t* data, size_t size, BasicGridMap<CellT>& map)
+    {
+        GridDeltaHeader header;
+        if (size < sizeof(header)) {
+            std::cout << "Grid delta error: truncated message";
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, "UGDL", 4) != 0 || header.version != GRID_DELTA_VERSION
+            || header.width <= 0 || header.height <= 0 || !(header.quant_step > 0.0f)) {
+            std::cout << "Grid delta error: not a grid delta message";
+            return false;
+        }
+        if (static_cast<uint64_t>(header.width) * static_cast<uint64_t>(header.height) > GRID_DELTA_MAX_CELLS) {
+            std::cout << "Grid delta error: " << header.width << " x " << header.height << " cells is too large";
+            return false;
+        }
+        if (!geometry_valid(header) || !regions_valid(header, data, size)) {
+            std::cout << "Grid delta error: malformed message " << header.sequence;
+            return false;
+        }
+        if (_sequence != 0 && header.sequence <= _sequence) {
+            std::cout << "Grid delta error: message " << header.sequence << " is older than " << _sequence;
+            return false;
+        }
+        if (!header.keyframe && (_sequence == 0 || header.base != _sequence || header.width != map.width()
+            || header.height != map.height())) {
+            std::cout << "Grid delta error: message " << header.sequence << " needs base " << header.base
+                << ", holding " << _sequence;
+            _sequence = 0;
+            return false;
+        }
+
+        if (header.keyframe) {
+            if ((header.width != map.width() || header.height != map.height() || header.resolution != map.resolution())
+                && !map.init(header.resolution, header.width, header.height, Eigen::Vector3d::Zero())) {
+                _sequence = 0;
+                return false;
+            }
+        } else {
+            map.shift_map(header.shift_x, header.shift_y);
+        }
+        map.set_origin(Eigen::Vector2d(header.origin_x, header.origin_y));
+
+        build_table(header.quant_step);
+        size_t at = sizeof(header);
+        for (uint32_t r = 0; r < header.regions; r++) {
+            GridDeltaRegion region;
+            std::memcpy(&region, data + at, sizeof(region));
+            at += sizeof(region);
+            apply_region(region, data + at, map);
+            at += region.bytes;
+        }
+        _sequence = header.sequence;
+        return true;
+    }
+
+private:
+    uint32_t _sequence;
+    float _table_step;              // quant_step of _table.
+    value_type _table[256];         // Raw cell value of each quantized value, indexed by q + 128.
+    std::vector<int8_t> _cells;     // Unpacked cells of the region being applied.
+
+    void build_table(float step)
+    {
+        if (step == _table_step) return;
+        for (int q = -128; q < 128; q++) {
+            float log_odds = std::max(-LOG_ODDS_LIMIT, std::min(LOG_ODDS_LIMIT, q * step));
+            _table[q + 128] = CellT::to_raw(log_odds);
+        }
+        _table_step = step;
+    }
+
+    // A keyframe holds one region of the whole map and a valid resolution, a delta shifts by less
+    // than the map size, larger shifts are sent as keyframes.
+    static bool geometry_valid(const GridDeltaHeader& header)
+    {
+        if (header.keyframe) {
+            return header.regions == 1 && std::isfinite(header.resolution) && header.resolution > 0.0f
+                && header.shift_x == 0 && header.shift_y == 0;
+        }
+        return std::llabs(header.shift_x) < header.width && std::llabs(header.shift_y) < header.height;
+    }
+
+    // Checks the region headers and the PackBits streams against size before anything is written.
+    static bool regions_valid(const GridDeltaHeader& header, const uint8_t* data, size_t size)
+    {
+        size_t at = sizeof(header);
+        for (uint32_t r = 0; r < header.regions; r++) {
+            GridDeltaRegion region;
+            if (size - at < sizeof(region)) return false;
+            std::memcpy(&region, data + at, sizeof(region));
+            at += sizeof(region);
+            if (region.x_begin < 0 || region.y_begin < 0 || region.x_end > header.width || region.y_end > header.height
+                || region.x_begin >= region.x_end || region.y_begin >= region.y_end || size - at < region.bytes) {
+                return false;
+            }
+            if (header.keyframe && (region.x_begin != 0 || region.y_begin != 0 || region.x_end != header.width
+                || region.y_end != header.height)) {
+                return false;
+            }
+            const size_t cells = static_cast<size_t>(region.x_end - region.x_begin) * (region.y_end - region.y_begin);
+            if (unpacked_size(data + at, region.bytes) != cells) return false;
+            at += region.bytes;
+        }
+        return at == size;
+    }
+
+    // Number of values of a PackBits stream, or SIZE_MAX when it is cut short.
+    static size_t unpacked_size(const uint8_t* data, size_t bytes)
+    {
+        size_t n = 0;
+        size_t i = 0;
+        while (i < bytes) {
+            uint8_t c = data[i++];
+            size_t values = c < 128 ? c + 1 : c - 125;
+            size_t stream = c < 128 ? values : 1;
+            if (bytes - i < stream) return SIZE_MAX;
+            i += stream;
+            n += values;
+        }
+        return n;
+    }
+
+    void apply_region(const GridDeltaRegion& region, const uint8_t* data, BasicGridMap<CellT>& map)
+    {
+        const int w = region.x_end - region.x_begin;
+        _cells.resize(static_cast<size_t>(w) * (region.y_end - region.y_begin));
+        int8_t* dst = _cells.data();
+        size_t i = 0;
+        while (i < region.bytes) {
+            uint8_t c = data[i++];
+            if (c < 128) {
+                std::memcpy(dst, data + i, c + 1);
+                dst += c + 1;
+                i += c + 1;
+            } else {
+                std::memset(dst, data[i++], c - 125);
+                dst += c - 125;
+            }
+        }
+
+        const GridRegion logical = {region.x_begin, region.y_begin, region.x_end, region.y_end};
+        map.for_each_run(logical, [&](CellT* cell, int x, int y, int run) {
+            const int8_t* src = &_cells[static_cast<size_t>(y - region.y_begin) * w + x - region.x_begin];
+            for (int k = 0; k < run; k++) {
+                cell[k]._log_odds_val = _table[src[k] + 128];
+            }
+        });
+        map.dirty().mark_region(region.x_begin, region.y_begin, region.x_end, region.y_end);
+    }
+};
+
+typedef BasicGridDeltaEncoder<GridCell> GridDeltaEncoder;
+typedef BasicGridDeltaDecoder<GridCell> GridDeltaDecoder;
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+const int DIRTY_TILE = 16;      // Dirty tracking granularity [cells].
+
+// Half-open logical cell region [x_begin, x_end) x [y_begin, y_end).
+struct GridRegion
+{
+    int x_begin;
+    int y_begin;
+    int x_end;
+    int y_end;
+};
+
+// Tracks which DIRTY_TILE x DIRTY_TILE tiles of a map changed, stamped with an epoch.
+// A consumer keeps the epoch returned by checkpoint() and later asks for the regions changed since then:
+//
+//     uint32_t now = map.dirty().checkpoint();
+//     map.dirty().for_each_changed(last, [&](const GridRegion& region) { ... });
+//     last = now;
+//
+// When the map window moves the tile stamps move along with the cells, so the regions stay valid in
+// the logical coordinates of the shifted map, and the cleared strips coming into view are marked.
+class GridDirtyTracker
+{
+public:
+    GridDirtyTracker(int width = 0, int height = 0)
+    {
+        _epoch = 1;
+        _shift_x = 0;
+        _shift_y = 0;
+        _resets = 0;
+        resize(width, height);
+    }
+
+    // Resizes to a width x height cell map, every tile is marked as changed.
+    void resize(int width, int height)
+    {
+        _resets++;
+        _width = width;
+        _height = height;
+        _tiles_x = (width + DIRTY_TILE - 1) / DIRTY_TILE;
+        _tiles_y = (height + DIRTY_TILE - 1) / DIRTY_TILE;
+        _tile_epoch.assign(static_cast<size_t>(_tiles_x) * _tiles_y, _epoch);
+    }
+
+    // The current epoch, marks made from now on are stamped with it.
+    uint32_t epoch() const { return _epoch; }
+
+    // Closes the current epoch and returns it, later marks are stamped with a newer epoch.
+    // Only the stamp of future marks changes, so consumers holding a const map may call it.
+    // The epoch is advanced atomically so it may run alongside the *_atomic marks, see mark_atomic.
+    uint32_t checkpoint() const { return __atomic_fetch_add(&_epoch, 1, __ATOMIC_SEQ_CST); }
+
+    // Total shift of the window in cells, see shift.
+    long long shift_x() const { return _shift_x; }
+    long long shift_y() const { return _shift_y; }
+
+    // Number of resize and mark_all calls, for consumers that rebuild instead of following every tile.
+    uint32_t resets() const { return _resets; }
+
+    int tiles_x() const { return _tiles_x; }
+    int tiles_y() const { return _tiles_y; }
+
+    uint32_t tile_epoch(int tile_x, int tile_y) const
+    {
+        return _tile_epoch[tile_y * _tiles_x + tile_x];
+    }
+
+    void mark(int idx_x, int idx_y)
+    {
+        _tile_epoch[(idx_y / DIRTY_TILE) * _tiles_x + idx_x / DIRTY_TILE] = _epoch;
+    }
+
+    // Marks logical region [x_begin, x_end) x [y_begin, y_end), clipped to the map.
+    void mark_region(int x_begin, int y_begin, int x_end, int y_end)
+    {
+        x_begin = std::max(x_begin, 0);
+        y_begin = std::max(y_begin, 0);
+        x_end = std::min(x_end, _width);
+        y_end = std::min(y_end, _height);
+        if (x_begin >= x_end || y_begin >= y_end) return;
+
+        int tx_end = (x_end - 1) / DIRTY_TILE + 1;
+        int ty_end = (y_end - 1) / DIRTY_TILE + 1;
+        for (int ty = y_begin / DIRTY_TILE; ty < ty_end; ty++) {
+            uint32_t* row = &_tile_epoch[ty * _tiles_x];
+            std::fill(row + x_begin / DIRTY_TILE, row + tx_end, _epoch);
+        }
+    }
+
+    // Same as mark, may be called from several threads at once and alongside checkpoint.
+    // Call it after writing the cell. The stamp is stored again until the epoch did not move
+    // during the store, so a checkpoint racing with it either sees the final stamp in its epoch
+    // or has it stamped with a newer epoch, and the write is never skipped by both.
+    void mark_atomic(int idx_x, int idx_y)
+    {
+        mark_region_atomic(idx_x, idx_y, idx_x + 1, idx_y + 1);
+    }
+
+    // Same as mark_region, see mark_atomic.
+    void mark_region_atomic(int x_begin, int y_begin, int x_end, int y_end)
+    {
+        x_begin = std::max(x_begin, 0);
+        y_begin = std::max(y_begin, 0);
+        x_end = std::min(x_end, _width);
+        y_end = std::min(y_end, _height);
+        if (x_begin >= x_end || y_begin >= y_end) return;
+
+        int tx_end = (x_end - 1) / DIRTY_TILE + 1;
+        int ty_end = (y_end - 1) / DIRTY_TILE + 1;
+        // Sequentially consistent, so each store is ordered before the epoch load after it.
+        uint32_t epoch = __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST);
+        for (;;) {
+            for (int ty = y_begin / DIRTY_TILE; ty < ty_end; ty++) {
+                uint32_t* row = &_tile_epoch[ty * _tiles_x];
+                for (int tx = x_begin / DIRTY_TILE; tx < tx_end; tx++) {
+                    __atomic_store_n(&row[tx], epoch, __ATOMIC_SEQ_CST);
+                }
+            }
+            uint32_t now = __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST);
+            if (now == epoch) break;
+            epoch = now;
+        }
+    }
+
+    void mark_all()
+    {
+        _resets++;
+        std::fill(_tile_epoch.begin(), _tile_epoch.end(), _epoch);
+    }
+
+    // The window moved by (dx, dy) cells, the cell formerly at (x + dx, y + dy) is now at (x, y).
+    // Each tile takes the newest stamp of the old tiles its cells came from, cells coming from
+    // outside the old window are marked.
+    void shift(int dx, int dy)
+    {
+        if (dx == 0 && dy == 0) return;
+        _shift_x += dx;
+        _shift_y += dy;
+
+        std::vector<uint32_t> shifted(_tile_epoch.size());
+        for (int ty = 0; ty < _tiles_y; ty++) {
+            int y_begin = ty * DIRTY_TILE + dy;
+            int y_end = std::min((ty + 1) * DIRTY_TILE, _height) + dy;
+            for (int tx = 0; tx < _tiles_x; tx++) {
+                int x_begin = tx * DIRTY_TILE + dx;
+                int x_end = std::min((tx + 1) * DIRTY_TILE, _width) + dx;
+                uint32_t stamp = 0;
+                if (x_begin < 0 || y_begin < 0 || x_end > _width || y_end > _height) {
+                    stamp = _epoch;
+                }
+                int ox_end = (std::min(x_end, _width) - 1) / DIRTY_TILE + 1;
+                int oy_end = (std::min(y_end, _height) - 1) / DIRTY_TILE + 1;
+                for (int oy = std::max(y_begin, 0) / DIRTY_TILE; oy < oy_end; oy++) {
+                    for (int ox = std::max(x_begin, 0) / DIRTY_TILE; ox < ox_end; ox++) {
+                        stamp = std::max(stamp, _tile_epoch[oy * _tiles_x + ox]);
+                    }
+                }
+                shifted[ty * _tiles_x + tx] = stamp;
+            }
+        }
+        _tile_epoch.swap(shifted);
+    }
+
+    // Calls fn(const GridRegion&) for the bounding boxes of the tiles changed after epoch since.
+    // Runs of changed tiles are merged along x, equal runs of consecutive tile rows along y.
+    template <typename RegionFn>
+    void for_each_changed(uint32_t since, RegionFn fn) const
+    {
+        std::vector<GridRegion> open;
+        std::vector<GridRegion> row_runs;
+        for (int ty = 0; ty <= _tiles_y; ty++) {
+            row_runs.clear();
+            if (ty < _tiles_y) {
+                // Ordered after the checkpoint and before the cell reads, see mark_atomic.
+                const uint32_t* row = &_tile_epoch[ty * _tiles_x];
+                auto changed = [&](int tx) { return __atomic_load_n(&row[tx], __ATOMIC_SEQ_CST) > since; };
+                int tx = 0;
+                while (tx < _tiles_x) {
+                    if (!changed(tx)) {
+                        tx++;
+                        continue;
+                    }
+                    int tx_begin = tx;
+                    while (tx < _tiles_x && changed(tx)) tx++;
+                    GridRegion run;
+                    run.x_begin = tx_begin * DIRTY_TILE;
+                    run.x_end = std::min(tx * DIRTY_TILE, _width);
+                    run.y_begin = ty * DIRTY_TILE;
+                    run.y_end = std::min((ty + 1) * DIRTY_TILE, _height);
+                    row_runs.push_back(run);
+                }
+            }
+
+            // Extend the open boxes by the identical runs of this row, emit the others.
+            std::vector<GridRegion> still_open;
+            size_t j = 0;
+            for (const GridRegion& box : open) {
+                while (j < row_runs.size() && row_runs[j].x_begin < box.x_begin) {
+                    still_open.push_back(row_runs[j++]);
+                }
+                if (j < row_runs.size() && row_runs[j].x_begin == box.x_begin && row_runs[j].x_end == box.x_end) {
+                    GridRegion grown = box;
+                    grown.y_end = row_runs[j++].y_end;
+                    still_open.push_back(grown);
+                } else {
+                    fn(box);
+                }
+            }
+            while (j < row_runs.size()) {
+                still_open.push_back(row_runs[j++]);
+            }
+            std::sort(still_open.begin(), still_open.end(),
+                [](const GridRegion& a, const GridRegion& b) { return a.x_begin < b.x_begin; });
+            open.swap(still_open);
+        }
+    }
+
+    // Bounding boxes of the tiles changed after epoch since.
+    std::vector<GridRegion> changed(uint32_t since) const
+    {
+        std::vector<GridRegion> regions;
+        for_each_changed(since, [&](const GridRegion& region) { regions.push_back(region); });
+        return regions;
+    }
+
+private:
+    int _width;                         // Map width [cells].
+    int _height;                        // Map height [cells].
+    int _tiles_x;                       // Tile columns.
+    int _tiles_y;                       // Tile rows.
+    mutable uint32_t _epoch;            // Stamp of new marks.
+    long long _shift_x;                 // Accumulated window shift [cells].
+    long long _shift_y;
+    uint32_t _resets;                   // Resizes and mark_all calls.
+    std::vector<uint32_t> _tile_epoch;  // Last epoch each tile changed in, row-major.
+};
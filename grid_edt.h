@@ -0,0 +1,360 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_parallel.h"
+
+// Default parameter values.
+const float DEFAULT_EDT_REBUILD_RATIO = 0.05f;      // Rebuild instead of propagating when 5% of the cells flipped.
+
+// Euclidean distance from every cell to the nearest is_occupied() cell of a GridMap.
+// update() compares the occupancy of the dirty regions with the last one seen and propagates only
+// the flipped cells, with the raise and lower wavefronts of the dynamic brushfire of Lau et al.
+// ("Efficient grid-based spatial representations for robot navigation in dynamic environments").
+// Each cell keeps its nearest obstacle, so distances are Euclidean distances between cell centers,
+// exact but for the rare cells where the 8-neighbor wave hands over a marginally farther obstacle.
+// A window shift moves the field along with the map, the cells whose nearest obstacle left the
+// window and the strips coming into view are refilled by the same wavefronts. A resize, a reset
+// of the map, a shift of a whole window or a flip count over rebuild_ratio of the map falls back
+// to a full rebuild with the separable transform of Felzenszwalb and Huttenlocher, parallel over
+// the columns and rows.
+template <typename CellT = GridCell>
+class BasicGridDistanceField
+{
+public:
+    static const int32_t NO_OBSTACLE = -1;
+    static const int32_t INF_SQ_DIST = std::numeric_limits<int32_t>::max();
+
+    // threads = 0 uses the hardware concurrency for the full rebuild.
+    BasicGridDistanceField(int threads = 0, float rebuild_ratio = DEFAULT_EDT_REBUILD_RATIO)
+        : _pool(threads)
+    {
+        _rebuild_ratio = rebuild_ratio;
+        _width = 0;
+        _height = 0;
+        _resolution = 1.0f;
+        _last_epoch = 0;
+        _last_shift_x = 0;
+        _last_shift_y = 0;
+        _last_resets = 0;
+        _rebuilds = 0;
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // Number of full rebuilds so far.
+    size_t rebuilds() const { return _rebuilds; }
+
+    // Squared distance [cells^2] to the nearest obstacle, INF_SQ_DIST without any obstacle.
+    int32_t squared_distance(int idx_x, int idx_y) const
+    {
+        return _sq_dist[idx_y * _width + idx_x];
+    }
+
+    // Distance [m] to the nearest obstacle, infinity without any obstacle.
+    float distance(int idx_x, int idx_y) const
+    {
+        int32_t d = squared_distance(idx_x, idx_y);
+        return d == INF_SQ_DIST ? std::numeric_limits<float>::infinity() : std::sqrt(static_cast<float>(d)) * _resolution;
+    }
+
+    // Logical index of the nearest obstacle cell, NO_OBSTACLE without any obstacle.
+    int32_t nearest_obstacle(int idx_x, int idx_y) const
+    {
+        return _obstacle[idx_y * _width + idx_x];
+    }
+
+    // Brings the field up to date with map, call it after the map changed and before queries.
+    void update(const BasicGridMap<CellT>& map)
+    {
+        GRID_METRICS_TIMER(GridPhase::EXTRACT);
+        const GridDirtyTracker& dirty = map.dirty();
+        uint32_t now = dirty.checkpoint();
+        _resolution = map.resolution();
+        const long long dx = dirty.shift_x() - _last_shift_x;
+        const long long dy = dirty.shift_y() - _last_shift_y;
+        bool rebuild_all = map.width() != _width || map.height() != _height || dirty.resets() != _last_resets
+            || std::llabs(dx) >= _width || std::llabs(dy) >= _height;
+
+        if (!rebuild_all) {
+            if (dx != 0 || dy != 0) {
+                shift(static_cast<int>(dx), static_cast<int>(dy));
+            }
+            _flips.clear();
+            dirty.for_each_changed(_last_epoch, [&](const GridRegion& region) {
+                map.for_each_run(region, [&](const CellT* cell, int x, int y, int run) {
+                    for (int i = 0; i < run; i++) {
+                        int idx = y * _width + x + i;
+                        uint8_t occupied = cell[i].is_occupied();
+                        if (occupied != _occupied[idx]) {
+                            _occupied[idx] = occupied;
+                            _flips.push_back(idx);
+                        }
+                    }
+                });
+            });
+            rebuild_all = _flips.size() > _rebuild_ratio * _width * _height;
+        }
+
+        if (rebuild_all) {
+            rebuild(map);
+        } else {
+            propagate();
+        }
+        _last_epoch = now;
+        _last_shift_x = dirty.shift_x();
+        _last_shift_y = dirty.shift_y();
+        _last_resets = dirty.resets();
+    }
+
+private:
+    typedef std::pair<int32_t, int32_t> QueueEntry;     // (squared distance, cell index).
+
+    GridThreadPool _pool;               // Workers of the full rebuild.
+    float _rebuild_ratio;               // Flipped cell ratio above which update rebuilds.
+    int _width;
+    int _height;
+    float _resolution;
+    uint32_t _last_epoch;               // Dirty epoch covered by the field.
+    long long _last_shift_x;            // Window shift covered by the field.
+    long long _last_shift_y;
+    uint32_t _last_resets;              // Map resets covered by the field.
+    size_t _rebuilds;
+    std::vector<uint8_t> _occupied;     // Occupancy the field was computed for.
+    std::vector<int32_t> _obstacle;     // Nearest obstacle index of each cell.
+    std::vector<int32_t> _sq_dist;      // Squared distance to it [cells^2].
+    std::vector<uint8_t> _raise;        // Cells on the raise wavefront.
+    std::vector<int32_t> _flips;        // Cells whose occupancy flipped in this update.
+    std::vector<uint8_t> _moved_occupied;   // Buffers of shift, kept for reuse.
+    std::vector<int32_t> _moved_obstacle;
+    std::vector<int32_t> _moved_sq_dist;
+    std::vector<int32_t> _remap;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > _open;
+
+    int32_t sq_dist_to(int32_t obstacle, int idx) const
+    {
+        int dx = obstacle % _width - idx % _width;
+        int dy = obstacle / _width - idx / _width;
+        return dx * dx + dy * dy;
+    }
+
+    // The window moved by (dx, dy) cells, the cell formerly at (x + dx, y + dy) is now at (x, y).
+    // A cell whose nearest obstacle is still in the window keeps it, as the window lost cells
+    // and the cells coming into view are cleared. The others and the cleared cells start a raise
+    // wavefront that propagate() refills from their neighbors.
+    void shift(int dx, int dy)
+    {
+        const size_t size = _occupied.size();
+        _moved_occupied.resize(size);
+        _moved_obstacle.resize(size);
+        _moved_sq_dist.resize(size);
+        _remap.resize(size);
+        const int x_begin = std::max(0, -dx);
+        const int x_end = std::min(_width, _width - dx);
+        const int y_begin = std::max(0, -dy);
+        const int y_end = std::min(_height, _height - dy);
+        // New index of each old cell, NO_OBSTACLE for the ones that left the window.
+        std::fill(_remap.begin(), _remap.end(), NO_OBSTACLE);
+        for (int y = y_begin; y < y_end; y++) {
+            int32_t* remap = &_remap[(y + dy) * _width + dx];
+            for (int x = x_begin; x < x_end; x++) {
+                remap[x] = y * _width + x;
+            }
+        }
+        for (int y = 0; y < _height; y++) {
+            const int row = y * _width;
+            const bool inside = y >= y_begin && y < y_end;
+            const int run_begin = inside ? x_begin : _width;
+            const int run_end = inside ? x_end : _width;
+            for (int x = 0; x < _width; x++) {
+                const int idx = row + x;
+                if (x < run_begin || x >= run_end) {
+                    _moved_occupied[idx] = 0;
+                    _moved_obstacle[idx] = NO_OBSTACLE;
+                    _moved_sq_dist[idx] = INF_SQ_DIST;
+                    continue;
+                }
+                const int old_idx = idx + dy * _width + dx;
+                const int32_t obstacle = _obstacle[old_idx];
+                const int32_t moved = obstacle == NO_OBSTACLE ? NO_OBSTACLE : _remap[obstacle];
+                _moved_occupied[idx] = _occupied[old_idx];
+                _moved_obstacle[idx] = moved;
+                _moved_sq_dist[idx] = moved == NO_OBSTACLE ? INF_SQ_DIST : _sq_dist[old_idx];
+            }
+        }
+        _occupied.swap(_moved_occupied);
+        _obstacle.swap(_moved_obstacle);
+        _sq_dist.swap(_moved_sq_dist);
+
+        // Without an obstacle left in the window no cell has one and there is nothing to refill.
+        if (std::find(_occupied.begin(), _occupied.end(), 1) == _occupied.end()) return;
+        for (int idx = 0; idx < static_cast<int>(size); idx++) {
+            if (_obstacle[idx] == NO_OBSTACLE) {
+                _raise[idx] = 1;
+                _open.push(QueueEntry(0, idx));
+            }
+        }
+    }
+
+    void propagate()
+    {
+        for (int32_t idx : _flips) {
+            if (_occupied[idx]) {
+                _obstacle[idx] = idx;
+                _sq_dist[idx] = 0;
+                _raise[idx] = 0;
+            } else {
+                _obstacle[idx] = NO_OBSTACLE;
+                _sq_dist[idx] = INF_SQ_DIST;
+                _raise[idx] = 1;
+            }
+            _open.push(QueueEntry(0, idx));
+        }
+
+        while (!_open.empty()) {
+            int32_t idx = _open.top().second;
+            _open.pop();
+            if (_raise[idx]) {
+                process_raise(idx);
+            } else if (_obstacle[idx] != NO_OBSTACLE && _occupied[_obstacle[idx]]) {
+                process_lower(idx);
+            }
+        }
+    }
+
+    // Calls fn(neighbor index) for the 8-neighborhood of idx inside the map.
+    template <typename NeighborFn>
+    void for_each_neighbor(int idx, NeighborFn fn) const
+    {
+        int x = idx % _width;
+        int y = idx / _width;
+        for (int ny = std::max(0, y - 1); ny <= std::min(_height - 1, y + 1); ny++) {
+            for (int nx = std::max(0, x - 1); nx <= std::min(_width - 1, x + 1); nx++) {
+                if (nx != x || ny != y) fn(ny * _width + nx);
+            }
+        }
+    }
+
+    // Clears the neighbors whose nearest obstacle vanished and queues the others to refill the hole.
+    void process_raise(int idx)
+    {
+        for_each_neighbor(idx, [&](int n) {
+            if (_obstacle[n] == NO_OBSTACLE || _raise[n]) return;
+            _open.push(QueueEntry(_sq_dist[n], n));
+            if (!_occupied[_obstacle[n]]) {
+                _obstacle[n] = NO_OBSTACLE;
+                _sq_dist[n] = INF_SQ_DIST;
+                _raise[n] = 1;
+            }
+        });
+        _raise[idx] = 0;
+    }
+
+    // Offers the nearest obstacle of idx to its neighbors.
+    void process_lower(int idx)
+    {
+        const int32_t obstacle = _obstacle[idx];
+        for_each_neighbor(idx, [&](int n) {
+            if (_raise[n]) return;
+            // Ties go to the lower obstacle index, otherwise a cell equally close to two obstacles
+            // stops the wave of the one that is closer to the cells behind it.
+            int32_t d = sq_dist_to(obstacle, n);
+            if (d < _sq_dist[n] || (d == _sq_dist[n] && obstacle < _obstacle[n])) {
+                _sq_dist[n] = d;
+                _obstacle[n] = obstacle;
+                _open.push(QueueEntry(d, n));
+            }
+        });
+    }
+
+    // Separable exact transform: the nearest obstacle row of every column, then the lower envelope
+    // of the column parabolas along every row.
+    void rebuild(const BasicGridMap<CellT>& map)
+    {
+        _rebuilds++;
+        _width = map.width();
+        _height = map.height();
+        const size_t size = static_cast<size_t>(_width) * _height;
+        _occupied.assign(size, 0);
+        _obstacle.assign(size, NO_OBSTACLE);
+        _sq_dist.assign(size, INF_SQ_DIST);
+        _raise.assign(size, 0);
+        _open = decltype(_open)();
+        map.for_each_run(GridRegion{0, 0, _width, _height}, [&](const CellT* cell, int x, int y, int run) {
+            for (int i = 0; i < run; i++) {
+                _occupied[y * _width + x + i] = cell[i].is_occupied();
+            }
+        });
+
+        // Nearest obstacle row in each column, -1 for none.
+        std::vector<int32_t> column_row(size, -1);
+        _pool.parallel_for(_width, [&](int x) {
+            int last = -1;
+            for (int y = 0; y < _height; y++) {
+                if (_occupied[y * _width + x]) last = y;
+                column_row[y * _width + x] = last;
+            }
+            last = -1;
+            for (int y = _height - 1; y >= 0; y--) {
+                if (_occupied[y * _width + x]) last = y;
+                int32_t& row = column_row[y * _width + x];
+                if (last >= 0 && (row < 0 || last - y < y - row)) row = last;
+            }
+        });
+
+        _pool.parallel_for(_height, [&](int y) {
+            // Lower envelope of the parabolas (x - q)^2 + g(q)^2 over the columns q with an obstacle.
+            std::vector<int> sites;
+            std::vector<double> bounds;
+            sites.reserve(_width);
+            bounds.reserve(_width + 1);
+            const int32_t* rows = &column_row[y * _width];
+            auto g = [&](int q) { double d = rows[q] - y; return d * d; };
+            for (int q = 0; q < _width; q++) {
+                if (rows[q] < 0) continue;
+                while (!sites.empty()) {
+                    int p = sites.back();
+                    double s = ((g(q) + q * q) - (g(p) + p * p)) / (2.0 * (q - p));
+                    if (s > bounds.back()) {
+                        bounds.push_back(s);
+                        break;
+                    }
+                    sites.pop_back();
+                    bounds.pop_back();
+                }
+                if (sites.empty()) bounds.push_back(-std::numeric_limits<double>::infinity());
+                sites.push_back(q);
+            }
+            if (sites.empty()) return;
+
+            size_t k = 0;
+            for (int x = 0; x < _width; x++) {
+                while (k + 1 < sites.size() && bounds[k + 1] < x) k++;
+                int q = sites[k];
+                int idx = y * _width + x;
+                _obstacle[idx] = rows[q] * _width + q;
+                _sq_dist[idx] = sq_dist_to(_obstacle[idx], idx);
+            }
+        });
+    }
+};
+
+template <typename CellT>
+const int32_t BasicGridDistanceField<CellT>::NO_OBSTACLE;
+template <typename CellT>
+const int32_t BasicGridDistanceField<CellT>::INF_SQ_DIST;
+
+typedef BasicGridDistanceField<GridCell> GridDistanceField;
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "grid_bitmask.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+
+// Default parameter values.
+const int DEFAULT_FREE_SPACE_BINS = 360;    // 1 degree polar bins.
+
+// One 8-connected component of occupied cells.
+struct GridComponent
+{
+    int32_t label;
+    int cells;              // Number of cells.
+    GridRegion bbox;        // Bounding box, half-open.
+};
+
+// 8-connected component labeling of an occupied cell bit mask, see BasicGridMap::classify.
+// label() labels the whole mask from its bit runs with a union-find over the runs. relabel() reuses
+// the labels of the previous call and only relabels the components touching the changed regions, a
+// component keeps the smallest old label of its cells when it has one. After a window shift the
+// previous labels no longer line up with the mask, call label() instead.
+class GridComponentLabeler
+{
+public:
+    GridComponentLabeler()
+    {
+        _width = 0;
+        _height = 0;
+        _next_label = 1;
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // Component label of cell (idx_x, idx_y), 0 for free and unknown cells.
+    int32_t label_of(int idx_x, int idx_y) const
+    {
+        return _labels[idx_y * _width + idx_x];
+    }
+
+    const std::unordered_map<int32_t, GridComponent>& components() const { return _components; }
+
+    void label(const GridBitmask& occupied)
+    {
+        _width = occupied.width();
+        _height = occupied.height();
+        _labels.assign(static_cast<size_t>(_width) * _height, 0);
+        _components.clear();
+        _next_label = 1;
+        label_window(occupied, GridRegion{0, 0, _width, _height}, std::unordered_set<int32_t>());
+    }
+
+    // Updates the labels after the cells of the changed regions may have flipped, the regions are in
+    // the format of GridDirtyTracker::changed.
+    void relabel(const GridBitmask& occupied, const std::vector<GridRegion>& changed)
+    {
+        if (occupied.width() != _width || occupied.height() != _height) {
+            label(occupied);
+            return;
+        }
+        if (changed.empty()) return;
+
+        // Components next to a changed cell may grow, merge or split, the others stay as they are.
+        std::unordered_set<int32_t> affected;
+        GridRegion window = changed.front();
+        for (const GridRegion& region : changed) {
+            window = merge(window, region);
+            for (const auto& entry : _components) {
+                const GridRegion& box = entry.second.bbox;
+                if (box.x_begin <= region.x_end && region.x_begin <= box.x_end
+                    && box.y_begin <= region.y_end && region.y_begin <= box.y_end) {
+                    affected.insert(entry.first);
+                }
+            }
+        }
+        for (int32_t old_label : affected) {
+            window = merge(window, _components[old_label].bbox);
+        }
+        label_window(occupied, window, affected);
+    }
+
+    // Calls fn(const GridComponent&) for every component, in no particular order.
+    template <typename ComponentFn>
+    void for_each_component(ComponentFn fn) const
+    {
+        for (const auto& entry : _components) {
+            fn(entry.second);
+        }
+    }
+
+private:
+    struct Run
+    {
+        int y;
+        int x_begin;
+        int x_end;
+        int parent;             // Union-find parent run.
+    };
+
+    int _width;
+    int _height;
+    int32_t _next_label;                                    // Labels are never reused.
+    std::vector<int32_t> _labels;                           // Row-major cell labels.
+    std::unordered_map<int32_t, GridComponent> _components; // By label.
+    std::vector<Run> _runs;
+
+    static GridRegion merge(const GridRegion& a, const GridRegion& b)
+    {
+        return GridRegion{std::min(a.x_begin, b.x_begin), std::min(a.y_begin, b.y_begin),
+            std::max(a.x_end, b.x_end), std::max(a.y_end, b.y_end)};
+    }
+
+    int find(int run)
+    {
+        while (_runs[run].parent != run) {
+            _runs[run].parent = _runs[_runs[run].parent].parent;
+            run = _runs[run].parent;
+        }
+        return run;
+    }
+
+    void unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a != b) _runs[std::max(a, b)].parent = std::min(a, b);
+    }
+
+    // Labels the occupied cells of window that do not belong to a kept component, the cells of the
+    // affected components are cleared first and their labels offered to the new components.
+    void label_window(const GridBitmask& occupied, const GridRegion& window,
+        const std::unordered_set<int32_t>& affected)
+    {
+        GRID_METRICS_TIMER(GridPhase::EXTRACT);
+        std::vector<int32_t> old_labels(static_cast<size_t>(window.x_end - window.x_begin)
+            * (window.y_end - window.y_begin), 0);
+        for (int32_t old_label : affected) {
+            const GridRegion box = _components[old_label].bbox;
+            for (int y = box.y_begin; y < box.y_end; y++) {
+                for (int x = box.x_begin; x < box.x_end; x++) {
+                    int32_t& cell = _labels[y * _width + x];
+                    if (cell == old_label) {
+                        old_labels[(y - window.y_begin) * (window.x_end - window.x_begin) + x - window.x_begin] = cell;
+                        cell = 0;
+                    }
+                }
+            }
+            _components.erase(old_label);
+        }
+
+        // Runs of occupied cells without a kept label, row by row.
+        _runs.clear();
+        std::vector<size_t> row_first(window.y_end - window.y_begin + 1);
+        for (int y = window.y_begin; y < window.y_end; y++) {
+            row_first[y - window.y_begin] = _runs.size();
+            const uint64_t* row = occupied.row(y);
+            const int32_t* labels = &_labels[y * _width];
+            int x = window.x_begin;
+            while (x < window.x_end) {
+                x = next_bit(row, x, window.x_end, true);
+                if (x >= window.x_end) break;
+                int end = next_bit(row, x, window.x_end, false);
+                // Kept components only touch the window where no cell changed, split around them.
+                int begin = x;
+                for (; x < end; x++) {
+                    if (labels[x] != 0) {
+                        if (x > begin) add_run(y, begin, x);
+                        begin = x + 1;
+                    }
+                }
+                if (end > begin) add_run(y, begin, end);
+            }
+
+            // 8-connected runs of the row above.
+            if (y > window.y_begin) {
+                size_t a = row_first[y - 1 - window.y_begin];
+                size_t a_end = row_first[y - window.y_begin];
+                for (size_t b = a_end; b < _runs.size(); b++) {
+                    while (a < a_end && _runs[a].x_end < _runs[b].x_begin) a++;
+                    for (size_t k = a; k < a_end && _runs[k].x_begin <= _runs[b].x_end; k++) {
+                        unite(static_cast<int>(k), static_cast<int>(b));
+                    }
+                }
+            }
+        }
+
+        // Components in order of their first run, each takes the smallest old label of its cells.
+        std::vector<int32_t> root_label(_runs.size(), 0);
+        std::unordered_set<int32_t> taken;
+        std::vector<int32_t> candidate(_runs.size(), 0);
+        const int window_width = window.x_end - window.x_begin;
+        for (size_t i = 0; i < _runs.size(); i++) {
+            const Run& run = _runs[i];
+            int root = find(static_cast<int>(i));
+            for (int x = run.x_begin; x < run.x_end; x++) {
+                int32_t old_label = old_labels[(run.y - window.y_begin) * window_width + x - window.x_begin];
+                if (old_label != 0 && (candidate[root] == 0 || old_label < candidate[root])) {
+                    candidate[root] = old_label;
+                }
+            }
+        }
+        for (size_t i = 0; i < _runs.size(); i++) {
+            const Run& run = _runs[i];
+            int root = find(static_cast<int>(i));
+            if (root_label[root] == 0) {
+                int32_t reused = candidate[root];
+                root_label[root] = reused != 0 && taken.insert(reused).second ? reused : _next_label++;
+                _components[root_label[root]] = GridComponent{root_label[root], 0,
+                    GridRegion{run.x_begin, run.y, run.x_end, run.y + 1}};
+            }
+            GridComponent& component = _components[root_label[root]];
+            component.cells += run.x_end - run.x_begin;
+            component.bbox = merge(component.bbox, GridRegion{run.x_begin, run.y, run.x_end, run.y + 1});
+            std::fill(&_labels[run.y * _width + run.x_begin], &_labels[run.y * _width + run.x_end], root_label[root]);
+        }
+    }
+
+    void add_run(int y, int x_begin, int x_end)
+    {
+        int index = static_cast<int>(_runs.size());
+        _runs.push_back(Run{y, x_begin, x_end, index});
+    }
+
+    // First x in [x, x_end) whose bit equals value, x_end if there is none. Scans whole words.
+    static int next_bit(const uint64_t* row, int x, int x_end, bool value)
+    {
+        while (x < x_end) {
+            uint64_t word = value ? row[x >> 6] : ~row[x >> 6];
+            word &= ~uint64_t(0) << (x & 63);
+            if (word != 0) {
+                return std::min(x_end, ((x >> 6) << 6) + __builtin_ctzll(word));
+            }
+            x = ((x >> 6) + 1) << 6;
+        }
+        return x_end;
+    }
+};
+
+// Polar free-space boundary around a pose: for every angular bin the distance [m] the free space
+// reaches along the bin center ray, up to max_range. The ray stops at the first cell that is not
+// set in the free mask, whether it is occupied or unknown, or at the map border.
+// The cell of the pose and the cells the ray enters within start_range, the vehicle footprint,
+// are not tested, as the vehicle itself keeps them from being seen free.
+// Bin i covers the heading yaw + 2 * pi * i / bins, counter clockwise.
+template <typename MapT>
+std::vector<float> free_space_boundary(const MapT& map, const GridBitmask& free, const Eigen::Vector3d & pose,
+    float max_range, int bins = DEFAULT_FREE_SPACE_BINS, float start_range = 0.0f)
+{
+    GRID_METRICS_TIMER(GridPhase::EXTRACT);
+    std::vector<float> ranges(bins, 0.0f);
+    const double inv_res = 1.0 / map.resolution();
+    const double px = (pose.x() - map.origin().x()) * inv_res;
+    const double py = (pose.y() - map.origin().y()) * inv_res;
+    const double max_cells = max_range * inv_res;
+    const double start_cells = start_range * inv_res;
+
+    for (int i = 0; i < bins; i++) {
+        const double angle = pose.z() + 2.0 * M_PI * i / bins;
+        const double dx = std::cos(angle);
+        const double dy = std::sin(angle);
+
+        // Amanatides-Woo traversal of the cells crossed by the ray.
+        int x = static_cast<int>(std::floor(px));
+        int y = static_cast<int>(std::floor(py));
+        const int step_x = dx > 0.0 ? 1 : -1;
+        const int step_y = dy > 0.0 ? 1 : -1;
+        const double delta_x = dx != 0.0 ? std::abs(1.0 / dx) : INFINITY;
+        const double delta_y = dy != 0.0 ? std::abs(1.0 / dy) : INFINITY;
+        double t_x = dx != 0.0 ? ((dx > 0.0 ? x + 1 - px : px - x) * delta_x) : INFINITY;
+        double t_y = dy != 0.0 ? ((dy > 0.0 ? y + 1 - py : py - y) * delta_y) : INFINITY;
+        double t = 0.0;
+        bool skip = true;
+        while (t < max_cells) {
+            if (x < 0 || x >= map.width() || y < 0 || y >= map.height()) break;
+            if (!skip && !free.test(x, y)) break;
+            if (t_x < t_y) {
+                t = t_x;
+                t_x += delta_x;
+                x += step_x;
+            } else {
+                t = t_y;
+                t_y += delta_y;
+                y += step_y;
+            }
+            skip = t < start_cells;
+        }
+        ranges[i] = static_cast<float>(std::min(t, max_cells) * map.resolution());
+    }
+    return ranges;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_sensor.h"
+
+// Default parameter values.
+const float DEFAULT_FOOTPRINT_RANGE_STEP = 0.1f;            // Range quantization [m], one cell at the default resolution.
+const float DEFAULT_FOOTPRINT_HEADING_STEP = 0.0174533f;    // Heading quantization [rad], 1 degree.
+const size_t DEFAULT_FOOTPRINT_MEMORY_CAP = 4 << 20;        // 4MB of cached footprints.
+
+const int FOOTPRINT_MAX_SENSORS = 1 << 23;                  // Sensor ids of the 64-bit footprint keys.
+
+// One cell of a beam footprint, relative to the cell of the sensor.
+template <typename T>
+struct BasicFootprintCell
+{
+    int16_t dx;             // Column offset [cells].
+    int16_t dy;             // Row offset [cells].
+    T log_odds;             // The log odds accumulated into the cell, in the storage scale of the cell.
+};
+
+// The rasterized beam cone of one (range, heading) bin, cells are stored in row order.
+template <typename T>
+struct BasicBeamFootprint
+{
+    std::vector<BasicFootprintCell<T> > cells;
+    int min_dx, min_dy;     // Bounding box of the offsets [cells].
+    int max_dx, max_dy;
+};
+
+struct FootprintCacheStats
+{
+    size_t hits;            // Lookups served from the cache.
+    size_t misses;          // Lookups that had to rasterize the cone.
+    size_t evictions;       // Footprints dropped to respect the memory cap.
+    size_t footprints;      // Footprints currently cached.
+    size_t bytes;           // Memory used by the cached footprints.
+};
+
+// Lazily filled cache of beam footprints keyed by (sensor id, quantized range, quantized heading).
+// The sensor is snapped to the center of its cell, so the footprint only depends on range and heading
+// and an echo update becomes one offset-add-and-accumulate pass over a contiguous array.
+// The log odds of a footprint are taken from the GridSensor at fill time, weighted per cell when the
+// sensor has a model, call clear() after changing the update factors, the model or the map resolution.
+template <typename CellT = GridCell>
+class BasicBeamFootprintCache
+{
+public:
+    typedef typename CellT::value_type value_type;
+    typedef BasicFootprintCell<value_type> FootprintCell;
+    typedef BasicBeamFootprint<value_type> BeamFootprint;
+
+    BasicBeamFootprintCache(float range_step = DEFAULT_FOOTPRINT_RANGE_STEP,
+        float heading_step = DEFAULT_FOOTPRINT_HEADING_STEP,
+        size_t memory_cap = DEFAULT_FOOTPRINT_MEMORY_CAP)
+    {
+        _range_step = range_step;
+        _heading_step = heading_step;
+        _memory_cap = memory_cap;
+        clear();
+    }
+
+    // Register the fixed beam shape of a sensor, this drops the cached footprints of that sensor.
+    // Returns false for a sensor_id outside [0, FOOTPRINT_MAX_SENSORS).
+    bool set_sensor(int sensor_id, float fov, float max_range)
+    {
+        if (sensor_id < 0 || sensor_id >= FOOTPRINT_MAX_SENSORS) {
+            std::cout << "Footprint cache error: sensor id " << sensor_id << " outside [0, "
+                << FOOTPRINT_MAX_SENSORS << ")";
+            return false;
+        }
+        if (sensor_id >= static_cast<int>(_beams.size())) {
+            _beams.resize(sensor_id + 1);
+        }
+        _beams[sensor_id].fov = fov;
+        _beams[sensor_id].max_range = max_range;
+        _beams[sensor_id].registered = true;
+
+        for (auto it = _lru.begin(); it != _lru.end();) {
+            if (key_sensor(*it) == sensor_id) {
+                erase(*it);
+                it = _lru.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return true;
+    }
+
+    bool has_sensor(int sensor_id) const
+    {
+        return sensor_id >= 0 && sensor_id < static_cast<int>(_beams.size()) && _beams[sensor_id].registered;
+    }
+
+    // Update all cells covered by one echo of a registered sensor, see GridSensor::integrate_echo.
+    // Returns false without updating the map for a sensor not registered with set_sensor.
+    bool integrate_echo(BasicGridMap<CellT>& map, const BasicGridSensor<CellT>& sensor, int sensor_id,
+        const Eigen::Vector3d & sensor_pose, float range)
+    {
+        if (!has_sensor(sensor_id)) {
+            std::cout << "Footprint cache error: sensor id " << sensor_id << " is not registered";
+            return false;
+        }
+        GRID_METRICS_TIMER(GridPhase::ECHO);
+        const double inv_res = 1.0 / map.resolution();
+        int sx = static_cast<int>(std::floor((sensor_pose.x() - map.origin().x()) * inv_res));
+        int sy = static_cast<int>(std::floor((sensor_pose.y() - map.origin().y()) * inv_res));
+
+        const BeamFootprint& footprint = lookup(sensor, sensor_id, range, sensor_pose.z(), map.resolution());
+        const FootprintCell* cell = footprint.cells.data();
+        const size_t size = footprint.cells.size();
+        GRID_METRICS_ADD(echoes, 1);
+        GRID_METRICS_ADD(cells_touched, size);
+        map.dirty().mark_region(sx + footprint.min_dx, sy + footprint.min_dy,
+            sx + footprint.max_dx + 1, sy + footprint.max_dy + 1);
+
+        if (map.is_in_border(sx + footprint.min_dx, sy + footprint.min_dy)
+            && map.is_in_border(sx + footprint.max_dx, sy + footprint.max_dy)) {
+            for (size_t i = 0; i < size; i++) {
+                map(sx + cell[i].dx, sy + cell[i].dy).update(cell[i].log_odds);
+            }
+        } else {
+            for (size_t i = 0; i < size; i++) {
+                int x = sx + cell[i].dx;
+                int y = sy + cell[i].dy;
+                if (map.is_in_border(x, y)) {
+                    map(x, y).update(cell[i].log_odds);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Returns the footprint of the bin containing (range, heading), rasterizing it on a cache miss,
+    // and an empty one for a sensor not registered with set_sensor.
+    // The reference is valid until the next lookup or clear.
+    const BeamFootprint& lookup(const BasicGridSensor<CellT>& sensor, int sensor_id, float range, double heading,
+        float resolution)
+    {
+        if (!has_sensor(sensor_id)) {
+            _uncached.cells.clear();
+            _uncached.min_dx = _uncached.min_dy = 0;
+            _uncached.max_dx = _uncached.max_dy = 0;
+            return _uncached;
+        }
+        const BeamShape& beam = _beams[sensor_id];
+        // The echo is decided on the measured range like in GridSensor::integrate_echo, an echo bin
+        // is kept below max_range so snapping never turns a hit arc into a no-echo cone or back.
+        const bool has_echo = range < beam.max_range;
+        int range_bin = 0;
+        if (has_echo) {
+            range_bin = std::max(0, static_cast<int>(std::lround(range / _range_step)));
+            while (range_bin > 0 && range_bin * _range_step >= beam.max_range) range_bin--;
+        }
+        int heading_bins = std::max(1, static_cast<int>(std::lround(2.0 * M_PI / _heading_step)));
+        int heading_bin = static_cast<int>(std::lround(heading / _heading_step)) % heading_bins;
+        if (heading_bin < 0) heading_bin += heading_bins;
+
+        uint64_t key = make_key(sensor_id, has_echo, range_bin, heading_bin);
+        auto found = _footprints.find(key);
+        if (found != _footprints.end()) {
+            _stats.hits++;
+            _lru.splice(_lru.begin(), _lru, found->second.lru_pos);
+            return found->second.footprint;
+        }
+
+        _stats.misses++;
+        Entry entry;
+        build(sensor, beam, has_echo ? range_bin * _range_step : beam.max_range, heading_bin * _heading_step,
+            resolution, entry.footprint);
+
+        // A footprint above the cap alone is served without caching it or evicting the others.
+        size_t bytes = footprint_bytes(entry.footprint);
+        if (bytes > _memory_cap) {
+            _uncached = std::move(entry.footprint);
+            return _uncached;
+        }
+        while (!_lru.empty() && _stats.bytes + bytes > _memory_cap) {
+            erase(_lru.back());
+            _lru.pop_back();
+            _stats.evictions++;
+        }
+        _lru.push_front(key);
+        entry.lru_pos = _lru.begin();
+        _stats.bytes += bytes;
+        _stats.footprints++;
+        return _footprints.emplace(key, std::move(entry)).first->second.footprint;
+    }
+
+    void clear()
+    {
+        _footprints.clear();
+        _lru.clear();
+        _stats = FootprintCacheStats();
+    }
+
+    void reset_stats()
+    {
+        _stats.hits = 0;
+        _stats.misses = 0;
+        _stats.evictions = 0;
+    }
+
+    const FootprintCacheStats& stats() const { return _stats; }
+    float range_step() const { return _range_step; }
+    float heading_step() const { return _heading_step; }
+    size_t memory_cap() const { return _memory_cap; }
+
+private:
+    struct BeamShape
+    {
+        float fov = 0.0f;
+        float max_range = 0.0f;
+        bool registered = false;    // False for the ids skipped by set_sensor.
+    };
+
+    struct Entry
+    {
+        BeamFootprint footprint;
+        std::list<uint64_t>::iterator lru_pos;
+    };
+
+    float _range_step;                                  // Range quantization [m].
+    float _heading_step;                                // Heading quantization [rad].
+    size_t _memory_cap;                                 // Upper bound of the cached footprint memory [bytes].
+    std::vector<BeamShape> _beams;                      // Beam shape by sensor id.
+    std::unordered_map<uint64_t, Entry> _footprints;
+    std::list<uint64_t> _lru;                           // Keys, most recently used first.
+    FootprintCacheStats _stats;
+    BeamFootprint _uncached;                            // Last footprint too large for the cap, or the empty one.
+
+    static uint64_t make_key(int sensor_id, bool has_echo, int range_bin, int heading_bin)
+    {
+        return (static_cast<uint64_t>(sensor_id) << 41)
+            | (static_cast<uint64_t>(!has_echo) << 40)
+            | (static_cast<uint64_t>(range_bin & 0xFFFFF) << 20)
+            | static_cast<uint64_t>(heading_bin & 0xFFFFF);
+    }
+
+    static int key_sensor(uint64_t key)
+    {
+        return static_cast<int>(key >> 41);
+    }
+
+    static size_t footprint_bytes(const BeamFootprint& footprint)
+    {
+        return sizeof(Entry) + sizeof(uint64_t) + footprint.cells.capacity() * sizeof(FootprintCell);
+    }
+
+    void erase(uint64_t key)
+    {
+        auto found = _footprints.find(key);
+        _stats.bytes -= footprint_bytes(found->second.footprint);
+        _stats.footprints--;
+        _footprints.erase(found);
+    }
+
+    // Rasterize the cone around the center of cell (r, r) of a virtual (2r + 1) x (2r + 1) grid.
+    static void build(const BasicGridSensor<CellT>& sensor, const BeamShape& beam, float range, double heading,
+        float resolution, BeamFootprint& footprint)
+    {
+        const double inv_res = 1.0 / resolution;
+        const int r = static_cast<int>(std::ceil(beam.max_range * inv_res)) + 1;
+        footprint.cells.clear();
+        footprint.min_dx = footprint.min_dy = 0;
+        footprint.max_dx = footprint.max_dy = 0;
+
+        const double ax = std::cos(heading);
+        const double ay = std::sin(heading);
+        BasicGridSensor<CellT>::rasterize_cone(r + 0.5, r + 0.5, heading, range * inv_res, beam.fov,
+            beam.max_range * inv_res, 2 * r + 1, 2 * r + 1,
+            [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                for (int x = x_begin; x < x_end; x++) {
+                    FootprintCell cell;
+                    cell.dx = static_cast<int16_t>(x - r);
+                    cell.dy = static_cast<int16_t>(idx_y - r);
+                    double dist = std::sqrt(static_cast<double>(cell.dx * cell.dx + cell.dy * cell.dy));
+                    float sin_off = dist > 0.0 ? static_cast<float>((ax * cell.dy - ay * cell.dx) / dist) : 0.0f;
+                    cell.log_odds = sensor.increment(is_hit, static_cast<float>(dist) * resolution, sin_off);
+                    footprint.cells.push_back(cell);
+                    footprint.min_dx = std::min(footprint.min_dx, static_cast<int>(cell.dx));
+                    footprint.min_dy = std::min(footprint.min_dy, static_cast<int>(cell.dy));
+                    footprint.max_dx = std::max(footprint.max_dx, static_cast<int>(cell.dx));
+                    footprint.max_dy = std::max(footprint.max_dy, static_cast<int>(cell.dy));
+                }
+            });
+        footprint.cells.shrink_to_fit();
+    }
+};
+
+typedef BasicBeamFootprintCache<GridCell> BeamFootprintCache;
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_parallel.h"
+#include "grid_sensor.h"
+
+// Default parameter values.
+const int DEFAULT_FUSION_BAND = 2 * DIRTY_TILE;     // Rows per work item, whole dirty tile rows so workers never share a tile.
+
+// One echo of a frame, range [m] of the sensor registered under sensor_id.
+struct GridEcho
+{
+    int sensor_id;
+    float range;
+};
+
+// Applies all echoes of one frame to a map in parallel.
+// The cones are rasterized concurrently, one echo per work item, then the map is cut into bands of
+// rows and every band applies the spans of all echoes in frame order. A cell is only ever written by
+// the worker owning its band and sees its updates in the same order as sequential integrate_echo
+// calls, so the result is identical to the sequential one, saturation included, for any thread count.
+template <typename CellT = GridCell>
+class BasicGridFrameFusion
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    // threads = 0 uses the hardware concurrency.
+    BasicGridFrameFusion(int threads = 0, int band_rows = DEFAULT_FUSION_BAND)
+        : _pool(threads)
+    {
+        _band_rows = std::max(DIRTY_TILE, band_rows / DIRTY_TILE * DIRTY_TILE);
+    }
+
+    void set_threads(int threads)
+    {
+        _pool.set_threads(threads);
+    }
+
+    int threads() const { return _pool.threads(); }
+
+    // Register a sensor, mount_pose is (x [m], y [m], yaw [rad]) in the vehicle frame. Returns false
+    // for a negative sensor_id.
+    bool set_sensor(int sensor_id, const Eigen::Vector3d & mount_pose, float fov, float max_range)
+    {
+        if (sensor_id < 0) {
+            std::cout << "Frame fusion error: negative sensor id " << sensor_id;
+            return false;
+        }
+        if (sensor_id >= static_cast<int>(_mounts.size())) {
+            _mounts.resize(sensor_id + 1);
+        }
+        _mounts[sensor_id].pose = mount_pose;
+        _mounts[sensor_id].fov = fov;
+        _mounts[sensor_id].max_range = max_range;
+        _mounts[sensor_id].registered = true;
+        return true;
+    }
+
+    // Whether set_sensor registered sensor_id, the integrate functions skip the echoes of other ids.
+    bool has_sensor(int sensor_id) const
+    {
+        return sensor_id >= 0 && sensor_id < static_cast<int>(_mounts.size()) && _mounts[sensor_id].registered;
+    }
+
+    // Same result as calling sensor.integrate_echo for every echo in order, with the sensor poses
+    // composed from vehicle_pose (x [m], y [m], yaw [rad]) in the map frame and the mount poses.
+    // Returns false if echoes of unregistered sensors were skipped.
+    bool integrate_frame(BasicGridMap<CellT>& map, const BasicGridSensor<CellT>& sensor,
+        const Eigen::Vector3d & vehicle_pose, const std::vector<GridEcho>& echoes)
+    {
+        return integrate(map, sensor, echoes, [&](size_t) -> const Eigen::Vector3d& { return vehicle_pose; });
+    }
+
+    // Same as integrate_frame with a vehicle pose per echo, vehicle_poses[i] for echoes[i], e.g. for
+    // echoes taken at different times of a moving vehicle.
+    bool integrate_echoes(BasicGridMap<CellT>& map, const BasicGridSensor<CellT>& sensor,
+        const std::vector<Eigen::Vector3d>& vehicle_poses, const std::vector<GridEcho>& echoes)
+    {
+        return integrate(map, sensor, echoes, [&](size_t i) -> const Eigen::Vector3d& { return vehicle_poses[i]; });
+    }
+
+private:
+    struct Mount
+    {
+        Eigen::Vector3d pose;
+        float fov;
+        float max_range;
+        bool registered;        // False for the ids skipped by set_sensor, value-initialized by resize.
+    };
+
+    struct Span
+    {
+        int y;
+        int x_begin;
+        int x_end;
+        value_type log_odds;
+    };
+
+    GridThreadPool _pool;                       // Workers of both passes, the calling thread is one of them.
+    int _band_rows;                             // Rows per band, a multiple of DIRTY_TILE.
+    std::vector<Mount> _mounts;                 // Indexed by sensor id.
+    std::vector<std::vector<Span> > _spans;     // Rasterized spans of each echo of the frame, kept for reuse.
+
+    // vehicle_pose(i) is the vehicle pose of echoes[i].
+    template <typename PoseFn>
+    bool integrate(BasicGridMap<CellT>& map, const BasicGridSensor<CellT>& sensor,
+        const std::vector<GridEcho>& echoes, PoseFn vehicle_pose)
+    {
+        if (echoes.empty()) return true;
+        GRID_METRICS_TIMER(GridPhase::FRAME);
+        if (_spans.size() < echoes.size()) {
+            _spans.resize(echoes.size());
+        }
+        size_t skipped = 0;
+        for (const GridEcho& echo : echoes) {
+            skipped += !has_sensor(echo.sensor_id);
+        }
+        GRID_METRICS_ADD(echoes, echoes.size() - skipped);
+
+        _pool.parallel_for(static_cast<int>(echoes.size()), [&](int i) {
+            std::vector<Span>& spans = _spans[i];
+            spans.clear();
+            if (!has_sensor(echoes[i].sensor_id)) return;
+            const Mount& mount = _mounts[echoes[i].sensor_id];
+            const Eigen::Vector3d& vehicle = vehicle_pose(i);
+            const double c = std::cos(vehicle.z());
+            const double s = std::sin(vehicle.z());
+            Eigen::Vector3d pose(vehicle.x() + c * mount.pose.x() - s * mount.pose.y(),
+                vehicle.y() + s * mount.pose.x() + c * mount.pose.y(),
+                vehicle.z() + mount.pose.z());
+            BasicGridSensor<CellT>::rasterize_cone(map, pose, echoes[i].range, mount.fov, mount.max_range,
+                [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                    spans.push_back(Span{idx_y, x_begin, x_end, is_hit ? sensor._hit_increment : sensor._miss_increment});
+                });
+        });
+
+        // The rasterizer emits ascending rows, so each band is a contiguous range of every span list.
+        const int bands = (map.height() + _band_rows - 1) / _band_rows;
+        _pool.parallel_for(bands, [&](int band) {
+            const int y_begin = band * _band_rows;
+            const int y_end = y_begin + _band_rows;
+            for (size_t i = 0; i < echoes.size(); i++) {
+                const std::vector<Span>& spans = _spans[i];
+                auto it = std::lower_bound(spans.begin(), spans.end(), y_begin,
+                    [](const Span& span, int y) { return span.y < y; });
+                for (; it != spans.end() && it->y < y_end; ++it) {
+                    map.update_region(it->x_begin, it->y, it->x_end, it->y + 1, it->log_odds);
+                }
+            }
+        });
+        GRID_METRICS_RUN(for (size_t i = 0; i < echoes.size(); i++) {
+            for (const Span& span : _spans[i]) {
+                grid_metrics().cells_touched += span.x_end - span.x_begin;
+            }
+        });
+        if (skipped != 0) {
+            std::cout << "Frame fusion error: skipped " << skipped << " echoes of unregistered sensors";
+            return false;
+        }
+        return true;
+    }
+};
+
+typedef BasicGridFrameFusion<GridCell> GridFrameFusion;
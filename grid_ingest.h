@@ -0,0 +1,345 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_fusion.h"
+#include "grid_map.h"
+#include "grid_sensor.h"
+
+// Default parameter values.
+const int DEFAULT_INGEST_QUEUE = 1024;          // Echo queue slots, rounded up to a power of two.
+const int DEFAULT_INGEST_BATCH = 64;            // Echoes per batch of the worker, about 5 frames of 12 sensors.
+const int DEFAULT_ODOMETRY_HISTORY = 256;       // Odometry samples kept for the interpolation.
+const int DEFAULT_INGEST_IDLE_US = 200;         // Worker sleep when there is nothing to do [us].
+
+// Bounded lock-free queue, any number of producer threads and one consumer thread.
+// Each slot carries a sequence number telling whether it is free for the push of a position or
+// holds the item for its pop, so producers only contend on the head counter.
+template <typename T>
+class GridMpscQueue
+{
+public:
+    explicit GridMpscQueue(int capacity = DEFAULT_INGEST_QUEUE)
+    {
+        size_t size = 1;
+        while (size < static_cast<size_t>(std::max(capacity, 2))) size <<= 1;
+        _slots.reset(new Slot[size]);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _head.store(0, std::memory_order_relaxed);
+        _tail = 0;
+    }
+
+    GridMpscQueue(const GridMpscQueue&) = delete;
+    GridMpscQueue& operator=(const GridMpscQueue&) = delete;
+
+    size_t capacity() const { return _mask + 1; }
+
+    // Any thread, fails when the queue is full.
+    bool push(const T& item)
+    {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &_slots[pos & _mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = item;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only, fails when the queue is empty.
+    bool pop(T& item)
+    {
+        Slot& slot = _slots[_tail & _mask];
+        if (slot.sequence.load(std::memory_order_acquire) != _tail + 1) return false;
+        item = slot.item;
+        slot.sequence.store(_tail + _mask + 1, std::memory_order_release);
+        _tail++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;   // pos while free for the push of pos, pos + 1 once it holds it.
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _head;      // Next push position.
+    alignas(64) size_t _tail;                   // Next pop position, consumer only.
+};
+
+// One timestamped echo of a sensor registered with the fusion engine of the ingest.
+struct GridTimedEcho
+{
+    double stamp;       // [s].
+    int sensor_id;
+    float range;        // [m].
+};
+
+// Vehicle pose (x [m], y [m], yaw [rad]) in the map frame at a time.
+struct GridOdometrySample
+{
+    double stamp;       // [s].
+    Eigen::Vector3d pose;
+};
+
+// The most recent vehicle poses, interpolated linearly between the samples around a time,
+// the yaw along the shorter turn. Samples must arrive in time order, older ones are ignored.
+class GridOdometryHistory
+{
+public:
+    explicit GridOdometryHistory(int capacity = DEFAULT_ODOMETRY_HISTORY)
+    {
+        _capacity = std::max(2, capacity);
+    }
+
+    bool empty() const { return _samples.empty(); }
+    double oldest_stamp() const { return _samples.front().stamp; }
+    double newest_stamp() const { return _samples.back().stamp; }
+
+    void add(const GridOdometrySample& sample)
+    {
+        if (!_samples.empty() && sample.stamp <= _samples.back().stamp)
+            return;
+
+        if (static_cast<int>(_samples.size()) == _capacity) {
+            _samples.pop_front();
+        }
+        _samples.push_back(sample);
+    }
+
+    // Pose at stamp, fails outside [oldest_stamp, newest_stamp].
+    bool interpolate(double stamp, Eigen::Vector3d& pose) const
+    {
+        if (_samples.empty() || stamp < oldest_stamp() || stamp > newest_stamp())
+            return false;
+
+        auto next = std::lower_bound(_samples.begin(), _samples.end(), stamp,
+            [](const GridOdometrySample& sample, double t) { return sample.stamp < t; });
+        if (next->stamp == stamp) {
+            pose = next->pose;
+            return true;
+        }
+        const GridOdometrySample& a = *(next - 1);
+        const GridOdometrySample& b = *next;
+        const double t = (stamp - a.stamp) / (b.stamp - a.stamp);
+        pose.x() = a.pose.x() + t * (b.pose.x() - a.pose.x());
+        pose.y() = a.pose.y() + t * (b.pose.y() - a.pose.y());
+        pose.z() = a.pose.z() + t * std::remainder(b.pose.z() - a.pose.z(), 2.0 * M_PI);
+        return true;
+    }
+
+private:
+    int _capacity;
+    std::deque<GridOdometrySample> _samples;
+};
+
+struct GridIngestStats
+{
+    uint64_t received;          // Echoes pushed.
+    uint64_t integrated;        // Echoes integrated into the map.
+    uint64_t dropped_full;      // Echoes refused by a full queue.
+    uint64_t dropped_stale;     // Echoes older than the odometry history.
+    uint64_t dropped_sensor;    // Echoes of a sensor id not registered with the fusion engine.
+    uint64_t dropped_odometry;  // Odometry samples refused by a full queue.
+};
+
+// Asynchronous echo ingestion. Sensor threads push timestamped echoes and the odometry thread pushes
+// vehicle poses, both lock free, and a worker drains them in batches into the frame fusion engine
+// with each echo placed at the vehicle pose interpolated for its stamp. Echoes newer than the
+// latest odometry wait for it, echoes older than the history are dropped, so the history must span
+// the queueing delay.
+// Between start and stop the map belongs to the worker: read or move it from the batch callback,
+// which runs on the worker after every integrated batch, e.g. to recenter or publish a snapshot.
+// Without start the caller may run the worker steps itself with process.
+template <typename CellT = GridCell>
+class BasicGridEchoIngest
+{
+public:
+    typedef std::function<void(BasicGridMap<CellT>&)> BatchFn;
+
+    BasicGridEchoIngest(BasicGridMap<CellT>& map, const BasicGridSensor<CellT>& sensor,
+        int queue_size = DEFAULT_INGEST_QUEUE, int batch = DEFAULT_INGEST_BATCH, int history = DEFAULT_ODOMETRY_HISTORY)
+        : _map(map), _sensor(sensor), _fusion(1), _echo_queue(queue_size), _odometry_queue(queue_size), _history(history)
+    {
+        _batch = std::max(1, batch);
+        _idle = std::chrono::microseconds(DEFAULT_INGEST_IDLE_US);
+        _running.store(false);
+        _received.store(0);
+        _integrated.store(0);
+        _dropped_full.store(0);
+        _dropped_stale.store(0);
+        _dropped_sensor.store(0);
+        _dropped_odometry.store(0);
+    }
+
+    ~BasicGridEchoIngest()
+    {
+        stop();
+    }
+
+    BasicGridEchoIngest(const BasicGridEchoIngest&) = delete;
+    BasicGridEchoIngest& operator=(const BasicGridEchoIngest&) = delete;
+
+    // Sensor mounts and thread count of the batch integration, configure before start. The batches
+    // run on the worker alone by default, more threads only pay off for large batches.
+    BasicGridFrameFusion<CellT>& fusion() { return _fusion; }
+
+    void set_batch_callback(BatchFn fn) { _batch_fn = fn; }
+
+    // Any thread, fails when the echo queue is full or the sensor is not registered with fusion().
+    bool push_echo(const GridTimedEcho& echo)
+    {
+        _received.fetch_add(1, std::memory_order_relaxed);
+        if (!_fusion.has_sensor(echo.sensor_id)) {
+            _dropped_sensor.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!_echo_queue.push(echo)) {
+            _dropped_full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Any thread, samples are expected in time order. Fails when the odometry queue is full.
+    bool push_odometry(const GridOdometrySample& sample)
+    {
+        if (!_odometry_queue.push(sample)) {
+            _dropped_odometry.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Starts the worker thread.
+    void start()
+    {
+        if (_running.exchange(true)) return;
+        _worker = std::thread([this] {
+            while (_running.load(std::memory_order_acquire)) {
+                if (process() == 0) {
+                    std::this_thread::sleep_for(_idle);
+                }
+            }
+        });
+    }
+
+    // Stops the worker after its current batch, echoes still queued stay queued.
+    void stop()
+    {
+        if (!_running.exchange(false)) return;
+        _worker.join();
+    }
+
+    bool is_running() const { return _running.load(); }
+
+    // One worker step: takes the queued odometry and up to a batch of echoes and integrates the
+    // echoes whose pose is known. Returns the number of echoes integrated or dropped.
+    // Only the worker, or the caller while the worker is not running, may call it.
+    int process()
+    {
+        GridOdometrySample sample;
+        while (_odometry_queue.pop(sample)) {
+            _history.add(sample);
+        }
+        GridTimedEcho echo;
+        while (static_cast<int>(_pending.size()) < _batch && _echo_queue.pop(echo)) {
+            _pending.push_back(echo);
+        }
+        if (_pending.empty() || _history.empty())
+            return 0;
+
+        // Stamp order, so each cell sees its updates in measurement order whatever the arrival.
+        std::stable_sort(_pending.begin(), _pending.end(),
+            [](const GridTimedEcho& a, const GridTimedEcho& b) { return a.stamp < b.stamp; });
+        _echoes.clear();
+        _poses.clear();
+        size_t waiting = 0;
+        int dropped = 0;
+        Eigen::Vector3d pose;
+        for (const GridTimedEcho& e : _pending) {
+            if (e.stamp > _history.newest_stamp()) {
+                _pending[waiting++] = e;
+            } else if (_history.interpolate(e.stamp, pose)) {
+                _echoes.push_back(GridEcho{e.sensor_id, e.range});
+                _poses.push_back(pose);
+            } else {
+                dropped++;
+            }
+        }
+        _pending.resize(waiting);
+        _dropped_stale.fetch_add(dropped, std::memory_order_relaxed);
+        if (!_echoes.empty()) {
+            _fusion.integrate_echoes(_map, _sensor, _poses, _echoes);
+            _integrated.fetch_add(_echoes.size(), std::memory_order_relaxed);
+            if (_batch_fn) {
+                _batch_fn(_map);
+            }
+        }
+        return static_cast<int>(_echoes.size()) + dropped;
+    }
+
+    GridIngestStats stats() const
+    {
+        GridIngestStats stats;
+        stats.received = _received.load(std::memory_order_relaxed);
+        stats.integrated = _integrated.load(std::memory_order_relaxed);
+        stats.dropped_full = _dropped_full.load(std::memory_order_relaxed);
+        stats.dropped_stale = _dropped_stale.load(std::memory_order_relaxed);
+        stats.dropped_sensor = _dropped_sensor.load(std::memory_order_relaxed);
+        stats.dropped_odometry = _dropped_odometry.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    BasicGridMap<CellT>& _map;
+    BasicGridSensor<CellT> _sensor;
+    BasicGridFrameFusion<CellT> _fusion;
+    GridMpscQueue<GridTimedEcho> _echo_queue;
+    GridMpscQueue<GridOdometrySample> _odometry_queue;
+    GridOdometryHistory _history;                   // Worker only.
+    std::vector<GridTimedEcho> _pending;            // Worker only, echoes waiting for their odometry.
+    std::vector<GridEcho> _echoes;                  // Worker only, the batch being integrated.
+    std::vector<Eigen::Vector3d> _poses;            // Vehicle pose of each echo of the batch.
+    int _batch;
+    std::chrono::microseconds _idle;
+    BatchFn _batch_fn;
+    std::thread _worker;
+    std::atomic<bool> _running;
+    std::atomic<uint64_t> _received;
+    std::atomic<uint64_t> _integrated;
+    std::atomic<uint64_t> _dropped_full;
+    std::atomic<uint64_t> _dropped_stale;
+    std::atomic<uint64_t> _dropped_sensor;
+    std::atomic<uint64_t> _dropped_odometry;
+};
+
+typedef BasicGridEchoIngest<GridCell> GridEchoIngest;
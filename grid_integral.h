@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+
+// Summed-area tables of is_occupied() and is_free() over a GridMap, any rectangle count is four lookups.
+// Each row keeps its prefix counts, update() recomputes the row prefixes right of the dirty regions
+// and accumulates the tables from the first changed row down. A window shift remaps the row prefixes
+// instead of recounting the map: cells coming into view are prior cells, which are neither occupied
+// nor free, so a shifted prefix is the difference of two old prefixes.
+template <typename CellT = GridCell>
+class BasicGridIntegral
+{
+public:
+    BasicGridIntegral()
+    {
+        _width = 0;
+        _height = 0;
+        _last_epoch = 0;
+        _last_shift_x = 0;
+        _last_shift_y = 0;
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // Brings the tables up to date with map, call it after the map changed and before queries.
+    void update(const BasicGridMap<CellT>& map)
+    {
+        const GridDirtyTracker& dirty = map.dirty();
+        uint32_t now = dirty.checkpoint();
+        _row_begin.assign(map.height(), map.width());
+        int first_row = map.height();
+        if (map.width() != _width || map.height() != _height) {
+            resize(map.width(), map.height());
+            std::fill(_row_begin.begin(), _row_begin.end(), 0);
+            first_row = 0;
+        } else {
+            int dx = static_cast<int>(dirty.shift_x() - _last_shift_x);
+            int dy = static_cast<int>(dirty.shift_y() - _last_shift_y);
+            if (dx != 0 || dy != 0) {
+                shift_rows(_row_occupied, dx, dy);
+                shift_rows(_row_free, dx, dy);
+                first_row = 0;
+            }
+            dirty.for_each_changed(_last_epoch, [&](const GridRegion& region) {
+                for (int y = region.y_begin; y < region.y_end; y++) {
+                    _row_begin[y] = std::min(_row_begin[y], region.x_begin);
+                }
+                first_row = std::min(first_row, region.y_begin);
+            });
+        }
+
+        for (int y = 0; y < _height; y++) {
+            if (_row_begin[y] < _width) count_row(map, y, _row_begin[y]);
+        }
+        accumulate(first_row);
+
+        _last_epoch = now;
+        _last_shift_x = dirty.shift_x();
+        _last_shift_y = dirty.shift_y();
+    }
+
+    // Number of is_occupied() cells in the logical region, clipped to the map.
+    int count_occupied(const GridRegion& region) const
+    {
+        return count(_sum_occupied, region);
+    }
+
+    // Number of is_free() cells in the logical region, clipped to the map.
+    int count_free(const GridRegion& region) const
+    {
+        return count(_sum_free, region);
+    }
+
+private:
+    int _width;
+    int _height;
+    uint32_t _last_epoch;                   // Dirty epoch covered by the tables.
+    long long _last_shift_x;                // Window shift covered by the tables.
+    long long _last_shift_y;
+    std::vector<int32_t> _row_occupied;     // Count of [0, x) in row y at y * (width + 1) + x.
+    std::vector<int32_t> _row_free;
+    std::vector<int32_t> _sum_occupied;     // Count of [0, x) x [0, y) at y * (width + 1) + x.
+    std::vector<int32_t> _sum_free;
+    std::vector<int> _row_begin;            // First changed column of each row in update.
+    std::vector<int32_t> _scratch;
+
+    void resize(int width, int height)
+    {
+        _width = width;
+        _height = height;
+        _row_occupied.assign(static_cast<size_t>(height) * (width + 1), 0);
+        _row_free.assign(static_cast<size_t>(height) * (width + 1), 0);
+        _sum_occupied.assign(static_cast<size_t>(height + 1) * (width + 1), 0);
+        _sum_free.assign(static_cast<size_t>(height + 1) * (width + 1), 0);
+    }
+
+    // The cell formerly at (x + dx, y + dy) is now at (x, y), the prefix of [0, x) in the new row is
+    // the old row prefix of [dx, x + dx) clipped to the old row.
+    void shift_rows(std::vector<int32_t>& rows, int dx, int dy)
+    {
+        const int stride = _width + 1;
+        _scratch.assign(rows.size(), 0);
+        const int lo = std::max(0, std::min(dx, _width));
+        for (int y = 0; y < _height; y++) {
+            int src_y = y + dy;
+            if (src_y < 0 || src_y >= _height) continue;
+            const int32_t* src = &rows[src_y * stride];
+            int32_t* dst = &_scratch[y * stride];
+            const int32_t base = src[lo];
+            for (int x = 0; x <= _width; x++) {
+                dst[x] = src[std::max(0, std::min(x + dx, _width))] - base;
+            }
+        }
+        rows.swap(_scratch);
+    }
+
+    // Recounts the prefixes of row y from column x_begin on.
+    void count_row(const BasicGridMap<CellT>& map, int y, int x_begin)
+    {
+        int32_t* occupied = &_row_occupied[y * (_width + 1)];
+        int32_t* free = &_row_free[y * (_width + 1)];
+        map.for_each_run(GridRegion{x_begin, y, _width, y + 1}, [&](const CellT* cell, int x, int, int run) {
+            for (int i = 0; i < run; i++) {
+                occupied[x + i + 1] = occupied[x + i] + cell[i].is_occupied();
+                free[x + i + 1] = free[x + i] + cell[i].is_free();
+            }
+        });
+    }
+
+    // Rebuilds the table rows after first_row from the row prefixes.
+    void accumulate(int first_row)
+    {
+        const int stride = _width + 1;
+        for (int y = first_row; y < _height; y++) {
+            const int32_t* row_occupied = &_row_occupied[y * stride];
+            const int32_t* row_free = &_row_free[y * stride];
+            const int32_t* above_occupied = &_sum_occupied[y * stride];
+            const int32_t* above_free = &_sum_free[y * stride];
+            int32_t* sum_occupied = &_sum_occupied[(y + 1) * stride];
+            int32_t* sum_free = &_sum_free[(y + 1) * stride];
+            for (int x = 0; x <= _width; x++) {
+                sum_occupied[x] = above_occupied[x] + row_occupied[x];
+                sum_free[x] = above_free[x] + row_free[x];
+            }
+        }
+    }
+
+    int count(const std::vector<int32_t>& sum, GridRegion region) const
+    {
+        region.x_begin = std::max(region.x_begin, 0);
+        region.y_begin = std::max(region.y_begin, 0);
+        region.x_end = std::min(region.x_end, _width);
+        region.y_end = std::min(region.y_end, _height);
+        if (region.x_begin >= region.x_end || region.y_begin >= region.y_end) return 0;
+
+        const int stride = _width + 1;
+        return sum[region.y_end * stride + region.x_end] - sum[region.y_begin * stride + region.x_end]
+            - sum[region.y_end * stride + region.x_begin] + sum[region.y_begin * stride + region.x_begin];
+    }
+};
+
+typedef BasicGridIntegral<GridCell> GridIntegral;
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "grid_cell.h"
+#include "grid_map.h"
+
+// Default parameter values.
+const int GRID_FILE_VERSION = 1;
+const int GRID_FILE_TILE = 32;          // RLE tile edge [cells].
+const int GRID_FILE_MAX_TILE = 4096;    // Largest RLE tile edge accepted on load [cells].
+
+enum class GridFileCompression
+{
+    NONE = 0,       // Raw cells in logical row-major order, can be viewed in place.
+    TILE_RLE = 1    // GRID_FILE_TILE x GRID_FILE_TILE tiles of (uint16 run length, raw value) pairs.
+};
+
+// Cell type codes of the file header.
+template <typename T> struct GridFileCellType;
+template <> struct GridFileCellType<float> { static const uint8_t code = 1; };
+template <> struct GridFileCellType<int16_t> { static const uint8_t code = 2; };
+template <> struct GridFileCellType<int8_t> { static const uint8_t code = 3; };
+
+// File header, host byte order. The cells start right after it, 64-byte aligned.
+// TILE_RLE data starts with tiles + 1 uint32 offsets of the tile streams relative to the data.
+struct GridFileHeader
+{
+    char magic[4];              // "UGMP".
+    uint16_t version;
+    uint8_t cell_type;          // GridFileCellType code.
+    uint8_t layout;             // GridLayout of the saved map, restored on load.
+    uint8_t rolling;            // Rolling mode of the saved map, restored on load.
+    uint8_t compression;        // GridFileCompression.
+    uint16_t reserved0;
+    float resolution;           // [m/cell].
+    int32_t width;              // [cells].
+    int32_t height;             // [cells].
+    int32_t tile;               // RLE tile edge [cells].
+    int32_t reserved1;
+    double origin_x;            // Left-down corner of cell (0, 0) [m].
+    double origin_y;
+    uint64_t data_size;         // Bytes after the header.
+};
+static_assert(sizeof(GridFileHeader) == 56, "The header layout is part of the file format.");
+
+const size_t GRID_FILE_DATA_OFFSET = 64;
+
+// Appends one RLE pair to a TILE_RLE stream.
+template <typename T>
+void grid_file_append_run(std::vector<uint8_t>& out, uint16_t count, T value)
+{
+    size_t at = out.size();
+    out.resize(at + sizeof(count) + sizeof(value));
+    std::memcpy(&out[at], &count, sizeof(count));
+    std::memcpy(&out[at + sizeof(count)], &value, sizeof(value));
+}
+
+// Writes map to out in the grid file format.
+template <typename CellT>
+void serialize_grid_map(const BasicGridMap<CellT>& map, std::vector<uint8_t>& out,
+    GridFileCompression compression = GridFileCompression::NONE)
+{
+    typedef typename CellT::value_type value_type;
+    GridFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "UGMP", 4);
+    header.version = GRID_FILE_VERSION;
+    header.cell_type = GridFileCellType<value_type>::code;
+    header.layout = static_cast<uint8_t>(map.layout());
+    header.rolling = map.is_rolling();
+    header.compression = static_cast<uint8_t>(compression);
+    header.resolution = map.resolution();
+    header.width = map.width();
+    header.height = map.height();
+    header.tile = GRID_FILE_TILE;
+    header.origin_x = map.origin().x();
+    header.origin_y = map.origin().y();
+
+    out.assign(GRID_FILE_DATA_OFFSET, 0);
+    if (compression == GridFileCompression::NONE) {
+        out.resize(GRID_FILE_DATA_OFFSET + sizeof(CellT) * map.width() * map.height());
+        CellT* cells = reinterpret_cast<CellT*>(&out[GRID_FILE_DATA_OFFSET]);
+        map.for_each_run(GridRegion{0, 0, map.width(), map.height()}, [&](const CellT* cell, int x, int y, int run) {
+            std::memcpy(cells + y * map.width() + x, cell, sizeof(CellT) * run);
+        });
+    } else {
+        const int tiles_x = (map.width() + GRID_FILE_TILE - 1) / GRID_FILE_TILE;
+        const int tiles_y = (map.height() + GRID_FILE_TILE - 1) / GRID_FILE_TILE;
+        const size_t table = sizeof(uint32_t) * (tiles_x * tiles_y + 1);
+        out.resize(GRID_FILE_DATA_OFFSET + table);
+        std::vector<uint32_t> offsets;
+        offsets.reserve(tiles_x * tiles_y + 1);
+        for (int ty = 0; ty < tiles_y; ty++) {
+            for (int tx = 0; tx < tiles_x; tx++) {
+                offsets.push_back(static_cast<uint32_t>(out.size() - GRID_FILE_DATA_OFFSET));
+                int x_end = std::min((tx + 1) * GRID_FILE_TILE, map.width());
+                int y_end = std::min((ty + 1) * GRID_FILE_TILE, map.height());
+                value_type value = 0;
+                uint16_t count = 0;
+                for (int y = ty * GRID_FILE_TILE; y < y_end; y++) {
+                    for (int x = tx * GRID_FILE_TILE; x < x_end; x++) {
+                        value_type v = map(x, y)._log_odds_val;
+                        if (count > 0 && (std::memcmp(&v, &value, sizeof(v)) != 0 || count == UINT16_MAX)) {
+                            grid_file_append_run(out, count, value);
+                            count = 0;
+                        }
+                        value = v;
+                        count++;
+                    }
+                }
+                grid_file_append_run(out, count, value);
+            }
+        }
+        offsets.push_back(static_cast<uint32_t>(out.size() - GRID_FILE_DATA_OFFSET));
+        std::memcpy(&out[GRID_FILE_DATA_OFFSET], offsets.data(), table);
+    }
+    header.data_size = out.size() - GRID_FILE_DATA_OFFSET;
+    std::memcpy(out.data(), &header, sizeof(header));
+}
+
+// Checks the header of a grid file buffer for cell type T, returns null if it is not valid.
+// Every field is checked, the map size against the data there is to fill it and against the
+// int cell indices of BasicGridMap in either layout.
+template <typename T>
+const GridFileHeader* grid_file_header(const uint8_t* data, size_t size)
+{
+    if (size < GRID_FILE_DATA_OFFSET) return nullptr;
+    const GridFileHeader* header = reinterpret_cast<const GridFileHeader*>(data);
+    if (std::memcmp(header->magic, "UGMP", 4) != 0 || header->version != GRID_FILE_VERSION
+        || header->cell_type != GridFileCellType<T>::code || header->width <= 0 || header->height <= 0
+        || header->layout > static_cast<uint8_t>(GridLayout::TILED) || header->rolling > 1
+        || !std::isfinite(header->resolution) || header->resolution <= 0.0f
+        || header->data_size > size - GRID_FILE_DATA_OFFSET) {
+        return nullptr;
+    }
+    const uint64_t padded_width = (static_cast<uint64_t>(header->width) + LAYOUT_TILE - 1) / LAYOUT_TILE * LAYOUT_TILE;
+    const uint64_t padded_height = (static_cast<uint64_t>(header->height) + LAYOUT_TILE - 1) / LAYOUT_TILE * LAYOUT_TILE;
+    if (padded_width * padded_height > static_cast<uint64_t>(INT32_MAX)) return nullptr;
+
+    const uint64_t cells = static_cast<uint64_t>(header->width) * header->height;
+    if (header->compression == static_cast<uint8_t>(GridFileCompression::NONE)) {
+        if (header->data_size < sizeof(T) * cells) return nullptr;
+    } else if (header->compression == static_cast<uint8_t>(GridFileCompression::TILE_RLE)) {
+        if (header->tile <= 0 || header->tile > GRID_FILE_MAX_TILE) return nullptr;
+        const uint64_t tiles = ((static_cast<uint64_t>(header->width) + header->tile - 1) / header->tile)
+            * ((static_cast<uint64_t>(header->height) + header->tile - 1) / header->tile);
+        // The offset table, then at least one run per tile and no run longer than UINT16_MAX.
+        const uint64_t table = sizeof(uint32_t) * (tiles + 1);
+        const uint64_t pair = sizeof(uint16_t) + sizeof(T);
+        if (header->data_size < table || (header->data_size - table) / pair < tiles
+            || cells > (header->data_size - table) / pair * UINT16_MAX) {
+            return nullptr;
+        }
+    } else {
+        return nullptr;
+    }
+    return header;
+}
+
+// Decodes the TILE_RLE cells of a checked header into map, false if a tile stream does not cover
+// its tile exactly.
+template <typename CellT>
+bool grid_file_decode_rle(const GridFileHeader* header, const uint8_t* body, BasicGridMap<CellT>& map)
+{
+    typedef typename CellT::value_type value_type;
+    const int tile = header->tile;
+    const int tiles_x = (map.width() + tile - 1) / tile;
+    const int tiles_y = (map.height() + tile - 1) / tile;
+    const size_t pair = sizeof(uint16_t) + sizeof(value_type);
+    const uint64_t table = sizeof(uint32_t) * (static_cast<uint64_t>(tiles_x) * tiles_y + 1);
+    for (int t = 0; t < tiles_x * tiles_y; t++) {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        std::memcpy(&begin, body + sizeof(uint32_t) * t, sizeof(begin));
+        std::memcpy(&end, body + sizeof(uint32_t) * (t + 1), sizeof(end));
+        if (begin < table || begin > end || end > header->data_size || (end - begin) % pair != 0) return false;
+
+        const int tx = t % tiles_x;
+        const int ty = t / tiles_x;
+        const int x_begin = tx * tile;
+        const int x_end = std::min(x_begin + tile, map.width());
+        const int y_end = std::min((ty + 1) * tile, map.height());
+        int x = x_begin;
+        int y = ty * tile;
+        for (uint32_t at = begin; at < end; at += pair) {
+            uint16_t count = 0;
+            value_type value = 0;
+            std::memcpy(&count, body + at, sizeof(count));
+            std::memcpy(&value, body + at + sizeof(count), sizeof(value));
+            for (; count > 0; count--) {
+                if (y == y_end) return false;
+                map(x, y)._log_odds_val = value;
+                if (++x == x_end) {
+                    x = x_begin;
+                    y++;
+                }
+            }
+        }
+        if (y != y_end) return false;
+    }
+    return true;
+}
+
+// Reads a grid file buffer into map, restoring geometry, layout and rolling mode. The cells are
+// decoded into a map of the same allocator first, map is only replaced when the whole file is
+// valid. The dirty tracking of map carries on with every tile marked.
+template <typename CellT>
+bool deserialize_grid_map(const uint8_t* data, size_t size, BasicGridMap<CellT>& map)
+{
+    typedef typename CellT::value_type value_type;
+    const GridFileHeader* header = grid_file_header<value_type>(data, size);
+    if (header == nullptr) {
+        std::cout << "Invalid grid map file data.";
+        return false;
+    }
+
+    BasicGridMap<CellT> decoded(header->resolution, 1, 1, Eigen::Vector3d::Zero(), map.allocator());
+    if (!decoded.set_layout(static_cast<GridLayout>(header->layout))
+        || !decoded.init(header->resolution, header->width, header->height, Eigen::Vector3d::Zero())) {
+        return false;
+    }
+    decoded.set_origin(Eigen::Vector2d(header->origin_x, header->origin_y));
+
+    const uint8_t* body = data + GRID_FILE_DATA_OFFSET;
+    if (header->compression == static_cast<uint8_t>(GridFileCompression::NONE)) {
+        const CellT* cells = reinterpret_cast<const CellT*>(body);
+        decoded.for_each_run(GridRegion{0, 0, decoded.width(), decoded.height()}, [&](CellT* cell, int x, int y, int run) {
+            std::memcpy(cell, cells + y * decoded.width() + x, sizeof(CellT) * run);
+        });
+    } else if (!grid_file_decode_rle(header, body, decoded)) {
+        std::cout << "Invalid grid map file data.";
+        return false;
+    }
+    decoded.set_rolling(header->rolling != 0);
+
+    // A map on an external buffer keeps it, the cells are copied into it if they fit.
+    GridDirtyTracker dirty = map.dirty();
+    if (map.has_external_buffer()) {
+        if (static_cast<size_t>(decoded.storage_size()) > map.external_buffer_cells()) {
+            std::cout << "External buffer too small in grid mapping.";
+            return false;
+        }
+        map = decoded;
+    } else {
+        map.swap(decoded);
+    }
+    dirty.resize(map.width(), map.height());
+    map.dirty() = dirty;
+    return true;
+}
+
+template <typename CellT>
+bool save_grid_map(const BasicGridMap<CellT>& map, const std::string& path,
+    GridFileCompression compression = GridFileCompression::NONE)
+{
+    std::vector<uint8_t> data;
+    serialize_grid_map(map, data, compression);
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!file) {
+        std::cout << "Write grid map file error: " << path;
+        return false;
+    }
+    return true;
+}
+
+// Read-only memory mapping of a grid file, POSIX only.
+class GridMapFile
+{
+public:
+    GridMapFile()
+    {
+        _data = nullptr;
+        _size = 0;
+    }
+
+    ~GridMapFile()
+    {
+        close();
+    }
+
+    GridMapFile(const GridMapFile&) = delete;
+    GridMapFile& operator=(const GridMapFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cout << "Open grid map file error: " << path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                _data = static_cast<const uint8_t*>(data);
+                _size = st.st_size;
+            }
+        }
+        ::close(fd);
+        return _data != nullptr;
+    }
+
+    void close()
+    {
+        if (_data != nullptr) {
+            munmap(const_cast<uint8_t*>(_data), _size);
+            _data = nullptr;
+            _size = 0;
+        }
+    }
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t* _data;
+    size_t _size;
+};
+
+template <typename CellT>
+bool load_grid_map(const std::string& path, BasicGridMap<CellT>& map)
+{
+    GridMapFile file;
+    return file.open(path) && deserialize_grid_map(file.data(), file.size(), map);
+}
+
+// Zero-copy read-only map over an uncompressed grid file buffer, for example a GridMapFile.
+// The buffer must outlive the view. Cells are in logical row-major order whatever the saved layout.
+template <typename CellT = GridCell>
+class BasicGridMapView
+{
+public:
+    BasicGridMapView()
+    {
+        _cells = nullptr;
+        _resolution = 0.0f;
+        _width = 0;
+        _height = 0;
+        _origin.setZero();
+    }
+
+    // Returns false if data is not an uncompressed grid file of CellT cells.
+    bool attach(const uint8_t* data, size_t size)
+    {
+        const GridFileHeader* header = grid_file_header<typename CellT::value_type>(data, size);
+        if (header == nullptr || header->compression != static_cast<uint8_t>(GridFileCompression::NONE)) {
+            _cells = nullptr;
+            return false;
+        }
+        _cells = reinterpret_cast<const CellT*>(data + GRID_FILE_DATA_OFFSET);
+        _resolution = header->resolution;
+        _width = header->width;
+        _height = header->height;
+        _origin << header->origin_x, header->origin_y;
+        return true;
+    }
+
+    float resolution() const { return _resolution; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    Eigen::Vector2d origin() const { return _origin; }
+
+    const CellT& operator()(int idx_x, int idx_y) const
+    {
+        return _cells[idx_y * _width + idx_x];
+    }
+
+    bool is_in_border(const int idx_x, const int idx_y) const
+    {
+        return (idx_x >= 0 && idx_x < _width && idx_y >= 0 && idx_y < _height);
+    }
+
+    bool idx_to_xy(const int idx_x, const int idx_y, double &x, double &y) const
+    {
+        x = _origin.x() + _resolution * (idx_x + 0.5);
+        y = _origin.y() + _resolution * (idx_y + 0.5);
+        return is_in_border(idx_x, idx_y);
+    }
+
+    bool xy_to_idx(const double x, const double y, int &idx_x, int &idx_y) const
+    {
+        idx_x = (x - _origin.x()) / _resolution;
+        idx_y = (y - _origin.y()) / _resolution;
+        if (is_in_border(idx_x, idx_y)) {
+            return true;
+        } else {
+            idx_x = std::max(0, std::min(idx_x, _width - 1));
+            idx_y = std::max(0, std::min(idx_y, _height - 1));
+            return false;
+        }
+    }
+
+private:
+    const CellT* _cells;
+    float _resolution;
+    int _width;
+    int _height;
+    Eigen::Vector2d _origin;
+};
+
+typedef BasicGridMapView<GridCell> GridMapView;
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_sensor.h"
+
+// Attribute planes of a BasicLayeredGridMap, combined as a bit set.
+enum GridLayer
+{
+    GRID_LAYER_TIMESTAMP = 1 << 0,      // uint32_t stamp of the last update, 0 for never.
+    GRID_LAYER_HIT_COUNT = 1 << 1,      // uint16_t number of hits, saturating.
+    GRID_LAYER_SENSOR_MASK = 1 << 2,    // uint16_t bit set of the sensor ids that saw the cell.
+    GRID_LAYER_HEIGHT_CLASS = 1 << 3,   // uint8_t application defined height class.
+    GRID_LAYER_ALL = 0xF
+};
+
+const int GRID_LAYER_MAX_SENSORS = 16;  // Sensor ids of the uint16_t sensor mask plane.
+
+// A BasicGridMap with per cell attributes kept as separate planes, struct-of-arrays, so the log odds
+// kernels run on the unchanged map and each loop only touches the planes it needs. The planes use
+// the storage order of the map, index them with index_map() or walk them with for_each_run, and
+// they follow every shift of the map. Planes not selected at construction are not allocated.
+template <typename CellT = GridCell>
+class BasicLayeredGridMap
+{
+public:
+    typedef CellT cell_type;
+    typedef typename CellT::value_type value_type;
+
+    BasicLayeredGridMap(float resolution = RESOLUTION,
+        float width = WIDTH,
+        float height = HEIGHT,
+        const Eigen::Vector3d & center_pos = Eigen::Vector3d(0.0, 0.0, 0.0),
+        uint32_t layers = GRID_LAYER_ALL)
+        : _map(resolution, width, height, center_pos)
+    {
+        _layers = layers;
+        resize_planes();
+    }
+
+    // Read-only, the map is written through this class so the planes stay in step.
+    const BasicGridMap<CellT>& log_odds() const { return _map; }
+
+    float resolution() const { return _map.resolution(); }
+    int width() const { return _map.width(); }
+    int height() const { return _map.height(); }
+    Eigen::Vector2d origin() const { return _map.origin(); }
+    uint32_t layers() const { return _layers; }
+    bool has_layer(GridLayer layer) const { return (_layers & layer) != 0; }
+
+    int index_map(int idx_x, int idx_y) const { return _map.index_map(idx_x, idx_y); }
+
+    // Planes in the storage order of log_odds(), nullptr when the layer was not selected.
+    uint32_t* timestamps() { return plane_data(_timestamp); }
+    uint16_t* hit_counts() { return plane_data(_hit_count); }
+    uint16_t* sensor_masks() { return plane_data(_sensor_mask); }
+    uint8_t* height_classes() { return plane_data(_height_class); }
+    const uint32_t* timestamps() const { return plane_data(_timestamp); }
+    const uint16_t* hit_counts() const { return plane_data(_hit_count); }
+    const uint16_t* sensor_masks() const { return plane_data(_sensor_mask); }
+    const uint8_t* height_classes() const { return plane_data(_height_class); }
+
+    uint32_t& timestamp(int idx_x, int idx_y) { return _timestamp[index_map(idx_x, idx_y)]; }
+    uint16_t& hit_count(int idx_x, int idx_y) { return _hit_count[index_map(idx_x, idx_y)]; }
+    uint16_t& sensor_mask(int idx_x, int idx_y) { return _sensor_mask[index_map(idx_x, idx_y)]; }
+    uint8_t& height_class(int idx_x, int idx_y) { return _height_class[index_map(idx_x, idx_y)]; }
+    uint32_t timestamp(int idx_x, int idx_y) const { return _timestamp[index_map(idx_x, idx_y)]; }
+    uint16_t hit_count(int idx_x, int idx_y) const { return _hit_count[index_map(idx_x, idx_y)]; }
+    uint16_t sensor_mask(int idx_x, int idx_y) const { return _sensor_mask[index_map(idx_x, idx_y)]; }
+    uint8_t height_class(int idx_x, int idx_y) const { return _height_class[index_map(idx_x, idx_y)]; }
+
+    // Calls fn(storage index, idx_x, idx_y, run) for every contiguous run of the planes inside the
+    // logical region, see BasicGridMap::for_each_run.
+    template <typename RunFn>
+    void for_each_run(const GridRegion& region, RunFn fn) const
+    {
+        const CellT* base = &_map(0);
+        _map.for_each_run(region, [&](const CellT* cell, int x, int y, int run) {
+            fn(static_cast<int>(cell - base), x, y, run);
+        });
+    }
+
+    // GridSensor::integrate_echo plus the attributes of the covered cells: all of them get stamp
+    // and the bit of sensor_id, the hit arc also counts a hit. Returns false without touching the map
+    // for a sensor_id outside [0, GRID_LAYER_MAX_SENSORS).
+    bool integrate_echo(const BasicGridSensor<CellT>& sensor, int sensor_id, const Eigen::Vector3d & sensor_pose,
+        float range, float fov, float max_range, uint32_t stamp)
+    {
+        if (sensor_id < 0 || sensor_id >= GRID_LAYER_MAX_SENSORS) {
+            std::cout << "Layered map error: sensor id " << sensor_id << " outside [0, "
+                << GRID_LAYER_MAX_SENSORS << ")";
+            return false;
+        }
+        GRID_METRICS_TIMER(GridPhase::ECHO);
+        GRID_METRICS_ADD(echoes, 1);
+        const uint16_t sensor_bit = static_cast<uint16_t>(1u << sensor_id);
+        const bool has_echo_planes = !_timestamp.empty() || !_sensor_mask.empty() || !_hit_count.empty();
+        BasicGridSensor<CellT>::rasterize_cone(_map, sensor_pose, range, fov, max_range,
+            [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                _map.update_region(x_begin, idx_y, x_end, idx_y + 1,
+                    is_hit ? sensor._hit_increment : sensor._miss_increment);
+                GRID_METRICS_ADD(cells_touched, x_end - x_begin);
+                if (!has_echo_planes) return;
+                for_each_run(GridRegion{x_begin, idx_y, x_end, idx_y + 1}, [&](int i, int, int, int run) {
+                    if (!_timestamp.empty()) {
+                        std::fill_n(&_timestamp[i], run, stamp);
+                    }
+                    if (!_sensor_mask.empty()) {
+                        uint16_t* mask = &_sensor_mask[i];
+                        for (int k = 0; k < run; k++) mask[k] |= sensor_bit;
+                    }
+                    if (is_hit && !_hit_count.empty()) {
+                        uint16_t* count = &_hit_count[i];
+                        for (int k = 0; k < run; k++) count[k] += count[k] != UINT16_MAX;
+                    }
+                });
+            });
+        return true;
+    }
+
+    uint8_t is_in_ext_zone(const Eigen::Vector3d & pos)
+    {
+        return _map.is_in_ext_zone(pos);
+    }
+
+    // See BasicGridMap::extend_map.
+    void extend_map(uint8_t ext_zone_type)
+    {
+        BasicGridMap<CellT>::extension_shifts(ext_zone_type, [this](int dx, int dy) { shift_map(dx, dy); });
+    }
+
+    // See BasicGridMap::recenter_to.
+    bool recenter_to(const Eigen::Vector3d & pos, int dead_band = 0)
+    {
+        int dx = 0;
+        int dy = 0;
+        if (!_map.recenter_offset(pos, dead_band, dx, dy))
+            return false;
+
+        shift_map(dx, dy);
+        return true;
+    }
+
+    // BasicGridMap::shift_map, the planes move the same way and their exposed cells are zeroed.
+    void shift_map(int dx, int dy)
+    {
+        _map.shift_map(dx, dy);
+        for_each_plane([&](auto& plane) {
+            _map.shift_plane(plane.data(), dx, dy, typename std::decay<decltype(plane)>::type::value_type(0));
+        });
+    }
+
+    bool reset_map(const Eigen::Vector3d & pos)
+    {
+        if (!_map.reset_map(pos)) return false;
+        for_each_plane([](auto& plane) { std::fill(plane.begin(), plane.end(), 0); });
+        return true;
+    }
+
+    // See BasicGridMap::set_rolling and set_layout, the planes are reordered along. A failed change
+    // keeps the storage, so the planes stay where they are.
+    bool set_rolling(bool rolling)
+    {
+        if (rolling == _map.is_rolling()) return true;
+        bool changed = false;
+        reorder([&] { changed = _map.set_rolling(rolling); });
+        return changed;
+    }
+
+    bool set_layout(GridLayout layout)
+    {
+        if (layout == _map.layout()) return true;
+        bool changed = false;
+        reorder([&] { changed = _map.set_layout(layout); });
+        return changed;
+    }
+
+private:
+    BasicGridMap<CellT> _map;
+    uint32_t _layers;
+    std::vector<uint32_t> _timestamp;
+    std::vector<uint16_t> _hit_count;
+    std::vector<uint16_t> _sensor_mask;
+    std::vector<uint8_t> _height_class;
+
+    template <typename T>
+    static T* plane_data(std::vector<T>& plane) { return plane.empty() ? nullptr : plane.data(); }
+    template <typename T>
+    static const T* plane_data(const std::vector<T>& plane) { return plane.empty() ? nullptr : plane.data(); }
+
+    // Calls fn(std::vector<T>&) for every allocated plane.
+    template <typename PlaneFn>
+    void for_each_plane(PlaneFn fn)
+    {
+        if (!_timestamp.empty()) fn(_timestamp);
+        if (!_hit_count.empty()) fn(_hit_count);
+        if (!_sensor_mask.empty()) fn(_sensor_mask);
+        if (!_height_class.empty()) fn(_height_class);
+    }
+
+    void resize_planes()
+    {
+        const size_t size = _map.storage_size();
+        _timestamp.assign(has_layer(GRID_LAYER_TIMESTAMP) ? size : 0, 0);
+        _hit_count.assign(has_layer(GRID_LAYER_HIT_COUNT) ? size : 0, 0);
+        _sensor_mask.assign(has_layer(GRID_LAYER_SENSOR_MASK) ? size : 0, 0);
+        _height_class.assign(has_layer(GRID_LAYER_HEIGHT_CLASS) ? size : 0, 0);
+    }
+
+    // Runs a storage change of the map and moves the plane values to the new storage indices.
+    template <typename ChangeFn>
+    void reorder(ChangeFn change)
+    {
+        const int w = width();
+        const int h = height();
+        std::vector<int> old_index(static_cast<size_t>(w) * h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                old_index[y * w + x] = index_map(x, y);
+            }
+        }
+        change();
+        const size_t size = _map.storage_size();
+        for_each_plane([&](auto& plane) {
+            typename std::decay<decltype(plane)>::type moved(size, 0);
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    moved[index_map(x, y)] = plane[old_index[y * w + x]];
+                }
+            }
+            plane.swap(moved);
+        });
+    }
+};
+
+typedef BasicLayeredGridMap<GridCell> LayeredGridMap;
+typedef BasicLayeredGridMap<GridCell16> LayeredGridMap16;
+typedef BasicLayeredGridMap<GridCell8> LayeredGridMap8;
@@ -1,9 +1,22 @@
 #pragma once
 
 #include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "grid_allocator.h"
+#include "grid_bitmask.h"
 #include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_metrics.h"
+#include "grid_simd.h"
 
 
 // Default parameter values.
@@ -11,6 +24,7 @@ const float RESOLUTION = 0.1;   // 0.1m/cell
 const int WIDTH = 300;          // 30m / 0.1m/cell = 300cells
 const int HEIGHT = 300;         // 30m / 0.1m/cell = 300cells
 const int EXT_ZONE = 50;        // 5m / 0.1m/cell = 50cells
+const int LAYOUT_TILE = 16;     // Tile edge of the tiled layout [cells], a float tile row is one cache line.
 
 enum ExtZoneType
 {
@@ -21,113 +35,362 @@ enum ExtZoneType
     RIGHT = 1 << 3
 };
 
-class GridMap
+// Storage order of the cells of a map.
+enum class GridLayout
 {
+    ROW_MAJOR = 0,  // Rows of width cells, width priority.
+    TILED = 1       // LAYOUT_TILE x LAYOUT_TILE row-major tiles in row-major tile order, edges padded.
+};
+
+// An occupancy grid map of CellT cells, see BasicGridCell for the supported storage types.
+// The cell buffer is GRID_STORAGE_ALIGNMENT aligned, so every tile of the tiled layout starts on a
+// cache line. It comes from a GridAllocator or from an attached externally owned buffer.
+template <typename CellT = GridCell>
+class BasicGridMap
+{
+public:
+    typedef CellT cell_type;
+    typedef typename CellT::value_type value_type;
+
+    static_assert(sizeof(CellT) == sizeof(value_type), "Bulk kernels treat cell runs as value_type arrays.");
+    static_assert(std::is_trivially_copyable<CellT>::value, "Maps are copied with memcpy.");
+
 private:
     float _resolution;          // The map resolution [m/cell].
+    double _inv_resolution;     // 1 / _resolution, for the batched conversions.
     int _width;                 // Map width [cells].
     int _height;                // Map height [cells].
     Eigen::Vector2d _origin;    // The origin of the map [m, m].
                                 // This is the real-world position of the left-down of cell (0,0) in the map.
-    GridCell* _map_data;        // The map data, in row-major order, starting with (0,0), width priority.
+    CellT* _map_data;           // The map data, in row-major order, starting with (0,0), width priority.
+    size_t _capacity;           // Cells of the buffer behind _map_data.
+    GridAllocator* _allocator;  // Source of _map_data when no external buffer is attached, not owned.
+    CellT* _buffer;             // Attached external buffer, nullptr when the map owns its storage.
+    size_t _buffer_cells;       // Capacity of _buffer.
+    GridLayout _layout;         // Storage order of _map_data.
+    int _tiles_x;               // Tile columns of the tiled layout.
+    bool _rolling;              // Toroidal indexing mode, extend_map moves the wrap offset instead of the cells.
+    int _wrap_x;                // Storage column of logical column 0 in rolling mode [cells].
+    int _wrap_y;                // Storage row of logical row 0 in rolling mode [cells].
+    GridDirtyTracker _dirty;    // Changed tiles of the map, in logical cell coordinates.
 
 public:
-    GridMap(float resolution = RESOLUTION, 
+    BasicGridMap(float resolution = RESOLUTION, 
         float width = WIDTH, 
         float height = HEIGHT,
-        const Eigen::Vector3d & center_pos = Eigen::Vector3d(0.0, 0.0, 0.0))
+        const Eigen::Vector3d & center_pos = Eigen::Vector3d(0.0, 0.0, 0.0),
+        GridAllocator* allocator = nullptr)
     {
         _map_data = nullptr;
+        _width = _height = _tiles_x = 0;
+        _capacity = 0;
+        _allocator = allocator != nullptr ? allocator : grid_default_allocator();
+        _buffer = nullptr;
+        _buffer_cells = 0;
+        _layout = GridLayout::ROW_MAJOR;
+        _rolling = false;
         init(resolution, width, height, center_pos);
     }
 
-    ~GridMap()
+    ~BasicGridMap()
     {
         delete_map_data();
     }
 
-    GridMap(const GridMap& grid_map)
+    BasicGridMap(const BasicGridMap& grid_map)
     {
         _resolution = grid_map.resolution();
+        _inv_resolution = grid_map._inv_resolution;
         _width = grid_map.width();
         _height = grid_map.height();
         _origin = grid_map.origin();
-
-        int size = _width * _height;
-        _map_data = new GridCell[size];
-        if (_map_data != nullptr) {
-            for (int i = 0; i < size; ++i) {
-                _map_data[i] = grid_map(i);
-            }
+        _layout = grid_map._layout;
+        _tiles_x = grid_map._tiles_x;
+        _rolling = grid_map._rolling;
+        _wrap_x = grid_map._wrap_x;
+        _wrap_y = grid_map._wrap_y;
+        _dirty = grid_map._dirty;
+
+        // The copy owns its storage, from the allocator of the source.
+        _map_data = nullptr;
+        _capacity = 0;
+        _allocator = grid_map._allocator;
+        _buffer = nullptr;
+        _buffer_cells = 0;
+        if (!allocate_map_data()) {
+            clear_geometry();
+            return;
         }
+        copy_map_data(grid_map);
+    }
+
+    BasicGridMap(BasicGridMap&& grid_map) noexcept
+    {
+        _resolution = grid_map._resolution;
+        _inv_resolution = grid_map._inv_resolution;
+        _width = 0;
+        _height = 0;
+        _origin = grid_map._origin;
+        _map_data = nullptr;
+        _capacity = 0;
+        _allocator = grid_default_allocator();
+        _buffer = nullptr;
+        _buffer_cells = 0;
+        _layout = GridLayout::ROW_MAJOR;
+        _tiles_x = 0;
+        _rolling = false;
+        _wrap_x = 0;
+        _wrap_y = 0;
+        swap(grid_map);
     }
 
-    GridMap& operator=(const GridMap& grid_map)
+    // The map keeps its own allocator or external buffer. On an allocation failure the map is left
+    // empty, with a zero width and height.
+    BasicGridMap& operator=(const BasicGridMap& grid_map)
     {
         if (&grid_map == this) return *this;
 
-        if (grid_map.width() != _width || grid_map.height() != _height) {
+        if (grid_map.storage_size() != storage_size() || _map_data == nullptr) {
             delete_map_data();
-            _map_data = new GridCell[grid_map.height() * grid_map.width()];
+            _layout = grid_map._layout;
+            _width = grid_map.width();
+            _height = grid_map.height();
+            _tiles_x = grid_map._tiles_x;
+            if (!allocate_map_data()) {
+                clear_geometry();
+                return *this;
+            }
         }
 
         _resolution = grid_map.resolution();
+        _inv_resolution = grid_map._inv_resolution;
         _width = grid_map.width();
         _height = grid_map.height();
         _origin = grid_map.origin();
-        int size = _width * _height;
+        _layout = grid_map._layout;
+        _tiles_x = grid_map._tiles_x;
+        _rolling = grid_map._rolling;
+        _wrap_x = grid_map._wrap_x;
+        _wrap_y = grid_map._wrap_y;
+        _dirty = grid_map._dirty;
+        copy_map_data(grid_map);
 
-        for (int i = 0; i < size; ++i) {
-            _map_data[i] = grid_map(i);
-        }
+        return *this;
+    }
 
+    BasicGridMap& operator=(BasicGridMap&& grid_map) noexcept
+    {
+        swap(grid_map);
         return *this;
     }
 
-    void init(float resolution, float width, float height, 
+    // Exchanges the buffers and geometry of two maps without copying any cell.
+    void swap(BasicGridMap& grid_map) noexcept
+    {
+        std::swap(_resolution, grid_map._resolution);
+        std::swap(_inv_resolution, grid_map._inv_resolution);
+        std::swap(_width, grid_map._width);
+        std::swap(_height, grid_map._height);
+        std::swap(_origin, grid_map._origin);
+        std::swap(_map_data, grid_map._map_data);
+        std::swap(_capacity, grid_map._capacity);
+        std::swap(_allocator, grid_map._allocator);
+        std::swap(_buffer, grid_map._buffer);
+        std::swap(_buffer_cells, grid_map._buffer_cells);
+        std::swap(_layout, grid_map._layout);
+        std::swap(_tiles_x, grid_map._tiles_x);
+        std::swap(_rolling, grid_map._rolling);
+        std::swap(_wrap_x, grid_map._wrap_x);
+        std::swap(_wrap_y, grid_map._wrap_y);
+        std::swap(_dirty, grid_map._dirty);
+    }
+
+    // The buffer is only reallocated when the number of cells changes. On an allocation failure
+    // the map is left empty, with a zero width and height, and false is returned.
+    bool init(float resolution, float width, float height, 
         const Eigen::Vector3d & center_pos)
     {
+        int old_size = _map_data != nullptr ? storage_size() : 0;
         _resolution = resolution;
+        _inv_resolution = 1.0 / resolution;
         _width = width;
         _height = height;
+        _tiles_x = (_width + LAYOUT_TILE - 1) / LAYOUT_TILE;
+        _wrap_x = 0;
+        _wrap_y = 0;
         set_origin(center_pos);
-        delete_map_data();
-        allocate_map_data();
+        if (old_size != storage_size()) {
+            delete_map_data();
+            if (!allocate_map_data()) {
+                clear_geometry();
+                return false;
+            }
+        }
         reset_map_data();
+        _dirty.resize(_width, _height);
+        return true;
     }
 
+    // Converts the logical cell index to the index of _map_data, applying the wrap offset and layout.
     int index_map(int idx_x, int idx_y) const
     {
-        return idx_y * _width + idx_x;
+        int st_x = idx_x + _wrap_x;
+        int st_y = idx_y + _wrap_y;
+        if (st_x >= _width) st_x -= _width;
+        if (st_y >= _height) st_y -= _height;
+        return storage_index(st_x, st_y);
     }
     
+    // Converts the index of _map_data back to the logical cell index.
     void index_map(int idx, int & idx_x, int & idx_y) const
     {
-        idx_y = idx / _width;
-        idx_x = idx - idx_y * _width;
+        int st_x = 0;
+        int st_y = 0;
+        if (_layout == GridLayout::ROW_MAJOR) {
+            st_y = idx / _width;
+            st_x = idx - st_y * _width;
+        } else {
+            int tile = idx / (LAYOUT_TILE * LAYOUT_TILE);
+            int in_tile = idx - tile * (LAYOUT_TILE * LAYOUT_TILE);
+            int tile_y = tile / _tiles_x;
+            st_y = tile_y * LAYOUT_TILE + in_tile / LAYOUT_TILE;
+            st_x = (tile - tile_y * _tiles_x) * LAYOUT_TILE + in_tile % LAYOUT_TILE;
+        }
+        idx_x = st_x - _wrap_x;
+        idx_y = st_y - _wrap_y;
+        if (idx_x < 0) idx_x += _width;
+        if (idx_y < 0) idx_y += _height;
     }
 
     float resolution() const { return _resolution; }
     int width() const { return _width; }
     int height() const { return _height; }
     Eigen::Vector2d origin() const { return _origin; }
+    bool is_rolling() const { return _rolling; }
+    GridLayout layout() const { return _layout; }
+    int wrap_x() const { return _wrap_x; }
+    int wrap_y() const { return _wrap_y; }
+    const GridDirtyTracker& dirty() const { return _dirty; }
+    GridAllocator* allocator() const { return _allocator; }
+    bool has_external_buffer() const { return _buffer != nullptr; }
+    size_t external_buffer_cells() const { return _buffer_cells; }
+    GridDirtyTracker& dirty() { return _dirty; }
+
+    // Cells written directly through operator() have to be marked here to reach the dirty tracking.
+    void mark_dirty(int idx_x, int idx_y)
+    {
+        _dirty.mark(idx_x, idx_y);
+    }
+
+    // Switches between shifting and toroidal storage, the map content is kept.
+    // Returns false and keeps the map as is when the storage cannot be linearized.
+    bool set_rolling(bool rolling)
+    {
+        if (rolling == _rolling) return true;
+
+        // Linearize the storage so that the logical and storage index coincide again.
+        if ((_wrap_x != 0 || _wrap_y != 0) && !relayout(_layout)) return false;
+        _rolling = rolling;
+        return true;
+    }
+
+    // Switches the storage order, the map content is kept.
+    // Returns false and keeps the map as is when the new storage cannot be allocated.
+    bool set_layout(GridLayout layout)
+    {
+        if (layout == _layout) return true;
+        return relayout(layout);
+    }
+
+    // Number of cells of _map_data, including the padding of the tiled layout.
+    int storage_size() const
+    {
+        if (_layout == GridLayout::ROW_MAJOR) {
+            return _width * _height;
+        }
+        return _tiles_x * tiles_y() * LAYOUT_TILE * LAYOUT_TILE;
+    }
+
+    // Index of _map_data of storage cell (st_x, st_y), i.e. after the wrap offset is applied.
+    int storage_index(int st_x, int st_y) const
+    {
+        if (_layout == GridLayout::ROW_MAJOR) {
+            return st_y * _width + st_x;
+        }
+        int tile = (st_y / LAYOUT_TILE) * _tiles_x + st_x / LAYOUT_TILE;
+        return tile * (LAYOUT_TILE * LAYOUT_TILE) + (st_y % LAYOUT_TILE) * LAYOUT_TILE + st_x % LAYOUT_TILE;
+    }
+
+    // LAYOUT_TILE x LAYOUT_TILE tiles of the logical map, the edge tiles are clipped.
+    int tiles_x() const { return (_width + LAYOUT_TILE - 1) / LAYOUT_TILE; }
+    int tiles_y() const { return (_height + LAYOUT_TILE - 1) / LAYOUT_TILE; }
 
-    GridCell& operator()(int idx_x, int idx_y)
+    GridRegion tile_region(int tile_x, int tile_y) const
+    {
+        GridRegion region;
+        region.x_begin = tile_x * LAYOUT_TILE;
+        region.y_begin = tile_y * LAYOUT_TILE;
+        region.x_end = std::min(region.x_begin + LAYOUT_TILE, _width);
+        region.y_end = std::min(region.y_begin + LAYOUT_TILE, _height);
+        return region;
+    }
+
+    // Calls fn(const GridRegion&) for every tile, in tile row order. Without a wrap offset the tiles
+    // of the tiled layout are contiguous blocks of _map_data.
+    template <typename TileFn>
+    void for_each_tile(TileFn fn) const
+    {
+        for (int tile_y = 0; tile_y < tiles_y(); tile_y++) {
+            for (int tile_x = 0; tile_x < tiles_x(); tile_x++) {
+                fn(tile_region(tile_x, tile_y));
+            }
+        }
+    }
+
+    // Calls fn(cell, idx_x, idx_y, run) for every contiguous run of _map_data inside the logical region,
+    // cell points to the run of cells (idx_x, idx_y) .. (idx_x + run - 1, idx_y).
+    template <typename RunFn>
+    void for_each_run(const GridRegion& region, RunFn fn)
+    {
+        for (int y = region.y_begin; y < region.y_end; y++) {
+            int x = region.x_begin;
+            while (x < region.x_end) {
+                int run = row_run(x, region.x_end);
+                fn(&(*this)(x, y), x, y, run);
+                x += run;
+            }
+        }
+    }
+
+    template <typename RunFn>
+    void for_each_run(const GridRegion& region, RunFn fn) const
+    {
+        for (int y = region.y_begin; y < region.y_end; y++) {
+            int x = region.x_begin;
+            while (x < region.x_end) {
+                int run = row_run(x, region.x_end);
+                fn(&(*this)(x, y), x, y, run);
+                x += run;
+            }
+        }
+    }
+
+    CellT& operator()(int idx_x, int idx_y)
     {
         return (*this)(index_map(idx_x, idx_y));
     }
     
-    const GridCell& operator()(int idx_x, int idx_y) const
+    const CellT& operator()(int idx_x, int idx_y) const
     {
         return (*this)(index_map(idx_x, idx_y));
     }
 
-    GridCell& operator()(int idx)
+    CellT& operator()(int idx)
     {
         return _map_data[idx];
     }
 
-    const GridCell& operator()(int idx) const
+    const CellT& operator()(int idx) const
     {
         return _map_data[idx];
     }
@@ -138,32 +401,186 @@ public:
                    pos.y() - _resolution * _height / 2;
     }
 
-    // Allocates memory for the two dimensional pointer array for map representation.
-    void allocate_map_data()
+    // Sets the left-down corner of cell (0, 0) directly, the cells do not move.
+    void set_origin(const Eigen::Vector2d & origin)
     {
-        _map_data = new GridCell[_width * _height];
+        _origin = origin;
+    }
+
+    // Allocates storage_size() cells, from the external buffer when one is attached. The cells are
+    // not initialized.
+    bool allocate_map_data()
+    {
+        if (_buffer != nullptr) {
+            if (static_cast<size_t>(storage_size()) > _buffer_cells) {
+                std::cout << "External buffer too small in grid mapping.";
+                return false;
+            }
+            _map_data = _buffer;
+            _capacity = _buffer_cells;
+            return true;
+        }
+
+        _map_data = static_cast<CellT*>(_allocator->allocate(sizeof(CellT) * storage_size()));
         if (nullptr == _map_data) {
             std::cout << "Allocate memory error in grid mapping.";
+            return false;
         }
+        _capacity = storage_size();
+        return true;
     }
 
     void delete_map_data()
     {
         if (_map_data != nullptr) {
-            delete[] _map_data;
+            if (_map_data != _buffer) {
+                _allocator->deallocate(_map_data, sizeof(CellT) * _capacity);
+            }
             _map_data = nullptr;
+            _capacity = 0;
+        }
+    }
+
+    // Moves the cells into storage of allocator, nullptr selects grid_default_allocator(), an attached
+    // external buffer is released. On an allocation failure the map keeps its storage.
+    bool set_allocator(GridAllocator* allocator)
+    {
+        allocator = allocator != nullptr ? allocator : grid_default_allocator();
+        CellT* data = static_cast<CellT*>(allocator->allocate(sizeof(CellT) * storage_size()));
+        if (nullptr == data) {
+            std::cout << "Allocate memory error in grid mapping.";
+            return false;
         }
+        move_map_data(data);
+        _allocator = allocator;
+        _buffer = nullptr;
+        _buffer_cells = 0;
+        _map_data = data;
+        _capacity = storage_size();
+        return true;
+    }
+
+    // Keeps the cells in an externally owned buffer of cells cells, GRID_STORAGE_ALIGNMENT aligned,
+    // that the map never frees. init, reset_map and assignments within the capacity then never
+    // allocate, copies of the map and layout changes still allocate through the allocator.
+    bool attach_buffer(CellT* buffer, size_t cells)
+    {
+        if (reinterpret_cast<uintptr_t>(buffer) % GRID_STORAGE_ALIGNMENT != 0
+            || cells < static_cast<size_t>(storage_size())) {
+            std::cout << "Invalid external buffer in grid mapping.";
+            return false;
+        }
+        move_map_data(buffer);
+        _buffer = buffer;
+        _buffer_cells = cells;
+        _map_data = buffer;
+        _capacity = cells;
+        return true;
     }
 
     void reset_map_data()
     {
-        int size = _width * _height;
+        if (_map_data != nullptr) {
+            fill_prior(_map_data, storage_size());
+        }
+    }
 
+    // Copies the cells of a map of the same size, the storage order is kept as is.
+    void copy_map_data(const BasicGridMap& grid_map)
+    {
+        if (_map_data != nullptr && grid_map._map_data != nullptr) {
+            std::memcpy(_map_data, grid_map._map_data, sizeof(CellT) * storage_size());
+        }
+    }
+
+    // Copies the cells into data and releases the current storage.
+    void move_map_data(CellT* data)
+    {
         if (_map_data != nullptr) {
-            for (int i = 0; i < size; ++i) {
-                _map_data[i].reset_value();
+            std::memmove(data, _map_data, sizeof(CellT) * storage_size());
+        } else {
+            fill_prior(data, storage_size());
+        }
+        delete_map_data();
+    }
+
+    static void fill_prior(CellT* cell, int size)
+    {
+        CellT prior;
+        prior.reset_value();
+        std::fill_n(cell, size, prior);
+    }
+
+    // Length of the contiguous run of _map_data starting at logical column idx_x of any row,
+    // limited to x_end. Rows wrap at most once in rolling mode, the tiled layout breaks them
+    // at every tile edge.
+    int row_run(int idx_x, int x_end) const
+    {
+        int st_x = idx_x + _wrap_x;
+        if (st_x >= _width) st_x -= _width;
+        int run = std::min(x_end - idx_x, _width - st_x);
+        if (_layout == GridLayout::TILED) {
+            run = std::min(run, LAYOUT_TILE - st_x % LAYOUT_TILE);
+        }
+        return run;
+    }
+
+    // Resets the cells of logical region [x_begin, x_end) x [y_begin, y_end).
+    void reset_region(int x_begin, int y_begin, int x_end, int y_end)
+    {
+        _dirty.mark_region(x_begin, y_begin, x_end, y_end);
+        for_each_run(GridRegion{x_begin, y_begin, x_end, y_end}, [](CellT* cell, int, int, int run) {
+            fill_prior(cell, run);
+        });
+    }
+
+    // CellT::update(mea_log_odds) on logical region [x_begin, x_end) x [y_begin, y_end).
+    // With a mask only the cells whose bit is set are updated.
+    void update_region(int x_begin, int y_begin, int x_end, int y_end, value_type mea_log_odds,
+        const GridBitmask* mask = nullptr)
+    {
+        _dirty.mark_region(x_begin, y_begin, x_end, y_end);
+        for_each_run(GridRegion{x_begin, y_begin, x_end, y_end}, [&](CellT* cell, int x, int y, int run) {
+            const uint64_t* mask_row = mask != nullptr ? mask->row(y) : nullptr;
+            GridKernel::saturating_add(&cell->_log_odds_val, run, mea_log_odds, mask_row, x);
+        });
+    }
+
+    // Same as update_region without a mask, for several threads updating the map at once.
+    // Cells are updated with BasicGridCell::update_atomic, so overlapping regions are fine, but the
+    // map must not be shifted, reset or written with the plain functions at the same time.
+    // The region is marked after the writes, so a concurrent checkpoint never misses them.
+    void update_region_atomic(int x_begin, int y_begin, int x_end, int y_end, value_type mea_log_odds)
+    {
+        for_each_run(GridRegion{x_begin, y_begin, x_end, y_end}, [&](CellT* cell, int, int, int run) {
+            for (int i = 0; i < run; i++) {
+                cell[i].update_atomic(mea_log_odds);
             }
+        });
+        _dirty.mark_region_atomic(x_begin, y_begin, x_end, y_end);
+    }
+
+    // Classifies the whole map into is_occupied() and is_free() bit masks.
+    void classify(GridBitmask& occupied, GridBitmask& free) const
+    {
+        GRID_METRICS_TIMER(GridPhase::EXTRACT);
+        if (occupied.width() != _width || occupied.height() != _height) {
+            occupied.resize(_width, _height);
+        } else {
+            occupied.clear();
+        }
+        if (free.width() != _width || free.height() != _height) {
+            free.resize(_width, _height);
+        } else {
+            free.clear();
         }
+
+        const value_type occupied_thre = CellT::log_odds_occupied_thre();
+        const value_type free_thre = CellT::log_odds_free_thre();
+        for_each_run(GridRegion{0, 0, _width, _height}, [&](const CellT* cell, int x, int y, int run) {
+            GridKernel::classify(&cell->_log_odds_val, run, occupied_thre, free_thre,
+                occupied.row(y), free.row(y), x);
+        });
     }
 
     bool is_in_border(const int idx_x, const int idx_y) const
@@ -214,8 +631,34 @@ public:
         return idx_to_xy(idx_x, idx_y, pos.x(), pos.y());
     }
 
+    // Converts the points (x [m], y [m]) of the columns of points, given in the frame of frame_pose
+    // (x [m], y [m], yaw [rad]) in the map frame, to cell indices with the vectorized
+    // GridKernel::points_to_cells. Pass a zero pose for points already in the map frame.
+    // in_border[i] is 1 for points inside the map, the indices of the others are clamped to the border
+    // as by xy_to_idx. Unlike xy_to_idx the indices are floored, so points just outside the left or
+    // bottom edge are no longer folded into cell 0. Returns the number of points inside the map.
+    int points_to_indices(const Eigen::Matrix2Xd & points, const Eigen::Vector3d & frame_pose,
+        Eigen::Matrix2Xi & indices, std::vector<uint8_t> & in_border) const
+    {
+        const int n = static_cast<int>(points.cols());
+        indices.resize(2, n);
+        in_border.resize(n);
+        return GridKernel::points_to_cells(points.data(), n,
+            std::cos(frame_pose.z()) * _inv_resolution, std::sin(frame_pose.z()) * _inv_resolution,
+            (frame_pose.x() - _origin.x()) * _inv_resolution, (frame_pose.y() - _origin.y()) * _inv_resolution,
+            _width, _height, indices.data(), in_border.data());
+    }
+
+    // Cell center positions [m] in the map frame of the columns of indices, see idx_to_xy.
+    void indices_to_points(const Eigen::Matrix2Xi & indices, Eigen::Matrix2Xd & points) const
+    {
+        const Eigen::Vector2d first_center = _origin + Eigen::Vector2d::Constant(0.5 * _resolution);
+        points = ((indices.cast<double>() * static_cast<double>(_resolution)).colwise() + first_center);
+    }
+
     uint8_t is_in_ext_zone(const Eigen::Vector3d & pos)
     {
+        GRID_METRICS_ADD(ext_zone_checks, 1);
         uint8_t ext_zone_type = ExtZoneType::NONE;
         int idx_x = 0;
         int idx_y = 0;
@@ -233,74 +676,233 @@ public:
                 ext_zone_type |= ExtZoneType::TOP;
             }
         }
+        GRID_METRICS_ADD(ext_zone_triggers, ext_zone_type != ExtZoneType::NONE);
         return ext_zone_type;
     }
 
     void extend_map(uint8_t ext_zone_type)
+    {
+        extension_shifts(ext_zone_type, [this](int dx, int dy) { shift_map(dx, dy); });
+    }
+
+    // Calls shift(dx, dy) for each window move of extend_map(ext_zone_type), for the maps that keep
+    // their own storage next to or instead of a BasicGridMap.
+    template <typename ShiftFn>
+    static void extension_shifts(uint8_t ext_zone_type, ShiftFn shift)
     {
         if (!ext_zone_type)
             return;
 
-        if (ext_zone_type & ExtZoneType::LEFT) {
-            _origin.x() -= EXT_ZONE * _resolution;
-            for (int y = 0; y < _height; y++) {
-                for (int x = _width - 1; x >= 0; x--) {
-                    if (x < EXT_ZONE) {
-                        _map_data[y * _width + x].reset_value();
-                        continue;
-                    }
-                    _map_data[y * _width + x]._log_odds_val
-                    = _map_data[y * _width + (x - EXT_ZONE)]._log_odds_val;
-                }
+        // Opposite directions behave like the legacy passes applied one after the other: the second
+        // pass moves the cells back, so only the strip of RIGHT or TOP ends up cleared. The first one
+        // of a pair is shifted on its own.
+        if ((ext_zone_type & ExtZoneType::LEFT) && (ext_zone_type & ExtZoneType::RIGHT)) {
+            shift(-EXT_ZONE, 0);
+        }
+        if ((ext_zone_type & ExtZoneType::DOWN) && (ext_zone_type & ExtZoneType::TOP)) {
+            shift(0, -EXT_ZONE);
+        }
+        int dx = (ext_zone_type & ExtZoneType::RIGHT) ? EXT_ZONE : (ext_zone_type & ExtZoneType::LEFT) ? -EXT_ZONE : 0;
+        int dy = (ext_zone_type & ExtZoneType::TOP) ? EXT_ZONE : (ext_zone_type & ExtZoneType::DOWN) ? -EXT_ZONE : 0;
+        shift(dx, dy);
+    }
+
+    // Moves the window by the whole cell offset that brings pos closest to the map center, instead of
+    // the fixed EXT_ZONE steps of extend_map. Nothing moves while both offsets are within dead_band
+    // cells, 0 recenters on every cell crossed. Overlapping cells are kept, on a rolling map the cost
+    // is proportional to the exposed area. Returns whether the window moved.
+    bool recenter_to(const Eigen::Vector3d & pos, int dead_band = 0)
+    {
+        int dx = 0;
+        int dy = 0;
+        if (!recenter_offset(pos, dead_band, dx, dy))
+            return false;
+
+        shift_map(dx, dy);
+        return true;
+    }
+
+    // The shift recenter_to(pos, dead_band) makes, false when the window stays.
+    bool recenter_offset(const Eigen::Vector3d & pos, int dead_band, int &dx, int &dy) const
+    {
+        dx = static_cast<int>(std::lround((pos.x() - _origin.x()) / _resolution - 0.5 * _width));
+        dy = static_cast<int>(std::lround((pos.y() - _origin.y()) / _resolution - 0.5 * _height));
+        return std::abs(dx) > dead_band || std::abs(dy) > dead_band;
+    }
+
+    // Moves the window by (dx, dy) cells of any size in one pass, the cell formerly at (x + dx, y + dy)
+    // is now at (x, y) and the cells coming into view are reset. The origin moves along.
+    // Row-major maps move each row with one memmove, rolling maps only move the wrap offset.
+    void shift_map(int dx, int dy)
+    {
+        if (dx == 0 && dy == 0)
+            return;
+
+        GRID_METRICS_TIMER(GridPhase::SHIFT);
+        GRID_METRICS_ADD(shifts, 1);
+        _origin.x() += dx * _resolution;
+        _origin.y() += dy * _resolution;
+        _dirty.shift(dx, dy);
+        if (std::abs(dx) >= _width || std::abs(dy) >= _height) {
+            reset_map_data();
+            return;
+        }
+
+        if (_rolling) {
+            _wrap_x = (_wrap_x + dx % _width + _width) % _width;
+            _wrap_y = (_wrap_y + dy % _height + _height) % _height;
+        }
+        move_storage(_map_data, dx, dy, [](CellT* cell, int size) { fill_prior(cell, size); });
+    }
+
+    // Applies the cell moves of the last shift_map(dx, dy) to a plane of storage_size() values kept in
+    // the storage order of the map, the values coming into view become fill. Call it right after
+    // shift_map with the same offsets, so attributes stored beside the map follow the window.
+    template <typename T>
+    void shift_plane(T* plane, int dx, int dy, T fill) const
+    {
+        if (dx == 0 && dy == 0)
+            return;
+
+        auto fill_run = [fill](T* first, int size) { std::fill_n(first, size, fill); };
+        if (std::abs(dx) >= _width || std::abs(dy) >= _height) {
+            fill_run(plane, storage_size());
+            return;
+        }
+        move_storage(plane, dx, dy, fill_run);
+    }
+
+    // Row-major shift of a width x height array, the value formerly at (x + dx, y + dy) is now at
+    // (x, y) and fill(first, size) resets the runs coming into view. Each destination row is written
+    // once from its source row, rows are visited away from the source side, so a source row is always
+    // read before it is overwritten. |dx| and |dy| must be below the size.
+    template <typename T, typename FillFn>
+    static void shift_rows(T* data, int width, int height, int dx, int dy, FillFn fill)
+    {
+        const int run = width - std::abs(dx);
+        const int dst_x = std::max(0, -dx);
+        const int src_x = std::max(0, dx);
+        const int clear_x = dx > 0 ? run : 0;
+        const int y_step = dy > 0 ? 1 : -1;
+        const int y_first = dy > 0 ? 0 : height - 1;
+        for (int y = y_first; y >= 0 && y < height; y += y_step) {
+            T* row = data + static_cast<size_t>(y) * width;
+            if (y + dy < 0 || y + dy >= height) {
+                fill(row, width);
+                continue;
             }
+            std::memmove(row + dst_x, data + static_cast<size_t>(y + dy) * width + src_x, sizeof(T) * run);
+            fill(row + clear_x, width - run);
+        }
+    }
+
+    // Reuses the existing buffer, so a relocalization reset does not touch the heap.
+    // Returns false when a map without storage cannot allocate it.
+    bool reset_map(const Eigen::Vector3d & pos)
+    {
+        _wrap_x = 0;
+        _wrap_y = 0;
+        set_origin(pos);
+        if (_map_data == nullptr && !allocate_map_data()) {
+            return false;
         }
-        if (ext_zone_type & ExtZoneType::RIGHT) {
-            _origin.x() += EXT_ZONE * _resolution;
-            for (int y = 0; y < _height; y++) {
-                for (int x = 0; x < _width; x++) {
-                    if (x >= _width - EXT_ZONE) {
-                        _map_data[y * _width + x].reset_value();
-                        continue;
+        reset_map_data();
+        _dirty.mark_all();
+        return true;
+    }
+
+private:
+    // Moves a buffer in the storage order of the map like a shift_map(dx, dy) whose wrap offsets are
+    // already updated, fill(first, size) resets the runs coming into view. On a rolling map only the
+    // exposed strips change, the tiled layout goes through the layout-independent cell access.
+    template <typename T, typename FillFn>
+    void move_storage(T* data, int dx, int dy, FillFn fill) const
+    {
+        if (_rolling) {
+            const CellT* base = _map_data;
+            auto clear = [&](int x_begin, int y_begin, int x_end, int y_end) {
+                for_each_run(GridRegion{x_begin, y_begin, x_end, y_end}, [&](const CellT* cell, int, int, int run) {
+                    fill(data + (cell - base), run);
+                });
+            };
+            if (dx > 0) clear(_width - dx, 0, _width, _height);
+            if (dx < 0) clear(0, 0, -dx, _height);
+            if (dy > 0) clear(0, _height - dy, _width, _height);
+            if (dy < 0) clear(0, 0, _width, -dy);
+        } else if (_layout == GridLayout::ROW_MAJOR) {
+            shift_rows(data, _width, _height, dx, dy, fill);
+        } else {
+            int x_step = dx > 0 ? 1 : -1;
+            int y_step = dy > 0 ? 1 : -1;
+            int x_first = dx > 0 ? 0 : _width - 1;
+            int y_first = dy > 0 ? 0 : _height - 1;
+            for (int y = y_first; y >= 0 && y < _height; y += y_step) {
+                for (int x = x_first; x >= 0 && x < _width; x += x_step) {
+                    T* cell = data + index_map(x, y);
+                    if (is_in_border(x + dx, y + dy)) {
+                        *cell = data[index_map(x + dx, y + dy)];
+                    } else {
+                        fill(cell, 1);
                     }
-                    _map_data[y * _width + x]._log_odds_val
-                    = _map_data[y * _width + (x + EXT_ZONE)]._log_odds_val;
                 }
             }
         }
-        if (ext_zone_type & ExtZoneType::DOWN) {
-            _origin.y() -= EXT_ZONE * _resolution;
-            for (int y = _height - 1; y >= 0; y--) {
-                for (int x = 0; x < _width; x++) {
-                    if (y < EXT_ZONE) {
-                        _map_data[y * _width + x].reset_value();
-                        continue;
-                    }
-                    _map_data[y * _width + x]._log_odds_val
-                    = _map_data[(y - EXT_ZONE) * _width + x]._log_odds_val;
-                }
+    }
+
+    // Copies the cells into a new buffer of the given layout without wrap offset.
+    // On an allocation failure the map is kept as is and false is returned.
+    bool relayout(GridLayout layout)
+    {
+        if (_buffer != nullptr) {
+            GridLayout old_layout = _layout;
+            _layout = layout;
+            bool fits = static_cast<size_t>(storage_size()) <= _buffer_cells;
+            _layout = old_layout;
+            if (!fits) {
+                std::cout << "External buffer too small in grid mapping.";
+                return false;
             }
         }
-        if (ext_zone_type & ExtZoneType::TOP) {
-            _origin.y() += EXT_ZONE * _resolution;
-            for (int y = 0; y < _height; y++) {
-                for (int x = 0; x < _width; x++) {
-                    if (y >= _height - EXT_ZONE) {
-                        _map_data[y * _width + x].reset_value();
-                        continue;
-                    }
-                    _map_data[y * _width + x]._log_odds_val
-                    = _map_data[(y + EXT_ZONE) * _width + x]._log_odds_val;
-                }
+
+        BasicGridMap copy(*this);
+        if (copy._map_data == nullptr) return false;
+        _layout = layout;
+        _wrap_x = 0;
+        _wrap_y = 0;
+        delete_map_data();
+        if (!allocate_map_data()) {
+            // Only the allocator can fail here, take the storage of the copy back.
+            swap(copy);
+            return false;
+        }
+        reset_map_data();
+        for (int y = 0; y < _height; y++) {
+            for (int x = 0; x < _width; x++) {
+                (*this)(x, y) = copy(x, y);
             }
         }
+        return true;
     }
 
-    void reset_map(const Eigen::Vector3d & pos)
+    // Leaves an empty map after an allocation failure, so that no access reaches missing cells.
+    void clear_geometry()
     {
-        set_origin(pos);
         delete_map_data();
-        allocate_map_data();
-        reset_map_data();
+        _width = 0;
+        _height = 0;
+        _tiles_x = 0;
+        _wrap_x = 0;
+        _wrap_y = 0;
+        _dirty.resize(0, 0);
     }
 };
 
+template <typename CellT>
+void swap(BasicGridMap<CellT>& a, BasicGridMap<CellT>& b) noexcept
+{
+    a.swap(b);
+}
+
+typedef BasicGridMap<GridCell> GridMap;
+typedef BasicGridMap<GridCell16> GridMap16;
+typedef BasicGridMap<GridCell8> GridMap8;
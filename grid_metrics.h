@@ -0,0 +1,222 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Instrumentation of the map update phases, compiled in when GRID_MAP_METRICS is defined.
+// Without it the GRID_METRICS_* macros expand to nothing, so the hot paths carry no trace of them.
+// Every thread counts into its own grid_metrics(), so instrumented calls may run on several threads
+// without synchronization, e.g. the ingest worker next to the application. Poll the counters of a
+// thread on that thread, those of the ingest worker from its batch callback. The worker threads of
+// the parallel layers are not instrumented, only their callers.
+// Reading the clock twice costs more than a footprint echo, so the timers sample one call in
+// timer_period of each phase, while calls counts all of them.
+
+// Default parameter values.
+const uint32_t DEFAULT_METRICS_TIMER_PERIOD = 16;   // Timed calls, one in 16 of each phase.
+
+enum class GridPhase
+{
+    ECHO = 0,       // Single echo integration.
+    FRAME = 1,      // Whole frames of the frame fusion.
+    SHIFT = 2,      // Window shifts of extend_map, recenter_to and shift_map.
+    DECAY = 3,      // BasicGridDecay steps.
+    EXTRACT = 4,    // Classification, component labeling, free space and distance fields.
+    COUNT = 5
+};
+
+// Clock of the scoped timers, the time stamp counter where there is one.
+inline uint64_t grid_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Nanoseconds per grid_ticks() tick, calibrated on the first call, which takes about 10ms.
+inline double grid_ns_per_tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ns_per_tick = [] {
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t ticks = grid_ticks();
+        while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(10)) {}
+        uint64_t elapsed_ticks = grid_ticks() - ticks;
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        return elapsed_ticks > 0 ? elapsed_ns / elapsed_ticks : 1.0;
+    }();
+    return ns_per_tick;
+#else
+    return 1.0;
+#endif
+}
+
+// Power of two histogram, bucket b counts the values in [2^b, 2^(b + 1)), bucket 0 also counts 0.
+struct GridHistogram
+{
+    static const int BUCKETS = 64;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[BUCKETS];
+
+    GridHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        count = 0;
+        sum = 0;
+        min = UINT64_MAX;
+        max = 0;
+        std::memset(buckets, 0, sizeof(buckets));
+    }
+
+    void record(uint64_t value)
+    {
+        count++;
+        sum += value;
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        buckets[63 - __builtin_clzll(value | 1)]++;
+    }
+
+    double mean() const
+    {
+        return count > 0 ? static_cast<double>(sum) / count : 0.0;
+    }
+
+    // Upper bound of the bucket holding the fraction q of the values, e.g. 0.99.
+    uint64_t quantile(double q) const
+    {
+        uint64_t rank = static_cast<uint64_t>(q * count);
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen > rank) return b < 63 ? (uint64_t(2) << b) - 1 : UINT64_MAX;
+        }
+        return max;
+    }
+};
+
+struct GridMetrics
+{
+    GridHistogram phases[static_cast<int>(GridPhase::COUNT)];  // Ticks per timed call.
+    uint64_t calls[static_cast<int>(GridPhase::COUNT)];         // Instrumented calls, timed or not.
+    uint64_t timer_mask;                // timer_period - 1, see set_timer_period.
+    GridHistogram frame_cells;          // Cells touched per frame, see end_frame.
+    uint64_t echoes;                    // Echoes integrated.
+    uint64_t cells_touched;             // Cell updates of the integrated echoes.
+    uint64_t shifts;                    // Window shifts.
+    uint64_t ext_zone_checks;           // is_in_ext_zone calls.
+    uint64_t ext_zone_triggers;         // is_in_ext_zone calls that asked for a shift.
+    uint64_t frames;
+    uint64_t frame_start_cells;         // cells_touched at the start of the frame.
+
+    GridMetrics()
+    {
+        set_timer_period(DEFAULT_METRICS_TIMER_PERIOD);
+        reset();
+    }
+
+    // Times one call in period of each phase, rounded down to a power of two, 1 times every call.
+    // reset() keeps the period.
+    void set_timer_period(uint32_t period)
+    {
+        timer_mask = period > 1 ? (uint64_t(1) << (31 - __builtin_clz(period))) - 1 : 0;
+    }
+
+    uint32_t timer_period() const { return static_cast<uint32_t>(timer_mask + 1); }
+
+    void reset()
+    {
+        for (GridHistogram& phase : phases) {
+            phase.reset();
+        }
+        std::memset(calls, 0, sizeof(calls));
+        frame_cells.reset();
+        echoes = 0;
+        cells_touched = 0;
+        shifts = 0;
+        ext_zone_checks = 0;
+        ext_zone_triggers = 0;
+        frames = 0;
+        frame_start_cells = 0;
+    }
+
+    const GridHistogram& phase(GridPhase phase) const
+    {
+        return phases[static_cast<int>(phase)];
+    }
+
+    // Mean duration [ns] of the timed calls of a phase.
+    double mean_ns(GridPhase phase) const
+    {
+        return this->phase(phase).mean() * grid_ns_per_tick();
+    }
+
+    // Closes a frame of the application, records the cells touched since the previous call.
+    void end_frame()
+    {
+        frame_cells.record(cells_touched - frame_start_cells);
+        frame_start_cells = cells_touched;
+        frames++;
+    }
+};
+
+inline GridMetrics& grid_metrics()
+{
+    static thread_local GridMetrics metrics;
+    return metrics;
+}
+
+// Counts a call of a phase and adds the duration of its scope to the phase histogram when the
+// call is sampled, see GridMetrics::set_timer_period.
+class GridScopedTimer
+{
+public:
+    explicit GridScopedTimer(GridPhase phase)
+    {
+        GridMetrics& metrics = grid_metrics();
+        const int p = static_cast<int>(phase);
+        _histogram = (metrics.calls[p]++ & metrics.timer_mask) == 0 ? &metrics.phases[p] : nullptr;
+        _start = _histogram != nullptr ? grid_ticks() : 0;
+    }
+
+    ~GridScopedTimer()
+    {
+        if (_histogram != nullptr) {
+            _histogram->record(grid_ticks() - _start);
+        }
+    }
+
+    GridScopedTimer(const GridScopedTimer&) = delete;
+    GridScopedTimer& operator=(const GridScopedTimer&) = delete;
+
+private:
+    GridHistogram* _histogram;
+    uint64_t _start;
+};
+
+#if defined(GRID_MAP_METRICS)
+#define GRID_METRICS_TIMER(phase) GridScopedTimer grid_metrics_timer(phase)
+#define GRID_METRICS_ADD(counter, n) (grid_metrics().counter += (n))
+#define GRID_METRICS_RUN(statement) statement
+#else
+#define GRID_METRICS_TIMER(phase) ((void)0)
+#define GRID_METRICS_ADD(counter, n) ((void)0)
+#define GRID_METRICS_RUN(statement) ((void)0)
+#endif
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_sensor_model.h"
+#include "grid_shm.h"
+
+// Default parameter values.
+const float OCCUPANCY_UNKNOWN_BAND = 0.0f;     // Cells within this log odds distance of the prior export as -1.
+
+// Geometry of an export, the fields of nav_msgs/MapMetaData less the time stamp.
+struct GridOccupancyInfo
+{
+    float resolution;           // [m/cell].
+    int32_t width;              // [cells].
+    int32_t height;             // [cells].
+    double origin_x;            // Left-down corner of cell (0, 0) [m], the map frame yaw is 0.
+    double origin_y;
+};
+
+// What an export buffer holds, so export_changed can refresh it in place.
+struct GridOccupancyStamp
+{
+    uint32_t valid;             // 0 until the first export into the buffer.
+    uint32_t epoch;             // Dirty epoch closed by the export.
+    int32_t width;              // [cells].
+    int32_t height;             // [cells].
+    int64_t shift_x;            // GridDirtyTracker::shift_x at the export.
+    int64_t shift_y;
+};
+
+// Frame header of an occupancy ring slot, the payload is the int8 data.
+struct GridOccupancyFrame
+{
+    GridOccupancyInfo info;
+    GridOccupancyStamp stamp;
+};
+
+typedef GridShmRing<GridOccupancyFrame> GridOccupancyRing;
+
+// Writes maps as nav_msgs/OccupancyGrid data straight into a caller buffer or an occupancy ring
+// slot: int8, -1 for unknown and the occupancy probability in percent otherwise, row-major from
+// cell (0, 0) whatever the layout of the map. The values come from BasicGridProbabilityLut, so they
+// match its prob() for every cell type. export_changed only rewrites the tiles changed since the
+// buffer was written and replays window shifts by moving its rows.
+template <typename CellT = GridCell>
+class BasicGridOccupancyExporter
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    explicit BasicGridOccupancyExporter(float unknown_band = OCCUPANCY_UNKNOWN_BAND)
+    {
+        _unknown_band = unknown_band;
+    }
+
+    float unknown_band() const { return _unknown_band; }
+
+    static GridOccupancyInfo info(const BasicGridMap<CellT>& map)
+    {
+        GridOccupancyInfo info;
+        info.resolution = map.resolution();
+        info.width = map.width();
+        info.height = map.height();
+        info.origin_x = map.origin().x();
+        info.origin_y = map.origin().y();
+        return info;
+    }
+
+    // Writes all cells to out[0, width * height), stamp, if given, records what out now holds.
+    bool export_map(const BasicGridMap<CellT>& map, int8_t* out, size_t size, GridOccupancyStamp* stamp = nullptr) const
+    {
+        if (!check_size(map, size))
+            return false;
+
+        const uint32_t epoch = map.dirty().checkpoint();
+        export_region(map, GridRegion{0, 0, map.width(), map.height()}, out);
+        if (stamp != nullptr) {
+            set_stamp(map, epoch, *stamp);
+        }
+        return true;
+    }
+
+    // Brings out, holding the export described by stamp, up to date with map. Only the tiles
+    // changed since are converted, rows are moved by the window shift since. Falls back to
+    // export_map when stamp does not match the map.
+    bool export_changed(const BasicGridMap<CellT>& map, int8_t* out, size_t size, GridOccupancyStamp& stamp) const
+    {
+        if (!check_size(map, size))
+            return false;
+
+        const int w = map.width();
+        const int h = map.height();
+        const long long dx = map.dirty().shift_x() - stamp.shift_x;
+        const long long dy = map.dirty().shift_y() - stamp.shift_y;
+        if (!stamp.valid || stamp.width != w || stamp.height != h || std::llabs(dx) >= w || std::llabs(dy) >= h) {
+            return export_map(map, out, size, &stamp);
+        }
+
+        const uint32_t epoch = map.dirty().checkpoint();
+        if (dx != 0 || dy != 0) {
+            // The cells coming into view are marked dirty, whatever is left in them is rewritten.
+            BasicGridMap<CellT>::shift_rows(out, w, h, static_cast<int>(dx), static_cast<int>(dy), [](int8_t*, int) {});
+        }
+        map.dirty().for_each_changed(stamp.epoch, [&](const GridRegion& region) {
+            export_region(map, region, out);
+        });
+        set_stamp(map, epoch, stamp);
+        return true;
+    }
+
+    // Exports map as the next frame of ring, dirty_only refreshes the slot of the frame published
+    // ring.slots() frames ago in place instead of converting every cell.
+    bool publish(const BasicGridMap<CellT>& map, GridOccupancyRing& ring, bool dirty_only = true) const
+    {
+        if (!ring.is_writer()) {
+            std::cout << "Occupancy export error: the ring is not open for writing";
+            return false;
+        }
+        GridOccupancyFrame* frame;
+        uint8_t* data;
+        ring.begin_frame(frame, data);
+        int8_t* out = reinterpret_cast<int8_t*>(data);
+        frame->info = info(map);
+        bool ok = dirty_only ? export_changed(map, out, ring.capacity(), frame->stamp)
+            : export_map(map, out, ring.capacity(), &frame->stamp);
+        if (!ok) {
+            frame->stamp.valid = 0;
+        }
+        ring.publish();
+        return ok;
+    }
+
+private:
+    float _unknown_band;
+    BasicGridProbabilityLut<CellT> _lut;
+
+    void export_region(const BasicGridMap<CellT>& map, const GridRegion& region, int8_t* out) const
+    {
+        const int w = map.width();
+        map.for_each_run(region, [&](const CellT* cell, int x, int y, int run) {
+            _lut.occupancy(&cell->_log_odds_val, run, _unknown_band, out + static_cast<size_t>(y) * w + x);
+        });
+    }
+
+    bool check_size(const BasicGridMap<CellT>& map, size_t size) const
+    {
+        if (size < static_cast<size_t>(map.width()) * map.height()) {
+            std::cout << "Occupancy export error: " << size << " bytes for " << map.width() << " x "
+                << map.height() << " cells";
+            return false;
+        }
+        return true;
+    }
+
+    static void set_stamp(const BasicGridMap<CellT>& map, uint32_t epoch, GridOccupancyStamp& stamp)
+    {
+        stamp.valid = 1;
+        stamp.epoch = epoch;
+        stamp.width = map.width();
+        stamp.height = map.height();
+        stamp.shift_x = map.dirty().shift_x();
+        stamp.shift_y = map.dirty().shift_y();
+    }
+};
+
+typedef BasicGridOccupancyExporter<GridCell> GridOccupancyExporter;
+typedef BasicGridOccupancyExporter<GridCell16> GridOccupancyExporter16;
+typedef BasicGridOccupancyExporter<GridCell8> GridOccupancyExporter8;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker count for threads = 0, the hardware concurrency or 1 if it is unknown.
+inline int grid_default_threads()
+{
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Persistent workers for the parallel loops of the per-frame paths, started once by their owner
+// instead of on every loop. The calling thread is one of the threads() workers, so a pool of one
+// thread runs every loop inline. One loop at a time, from one calling thread.
+class GridThreadPool
+{
+public:
+    // threads = 0 uses the hardware concurrency.
+    explicit GridThreadPool(int threads = 0)
+    {
+        _threads = 1;
+        _generation = 0;
+        _busy = 0;
+        _stop = false;
+        _call = nullptr;
+        _context = nullptr;
+        _n = 0;
+        _next.store(0);
+        start(threads);
+    }
+
+    ~GridThreadPool()
+    {
+        stop();
+    }
+
+    GridThreadPool(const GridThreadPool&) = delete;
+    GridThreadPool& operator=(const GridThreadPool&) = delete;
+
+    // Restarts the pool with another worker count.
+    void set_threads(int threads)
+    {
+        stop();
+        start(threads);
+    }
+
+    int threads() const { return _threads; }
+
+    // Calls fn(i) for i in [0, n) on the workers and returns when all calls are done.
+    // Work items are taken dynamically, so fn must not depend on which worker runs it.
+    template <typename Fn>
+    void parallel_for(int n, Fn fn)
+    {
+        if (n <= 0) return;
+        if (_workers.empty() || n == 1) {
+            for (int i = 0; i < n; i++) fn(i);
+            return;
+        }
+
+        _call = [](void* context, int i) { (*static_cast<Fn*>(context))(i); };
+        _context = &fn;
+        _n = n;
+        _next.store(0, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busy = static_cast<int>(_workers.size());
+            _generation++;
+        }
+        _wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _busy == 0; });
+    }
+
+private:
+    int _threads;
+    std::vector<std::thread> _workers;      // threads() - 1 helpers of the calling thread.
+    std::mutex _mutex;
+    std::condition_variable _wake;          // A loop started or the pool stops.
+    std::condition_variable _done;          // The last helper left the loop.
+    uint64_t _generation;                   // Loops started, guarded by _mutex.
+    int _busy;                              // Helpers still in the loop, guarded by _mutex.
+    bool _stop;
+    void (*_call)(void*, int);              // The loop body, published to the helpers by _mutex.
+    void* _context;
+    int _n;
+    std::atomic<int> _next;                 // Next work item of the loop.
+
+    void start(int threads)
+    {
+        _threads = threads > 0 ? threads : grid_default_threads();
+        _stop = false;
+        // Helpers start from the current generation, so a loop started before they wait is not missed.
+        const uint64_t generation = _generation;
+        for (int t = 1; t < _threads; t++) {
+            _workers.emplace_back([this, generation] { run(generation); });
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (std::thread& worker : _workers) {
+            worker.join();
+        }
+        _workers.clear();
+    }
+
+    void work()
+    {
+        for (int i = _next.fetch_add(1, std::memory_order_relaxed); i < _n; i = _next.fetch_add(1, std::memory_order_relaxed)) {
+            _call(_context, i);
+        }
+    }
+
+    void run(uint64_t seen)
+    {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _stop || _generation != seen; });
+                if (_stop) return;
+                seen = _generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_busy == 0) _done.notify_one();
+        }
+    }
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+
+// Default parameter values.
+const int PYRAMID_FACTOR = 4;           // Cells per level cell edge, 0.1m -> 0.4m -> 1.6m.
+const int DEFAULT_PYRAMID_LEVELS = 2;
+
+// Coarse max log odds levels over a GridMap for early-out region queries.
+// Level l cell (bx, by) holds the maximum raw log odds of the PYRAMID_FACTOR^(l+1) square of map cells
+// it covers, see block_region, so a query skips every coarse cell whose maximum is not occupied and
+// accepts every coarse cell inside the query whose maximum is. update() follows the dirty regions of
+// the map and only recomputes the coarse cells above them. The level cells are aligned to the world
+// cell grid rather than to the window, so a window shift moves them by whole level cells like
+// GridDirtyTracker::shift and only the level cells on the window edges are recomputed.
+template <typename CellT = GridCell>
+class BasicGridPyramid
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    BasicGridPyramid(int levels = DEFAULT_PYRAMID_LEVELS)
+    {
+        _levels.resize(std::max(1, levels));
+        _map_width = 0;
+        _map_height = 0;
+        _last_epoch = 0;
+        _last_shift_x = 0;
+        _last_shift_y = 0;
+    }
+
+    int levels() const { return static_cast<int>(_levels.size()); }
+    int width(int level) const { return _levels[level].width; }
+    int height(int level) const { return _levels[level].height; }
+
+    // Edge of a level cell [map cells].
+    int block(int level) const { return _levels[level].block; }
+
+    value_type max_log_odds(int level, int bx, int by) const
+    {
+        const Level& lv = _levels[level];
+        return lv.data[by * lv.width + bx];
+    }
+
+    // Logical map cells covered by level cell (bx, by), clipped to the map.
+    GridRegion block_region(int level, int bx, int by) const
+    {
+        const Level& lv = _levels[level];
+        GridRegion cells;
+        cells.x_begin = std::max(0, bx * lv.block - lv.offset_x);
+        cells.y_begin = std::max(0, by * lv.block - lv.offset_y);
+        cells.x_end = std::min(_map_width, (bx + 1) * lv.block - lv.offset_x);
+        cells.y_end = std::min(_map_height, (by + 1) * lv.block - lv.offset_y);
+        return cells;
+    }
+
+    // Brings the levels up to date with map, call it after the map changed and before queries.
+    void update(const BasicGridMap<CellT>& map)
+    {
+        const GridDirtyTracker& dirty = map.dirty();
+        const long long dx = dirty.shift_x() - _last_shift_x;
+        const long long dy = dirty.shift_y() - _last_shift_y;
+        bool rebuild = map.width() != _map_width || map.height() != _map_height
+            || std::llabs(dx) >= _map_width || std::llabs(dy) >= _map_height;
+        uint32_t now = dirty.checkpoint();
+        if (rebuild) {
+            resize(map.width(), map.height(), dirty.shift_x(), dirty.shift_y());
+            update_region(map, GridRegion{0, 0, _map_width, _map_height});
+        } else {
+            if (dx != 0 || dy != 0) {
+                shift(map, dirty.shift_x(), dirty.shift_y());
+            }
+            dirty.for_each_changed(_last_epoch, [&](const GridRegion& region) { update_region(map, region); });
+        }
+        _last_epoch = now;
+        _last_shift_x = dirty.shift_x();
+        _last_shift_y = dirty.shift_y();
+    }
+
+    // Whether any map cell of the logical region is_occupied(), the region is clipped to the map.
+    bool any_occupied(const BasicGridMap<CellT>& map, GridRegion region) const
+    {
+        region.x_begin = std::max(region.x_begin, 0);
+        region.y_begin = std::max(region.y_begin, 0);
+        region.x_end = std::min(region.x_end, _map_width);
+        region.y_end = std::min(region.y_end, _map_height);
+        if (region.x_begin >= region.x_end || region.y_begin >= region.y_end) return false;
+        return any_occupied(map, levels() - 1, region,
+            GridRegion{0, 0, _levels.back().width, _levels.back().height});
+    }
+
+    // Same as above for the box [min, max] in the map frame [m].
+    bool any_occupied(const BasicGridMap<CellT>& map, const Eigen::Vector2d & min, const Eigen::Vector2d & max) const
+    {
+        const double inv_res = 1.0 / map.resolution();
+        GridRegion region;
+        region.x_begin = static_cast<int>(std::floor((min.x() - map.origin().x()) * inv_res));
+        region.y_begin = static_cast<int>(std::floor((min.y() - map.origin().y()) * inv_res));
+        region.x_end = static_cast<int>(std::floor((max.x() - map.origin().x()) * inv_res)) + 1;
+        region.y_end = static_cast<int>(std::floor((max.y() - map.origin().y()) * inv_res)) + 1;
+        return any_occupied(map, region);
+    }
+
+private:
+    struct Level
+    {
+        int block;                      // Edge [map cells].
+        int width;                      // Level cells, enough for any offset.
+        int height;
+        int offset_x;                   // Logical cell x covered by level cell column 0 starts at -offset_x.
+        int offset_y;
+        std::vector<value_type> data;   // Row-major maxima.
+    };
+
+    std::vector<Level> _levels;
+    int _map_width;
+    int _map_height;
+    uint32_t _last_epoch;               // Dirty epoch covered by the levels.
+    long long _last_shift_x;            // Window shift covered by the levels.
+    long long _last_shift_y;
+    std::vector<value_type> _shifted;   // Level being shifted, kept for reuse.
+
+    // Non-negative remainder of the window shift, the offset of a level of that block.
+    static int offset_of(long long shift, int block)
+    {
+        return static_cast<int>((shift % block + block) % block);
+    }
+
+    void resize(int width, int height, long long shift_x, long long shift_y)
+    {
+        _map_width = width;
+        _map_height = height;
+        int block = 1;
+        for (Level& lv : _levels) {
+            block *= PYRAMID_FACTOR;
+            lv.block = block;
+            lv.width = (width + block - 1) / block + 1;
+            lv.height = (height + block - 1) / block + 1;
+            lv.offset_x = offset_of(shift_x, block);
+            lv.offset_y = offset_of(shift_y, block);
+            lv.data.assign(static_cast<size_t>(lv.width) * lv.height, std::numeric_limits<value_type>::lowest());
+        }
+    }
+
+    // Moves the level cells to the window shift (shift_x, shift_y). A level cell keeps the world
+    // cells it covers, so only the ones on the window edges, which lost or gained cells, are
+    // recomputed. The dirty regions of the cells coming into view follow in update.
+    void shift(const BasicGridMap<CellT>& map, long long shift_x, long long shift_y)
+    {
+        for (int l = 0; l < levels(); l++) {
+            Level& lv = _levels[l];
+            const int offset_x = offset_of(shift_x, lv.block);
+            const int offset_y = offset_of(shift_y, lv.block);
+            // Level cell (bx, by) now holds what (bx + sx, by + sy) held.
+            const long long sx = (shift_x - offset_x - (_last_shift_x - lv.offset_x)) / lv.block;
+            const long long sy = (shift_y - offset_y - (_last_shift_y - lv.offset_y)) / lv.block;
+            _shifted.assign(lv.data.size(), std::numeric_limits<value_type>::lowest());
+            for (int by = 0; by < lv.height; by++) {
+                const long long oy = by + sy;
+                if (oy < 0 || oy >= lv.height) continue;
+                for (int bx = 0; bx < lv.width; bx++) {
+                    const long long ox = bx + sx;
+                    if (ox >= 0 && ox < lv.width) {
+                        _shifted[by * lv.width + bx] = lv.data[oy * lv.width + ox];
+                    }
+                }
+            }
+            lv.data.swap(_shifted);
+            lv.offset_x = offset_x;
+            lv.offset_y = offset_y;
+
+            // The first and the last level cells of each axis are the partial ones, the cells past
+            // them cover nothing. The lower level is already up to date.
+            const int x_last = (_map_width - 1 + offset_x) / lv.block;
+            const int y_last = (_map_height - 1 + offset_y) / lv.block;
+            for (int by = 0; by < lv.height; by++) {
+                const bool edge_row = by == 0 || by >= y_last;
+                for (int bx = 0; bx < lv.width; bx++) {
+                    if (edge_row || bx == 0 || bx >= x_last) {
+                        lv.data[by * lv.width + bx] = block_max(map, l, bx, by);
+                    }
+                }
+            }
+        }
+    }
+
+    // Recomputes the level cells above the map region, level 0 from the map, the others from below.
+    void update_region(const BasicGridMap<CellT>& map, const GridRegion& region)
+    {
+        for (int l = 0; l < levels(); l++) {
+            Level& lv = _levels[l];
+            int bx_begin = (region.x_begin + lv.offset_x) / lv.block;
+            int by_begin = (region.y_begin + lv.offset_y) / lv.block;
+            int bx_end = (region.x_end - 1 + lv.offset_x) / lv.block + 1;
+            int by_end = (region.y_end - 1 + lv.offset_y) / lv.block + 1;
+            for (int by = by_begin; by < by_end; by++) {
+                for (int bx = bx_begin; bx < bx_end; bx++) {
+                    lv.data[by * lv.width + bx] = block_max(map, l, bx, by);
+                }
+            }
+        }
+    }
+
+    value_type block_max(const BasicGridMap<CellT>& map, int l, int bx, int by) const
+    {
+        return l == 0 ? map_max(map, bx, by) : level_max(l - 1, bx, by);
+    }
+
+    value_type map_max(const BasicGridMap<CellT>& map, int bx, int by) const
+    {
+        GridRegion cells = block_region(0, bx, by);
+        value_type result = std::numeric_limits<value_type>::lowest();
+        if (cells.x_begin >= cells.x_end || cells.y_begin >= cells.y_end) return result;
+        map.for_each_run(cells, [&](const CellT* cell, int, int, int run) {
+            for (int i = 0; i < run; i++) {
+                result = std::max(result, cell[i]._log_odds_val);
+            }
+        });
+        return result;
+    }
+
+    // Level cells of level child below level cell (bx, by) of level child + 1, unclipped. The child
+    // grid is offset by whole child cells against the parent grid.
+    GridRegion children(int child, int bx, int by) const
+    {
+        const Level& lv = _levels[child];
+        const Level& parent = _levels[child + 1];
+        const int kx = (parent.offset_x - lv.offset_x) / lv.block;
+        const int ky = (parent.offset_y - lv.offset_y) / lv.block;
+        return GridRegion{bx * PYRAMID_FACTOR - kx, by * PYRAMID_FACTOR - ky,
+            (bx + 1) * PYRAMID_FACTOR - kx, (by + 1) * PYRAMID_FACTOR - ky};
+    }
+
+    // Maximum of the level cells below level cell (bx, by) of level child + 1.
+    value_type level_max(int child, int bx, int by) const
+    {
+        const Level& lv = _levels[child];
+        const GridRegion blocks = children(child, bx, by);
+        value_type result = std::numeric_limits<value_type>::lowest();
+        int x_end = std::min(blocks.x_end, lv.width);
+        int y_end = std::min(blocks.y_end, lv.height);
+        for (int y = std::max(blocks.y_begin, 0); y < y_end; y++) {
+            for (int x = std::max(blocks.x_begin, 0); x < x_end; x++) {
+                result = std::max(result, lv.data[y * lv.width + x]);
+            }
+        }
+        return result;
+    }
+
+    // Searches the level cells [blocks] of level l that overlap the map region.
+    bool any_occupied(const BasicGridMap<CellT>& map, int l, const GridRegion& region, const GridRegion& blocks) const
+    {
+        const Level& lv = _levels[l];
+        const value_type occupied_thre = CellT::log_odds_occupied_thre();
+        int bx_begin = std::max(blocks.x_begin, (region.x_begin + lv.offset_x) / lv.block);
+        int by_begin = std::max(blocks.y_begin, (region.y_begin + lv.offset_y) / lv.block);
+        int bx_end = std::min(blocks.x_end, (region.x_end - 1 + lv.offset_x) / lv.block + 1);
+        int by_end = std::min(blocks.y_end, (region.y_end - 1 + lv.offset_y) / lv.block + 1);
+        for (int by = by_begin; by < by_end; by++) {
+            for (int bx = bx_begin; bx < bx_end; bx++) {
+                if (lv.data[by * lv.width + bx] <= occupied_thre) continue;
+
+                GridRegion cells = block_region(l, bx, by);
+                if (cells.x_begin >= region.x_begin && cells.x_end <= region.x_end
+                    && cells.y_begin >= region.y_begin && cells.y_end <= region.y_end) {
+                    return true;
+                }
+
+                if (l > 0) {
+                    if (any_occupied(map, l - 1, region, children(l - 1, bx, by))) return true;
+                    continue;
+                }
+
+                int x_end = std::min(cells.x_end, region.x_end);
+                int y_end = std::min(cells.y_end, region.y_end);
+                for (int y = std::max(cells.y_begin, region.y_begin); y < y_end; y++) {
+                    for (int x = std::max(cells.x_begin, region.x_begin); x < x_end; x++) {
+                        if (map(x, y).is_occupied()) return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+};
+
+typedef BasicGridPyramid<GridCell> GridPyramid;
@@ -1,19 +1,31 @@
 #pragma once
 
+#include <Eigen/Core>
+#include <algorithm>
 #include <cmath>
+#include <iostream>
+#include <vector>
 
 #include "grid_cell.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_sensor_model.h"
 
 // Default parameter values.
 const float DEFAULT_HIT_FACTOR = 0.9f;      // P(z=1|s=occ)=0.9 and P(z=0|s=occ)=1-P(z=1|s=occ)=0.1
 const float DEFAULT_MISS_FACTOR = 0.05f;    // P(z=1|s=free)=0.05 and P(z=0|s=free)=1-P(z=1|s=free)=0.95
+const float MAX_CONE_FOV = 3.0f;            // The cone is rasterized as a convex sector, so fov must stay below pi [rad].
 
 // Provides functions related to a log odds of occupancy probability respresentation for cells in a occupancy grid map.
-class GridSensor
+// CellT is the cell type of the updated maps, the increments are kept in its fixed-point scale.
+template <typename CellT = GridCell>
+class BasicGridSensor
 {
 public:
+    typedef typename CellT::value_type value_type;
+
     // Constructor, sets parameters like free and occupied log odds ratios.
-    GridSensor(float hit_factor = DEFAULT_HIT_FACTOR, 
+    BasicGridSensor(float hit_factor = DEFAULT_HIT_FACTOR, 
         float miss_factor = DEFAULT_MISS_FACTOR)
     {
         set_update_factor(hit_factor, miss_factor);
@@ -23,23 +35,252 @@ public:
 
     float _log_odds_hit;            // The log odds representation of probability used for updating cells as hit
     float _log_odds_miss;           // The log odds representation of probability used for updating cells as miss
+    value_type _hit_increment;      // _log_odds_hit in the storage scale of CellT
+    value_type _miss_increment;     // _log_odds_miss in the storage scale of CellT
 
     void set_update_factor(float hit_factor, float miss_factor)
     {
         _log_odds_hit = std::log(hit_factor / miss_factor);
         _log_odds_miss = std::log((1 - hit_factor) / (1 - miss_factor));
+        _hit_increment = CellT::to_raw(_log_odds_hit);
+        _miss_increment = CellT::to_raw(_log_odds_miss);
+        if (has_model()) set_model(_model);
+    }
+
+    // Use a range and angle dependent inverse sensor model in integrate_weighted_echo and the beam
+    // footprint cache, the weighted increments of every model bin are precomputed here.
+    void set_model(const GridSensorModel& model)
+    {
+        _model = model;
+        const int size = model.bins() * model.bins();
+        _hit_table.resize(size);
+        _miss_table.resize(size);
+        for (int i = 0; i < size; i++) {
+            _hit_table[i] = CellT::to_raw(_log_odds_hit * model.weight(i));
+            _miss_table[i] = CellT::to_raw(_log_odds_miss * model.weight(i));
+        }
+    }
+
+    bool has_model() const { return !_hit_table.empty(); }
+    const GridSensorModel& model() const { return _model; }
+
+    // Increment of a cell at range [m] whose direction is off the beam axis by an angle of sine
+    // sin_off_axis, the constant increments without a model.
+    value_type increment(bool is_hit, float range, float sin_off_axis) const
+    {
+        if (!has_model()) return is_hit ? _hit_increment : _miss_increment;
+        int bin = _model.bin(range, sin_off_axis);
+        return is_hit ? _hit_table[bin] : _miss_table[bin];
     }
 
     // Update cell as occupied
-    void set_hit(GridCell& cell)
+    void set_hit(CellT& cell) const
     {   
-        cell.update(_log_odds_hit);
+        cell.update(_hit_increment);
     }
 
     // Update cell as free
-    void set_miss(GridCell& cell)
+    void set_miss(CellT& cell) const
+    {
+        cell.update(_miss_increment);
+    }
+
+    // Update map cell (idx_x, idx_y) as occupied and mark it as changed.
+    void set_hit(BasicGridMap<CellT>& map, int idx_x, int idx_y) const
+    {
+        map(idx_x, idx_y).update(_hit_increment);
+        map.mark_dirty(idx_x, idx_y);
+    }
+
+    // Update map cell (idx_x, idx_y) as free and mark it as changed.
+    void set_miss(BasicGridMap<CellT>& map, int idx_x, int idx_y) const
+    {
+        map(idx_x, idx_y).update(_miss_increment);
+        map.mark_dirty(idx_x, idx_y);
+    }
+
+    // Thread-safe versions of set_hit/set_miss, see BasicGridMap::update_region_atomic.
+    void set_hit_atomic(BasicGridMap<CellT>& map, int idx_x, int idx_y) const
+    {
+        map(idx_x, idx_y).update_atomic(_hit_increment);
+        map.dirty().mark_atomic(idx_x, idx_y);
+    }
+
+    void set_miss_atomic(BasicGridMap<CellT>& map, int idx_x, int idx_y) const
+    {
+        map(idx_x, idx_y).update_atomic(_miss_increment);
+        map.dirty().mark_atomic(idx_x, idx_y);
+    }
+
+    // Update all cells covered by one ultrasonic echo.
+    // sensor_pose is (x [m], y [m], yaw [rad]) in the map frame, the arc at range is marked as hit
+    // and the inside of the cone as miss. A range not less than max_range is treated as no echo,
+    // the whole cone up to max_range is then marked as miss. MapT is BasicGridMap<CellT> or any map with
+    // the same update_region, e.g. StaticGridMap.
+    template <typename MapT>
+    void integrate_echo(MapT& map, const Eigen::Vector3d & sensor_pose,
+        float range, float fov, float max_range) const
+    {
+        GRID_METRICS_TIMER(GridPhase::ECHO);
+        GRID_METRICS_ADD(echoes, 1);
+        rasterize_cone(map, sensor_pose, range, fov, max_range,
+            [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                map.update_region(x_begin, idx_y, x_end, idx_y + 1, is_hit ? _hit_increment : _miss_increment);
+                GRID_METRICS_ADD(cells_touched, x_end - x_begin);
+            });
+    }
+
+    // Same as integrate_echo, several producer threads may integrate echoes into one map at once
+    // without a lock. See BasicGridMap::update_region_atomic for what must not run concurrently.
+    void integrate_echo_atomic(BasicGridMap<CellT>& map, const Eigen::Vector3d & sensor_pose,
+        float range, float fov, float max_range) const
+    {
+        rasterize_cone(map, sensor_pose, range, fov, max_range,
+            [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                map.update_region_atomic(x_begin, idx_y, x_end, idx_y + 1, is_hit ? _hit_increment : _miss_increment);
+            });
+    }
+
+    // Same as integrate_echo with the increments of the sensor model, the beam shape is the one of
+    // the model. Each cell costs one sqrt and a table lookup. Without set_model the map is left as
+    // is and false is returned.
+    bool integrate_weighted_echo(BasicGridMap<CellT>& map, const Eigen::Vector3d & sensor_pose, float range) const
+    {
+        if (!has_model()) {
+            std::cout << "Weighted echo without a sensor model in grid mapping.";
+            return false;
+        }
+        GRID_METRICS_TIMER(GridPhase::ECHO);
+        GRID_METRICS_ADD(echoes, 1);
+
+        const double inv_res = 1.0 / map.resolution();
+        const double px = (sensor_pose.x() - map.origin().x()) * inv_res;
+        const double py = (sensor_pose.y() - map.origin().y()) * inv_res;
+        const double ax = std::cos(sensor_pose.z());
+        const double ay = std::sin(sensor_pose.z());
+        const float res = map.resolution();
+        rasterize_cone(px, py, sensor_pose.z(), range * inv_res, _model.fov(), _model.max_range() * inv_res,
+            map.width(), map.height(), [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                const std::vector<value_type>& table = is_hit ? _hit_table : _miss_table;
+                const double dy = idx_y + 0.5 - py;
+                for (int x = x_begin; x < x_end; x++) {
+                    const double dx = x + 0.5 - px;
+                    const double dist = std::sqrt(dx * dx + dy * dy);
+                    const float sin_off = dist > 0.0 ? static_cast<float>((ax * dy - ay * dx) / dist) : 0.0f;
+                    map(x, idx_y).update(table[_model.bin(static_cast<float>(dist) * res, sin_off)]);
+                }
+                map.dirty().mark_region(x_begin, idx_y, x_end, idx_y + 1);
+                GRID_METRICS_ADD(cells_touched, x_end - x_begin);
+            });
+        return true;
+    }
+
+    // Rasterize the beam cone row by row and call span_fn(idx_y, x_begin, x_end, is_hit) for every
+    // run of cells [x_begin, x_end) inside the map. Each row costs one sqrt and no per-cell division,
+    // the cells of a row are classified by the cell center distance to the sensor.
+    template <typename MapT, typename SpanFn>
+    static void rasterize_cone(const MapT& map, const Eigen::Vector3d & sensor_pose,
+        float range, float fov, float max_range, SpanFn span_fn)
+    {
+        const double inv_res = 1.0 / map.resolution();
+        // Sensor position in continuous cell coordinates.
+        const double px = (sensor_pose.x() - map.origin().x()) * inv_res;
+        const double py = (sensor_pose.y() - map.origin().y()) * inv_res;
+        rasterize_cone(px, py, sensor_pose.z(), range * inv_res, fov, max_range * inv_res,
+            map.width(), map.height(), span_fn);
+    }
+
+    // Same as above in cell units, the sensor is at (px, py) of a width x height grid of cells.
+    template <typename SpanFn>
+    static void rasterize_cone(double px, double py, double yaw, double range_cells, float fov,
+        double max_range_cells, int width, int height, SpanFn span_fn)
+    {
+        const bool has_echo = range_cells < max_range_cells;
+        const double r_cells = std::max(0.0, std::min(range_cells, max_range_cells));
+        // The hit arc is the one cell thick band around the measured range.
+        const double r_in = has_echo ? std::max(0.0, r_cells - 0.5) : r_cells;
+        const double r_out = has_echo ? r_cells + 0.5 : r_cells;
+        if (r_out <= 0.0) return;
+
+        // Cone edges, a cell center v is inside when cross(right, v) >= 0 and cross(v, left) >= 0.
+        const double half_fov = 0.5 * std::max(0.0f, std::min(fov, MAX_CONE_FOV));
+        const double lx = std::cos(yaw + half_fov);
+        const double ly = std::sin(yaw + half_fov);
+        const double rx = std::cos(yaw - half_fov);
+        const double ry = std::sin(yaw - half_fov);
+
+        int y_begin = std::max(0, static_cast<int>(std::ceil(py - r_out - 0.5)));
+        int y_end = std::min(height, static_cast<int>(std::floor(py + r_out - 0.5)) + 1);
+        for (int idx_y = y_begin; idx_y < y_end; idx_y++) {
+            const double dy = idx_y + 0.5 - py;
+            double lo = -r_out;
+            double hi = r_out;
+            // -ry * dx + rx * dy >= 0 and ly * dx - lx * dy >= 0 are linear bounds of dx in this row.
+            if (!clip_half_plane(-ry, rx * dy, lo, hi) || !clip_half_plane(ly, -lx * dy, lo, hi)) {
+                continue;
+            }
+
+            double out_sq = r_out * r_out - dy * dy;
+            if (out_sq < 0.0) continue;
+            double out_half = std::sqrt(out_sq);
+            int a = cell_begin(std::max(lo, -out_half), px);
+            int b = cell_end(std::min(hi, out_half), px);
+            a = std::max(a, 0);
+            b = std::min(b, width);
+            if (a >= b) continue;
+
+            // Miss span inside the inner circle, the rest of [a, b) belongs to the hit arc.
+            int c = b;
+            int d = b;
+            double in_sq = r_in * r_in - dy * dy;
+            if (in_sq > 0.0) {
+                double in_half = std::sqrt(in_sq);
+                c = std::max(a, cell_begin(std::max(lo, -in_half), px));
+                d = std::min(b, cell_end(std::min(hi, in_half), px));
+                if (c >= d) {
+                    c = b;
+                    d = b;
+                }
+            }
+
+            if (c > a) span_fn(idx_y, a, c, has_echo);
+            if (d > c) span_fn(idx_y, c, d, false);
+            if (b > d) span_fn(idx_y, d, b, has_echo);
+        }
+    }
+
+private:
+    GridSensorModel _model;
+    std::vector<value_type> _hit_table;     // Weighted increments by model bin, empty without a model.
+    std::vector<value_type> _miss_table;
+
+    // Intersects [lo, hi] with {dx | k * dx + m >= 0}, returns false if the result is empty.
+    static bool clip_half_plane(double k, double m, double & lo, double & hi)
+    {
+        const double eps = 1e-9;
+        if (k > eps) {
+            lo = std::max(lo, -m / k);
+        } else if (k < -eps) {
+            hi = std::min(hi, -m / k);
+        } else if (m < 0.0) {
+            return false;
+        }
+        return lo <= hi;
+    }
+
+    // First cell whose center offset i + 0.5 - p is not less than dx.
+    static int cell_begin(double dx, double p)
+    {
+        return static_cast<int>(std::ceil(dx + p - 0.5));
+    }
+
+    // One past the last cell whose center offset i + 0.5 - p is not greater than dx.
+    static int cell_end(double dx, double p)
     {
-        cell.update(_log_odds_miss);
+        return static_cast<int>(std::floor(dx + p - 0.5)) + 1;
     }
 };
 
+typedef BasicGridSensor<GridCell> GridSensor;
+typedef BasicGridSensor<GridCell16> GridSensor16;
+typedef BasicGridSensor<GridCell8> GridSensor8;
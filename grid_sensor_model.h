@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_simd.h"
+
+// Default parameter values.
+const int DEFAULT_PROB_LUT_STEPS = 64;          // Float log odds table entries per log odds unit.
+const int DEFAULT_MODEL_BINS = 64;              // Entries of each weight table.
+const float DEFAULT_MODEL_AXIS_SIGMA = 0.5f;    // Angular weight standard deviation, in half beam widths.
+const float DEFAULT_MODEL_RANGE_DECAY = 0.5f;   // Weight lost from range 0 to max_range.
+
+// Table driven log_odds_to_prob over the clamped +/-LOG_ODDS_LIMIT range, also in the rounded percent
+// of nav_msgs/OccupancyGrid, so the probability and the occupancy export of a cell always agree.
+// Fixed-point cells have one entry per raw value, so the lookup is exact, float cells are rounded to
+// 1 / steps log odds.
+template <typename CellT = GridCell>
+class BasicGridProbabilityLut
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    BasicGridProbabilityLut(int steps = DEFAULT_PROB_LUT_STEPS)
+    {
+        // Raw units per table entry, fixed-point scales are used as they are.
+        _steps = CellT::traits_type::scale == 1.0f ? static_cast<float>(steps) : 1.0f;
+        _offset = static_cast<int>(std::lround(LOG_ODDS_LIMIT * CellT::traits_type::scale * _steps));
+        _bias = _offset + 0.5f;
+        _table.resize(2 * _offset + 1);
+        // Padded for the 32-bit gathers of GridKernel::lookup.
+        _percent.resize(2 * _offset + 4, 0);
+        for (int i = 0; i <= 2 * _offset; i++) {
+            float log_odds = (i - _offset) / (_steps * CellT::traits_type::scale);
+            _table[i] = CellT::log_odds_to_prob(log_odds);
+            _percent[i] = static_cast<int8_t>(std::lround(100.0f * _table[i]));
+        }
+    }
+
+    float prob(value_type raw) const
+    {
+        return _table[index(raw)];
+    }
+
+    float prob(const CellT& cell) const
+    {
+        return prob(cell._log_odds_val);
+    }
+
+    // Occupancy probabilities of the logical cells of a map, row-major into out.
+    template <typename MapT>
+    void to_prob(const MapT& map, std::vector<float>& out) const
+    {
+        const int width = map.width();
+        out.resize(static_cast<size_t>(width) * map.height());
+        map.for_each_run(GridRegion{0, 0, width, map.height()}, [&](const CellT* cell, int x, int y, int run) {
+            float* row = &out[static_cast<size_t>(y) * width + x];
+            for (int i = 0; i < run; i++) {
+                row[i] = prob(cell[i]._log_odds_val);
+            }
+        });
+    }
+
+    // nav_msgs/OccupancyGrid value of raw: -1 within unknown_band log odds of the prior, otherwise
+    // prob(raw) in percent, rounded.
+    int8_t occupancy(value_type raw, float unknown_band) const
+    {
+        return GridKernel::lookup(static_cast<float>(raw), _steps, _bias, 2 * _offset,
+            unknown_band * CellT::traits_type::scale, _percent.data());
+    }
+
+    // occupancy(data[i], unknown_band) into out[0, n), vectorized.
+    void occupancy(const value_type* data, int n, float unknown_band, int8_t* out) const
+    {
+        GridKernel::lookup(data, n, _steps, _bias, 2 * _offset, unknown_band * CellT::traits_type::scale,
+            _percent.data(), out);
+    }
+
+private:
+    float _steps;               // Table entries per raw unit.
+    int _offset;                // Table index of log odds 0.
+    float _bias;                // _offset + 0.5, rounds raw * _steps to the nearest entry.
+    std::vector<float> _table;
+    std::vector<int8_t> _percent;   // _table in rounded percent.
+
+    int index(value_type raw) const
+    {
+        float i = std::max(0.0f, std::min(raw * _steps + _bias, 2.0f * _offset));
+        return static_cast<int>(i);
+    }
+};
+
+// Range and angle dependent inverse sensor model of an ultrasonic beam.
+// The hit and miss log odds of a cell are scaled by the product of a Gaussian profile across the
+// beam and a linear decay along it. The profiles are tabulated by bin(range, sin_off_axis), the
+// sine of the off axis angle is used so a cell costs no atan2, see BasicGridSensor::set_model for
+// the per sensor tables of weighted increments.
+class GridSensorModel
+{
+public:
+    GridSensorModel(float fov = 1.0f, float max_range = 5.0f,
+        float axis_sigma = DEFAULT_MODEL_AXIS_SIGMA,
+        float range_decay = DEFAULT_MODEL_RANGE_DECAY,
+        int bins = DEFAULT_MODEL_BINS)
+    {
+        _fov = fov;
+        _max_range = max_range;
+        _bins = std::max(2, bins);
+        _inv_sin_half_fov = 1.0f / std::sin(0.5f * std::max(1e-3f, fov));
+        _inv_max_range = 1.0f / max_range;
+
+        _axis_weight.resize(_bins);
+        _range_weight.resize(_bins);
+        for (int i = 0; i < _bins; i++) {
+            // Bin i of the angular table is at sin(off axis) = i / (bins - 1) * sin(fov / 2).
+            float off_axis = std::asin(std::min(1.0f, i / (_bins - 1.0f) / _inv_sin_half_fov)) / (0.5f * fov);
+            _axis_weight[i] = std::exp(-0.5f * off_axis * off_axis / (axis_sigma * axis_sigma));
+            _range_weight[i] = 1.0f - range_decay * i / (_bins - 1.0f);
+        }
+    }
+
+    float fov() const { return _fov; }
+    float max_range() const { return _max_range; }
+
+    int bins() const { return _bins; }
+
+    // Table index of a cell at range [m] whose direction is off the beam axis by an angle of sine
+    // sin_off_axis, in [0, bins * bins).
+    int bin(float range, float sin_off_axis) const
+    {
+        int a = static_cast<int>(std::fabs(sin_off_axis) * _inv_sin_half_fov * (_bins - 1) + 0.5f);
+        int r = static_cast<int>(range * _inv_max_range * (_bins - 1) + 0.5f);
+        return std::min(a, _bins - 1) * _bins + std::min(r, _bins - 1);
+    }
+
+    // Weight of the log odds of table index bin.
+    float weight(int bin) const
+    {
+        return _axis_weight[bin / _bins] * _range_weight[bin % _bins];
+    }
+
+    float weight(float range, float sin_off_axis) const
+    {
+        return weight(bin(range, sin_off_axis));
+    }
+
+private:
+    float _fov;                         // Beam width [rad].
+    float _max_range;                   // [m].
+    int _bins;
+    float _inv_sin_half_fov;
+    float _inv_max_range;
+    std::vector<float> _axis_weight;    // By sin(off axis) / sin(fov / 2).
+    std::vector<float> _range_weight;   // By range / max_range.
+};
+
+typedef BasicGridProbabilityLut<GridCell> GridProbabilityLut;
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Default parameter values.
+const int GRID_SHM_RING_VERSION = 1;
+const int GRID_SHM_RING_SLOTS = 4;
+
+// POSIX shared memory ring of frames, one writer process and any number of reader processes.
+// Each slot holds a MetaT frame header and up to capacity() payload bytes. The writer fills the next
+// slot in place and publishes it, readers get pointers straight into the mapping and check with
+// is_valid after use that the slot was not reused meanwhile, a sequence lock per slot. The writer
+// reaches the slot of a frame again after slots() further publishes. Publishing never waits for
+// the readers, a slow reader sees is_valid fail and takes the latest frame again.
+template <typename MetaT>
+class GridShmRing
+{
+public:
+    static_assert(std::is_trivially_copyable<MetaT>::value, "The frame header is shared between processes.");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The sequence locks must not need a lock.");
+
+    // A published frame as seen by a reader, valid until is_valid says otherwise.
+    struct Frame
+    {
+        const MetaT* meta;
+        const uint8_t* data;
+        uint64_t sequence;          // 1 for the first published frame.
+    };
+
+    GridShmRing()
+    {
+        _base = nullptr;
+        _size = 0;
+        _writer = false;
+        _next = 0;
+    }
+
+    ~GridShmRing()
+    {
+        close();
+    }
+
+    GridShmRing(const GridShmRing&) = delete;
+    GridShmRing& operator=(const GridShmRing&) = delete;
+
+    // Creates the ring name, e.g. "/grid_map", as its writer, replacing an existing one.
+    // The slots start zeroed.
+    bool create(const std::string& name, int slots = GRID_SHM_RING_SLOTS, size_t capacity = 0)
+    {
+        close();
+        if (slots < 2) {
+            std::cout << "Shared memory ring error: at least 2 slots are needed, got " << slots;
+            return false;
+        }
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            std::cout << "Shared memory ring create error: " << name;
+            return false;
+        }
+        const size_t stride = slot_stride(capacity);
+        const size_t size = HEADER_SIZE + stride * slots;
+        void* data = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cout << "Shared memory ring map error: " << name;
+            shm_unlink(name.c_str());
+            return false;
+        }
+        _base = static_cast<uint8_t*>(data);
+        _size = size;
+        _writer = true;
+        _name = name;
+        _next = 1;
+
+        RingHeader* ring = header();
+        std::memcpy(ring->magic, "UGSR", 4);
+        ring->version = GRID_SHM_RING_VERSION;
+        ring->slots = slots;
+        ring->meta_size = sizeof(MetaT);
+        ring->capacity = capacity;
+        ring->stride = stride;
+        ring->sequence.store(0, std::memory_order_release);
+        return true;
+    }
+
+    // Maps an existing ring read-only as a reader.
+    bool open(const std::string& name)
+    {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            std::cout << "Shared memory ring open error: " << name;
+            return false;
+        }
+        struct stat st;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE) {
+            data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cout << "Shared memory ring map error: " << name;
+            return false;
+        }
+        _base = static_cast<uint8_t*>(data);
+        _size = st.st_size;
+
+        const RingHeader* ring = header();
+        if (std::memcmp(ring->magic, "UGSR", 4) != 0 || ring->version != GRID_SHM_RING_VERSION
+            || ring->meta_size != sizeof(MetaT) || ring->stride != slot_stride(ring->capacity)
+            || HEADER_SIZE + ring->stride * ring->slots > _size) {
+            std::cout << "Shared memory ring format error: " << name;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Unmaps the ring, the writer also removes its name. Mappings of readers stay valid.
+    void close()
+    {
+        if (_base != nullptr) {
+            munmap(_base, _size);
+            if (_writer) {
+                shm_unlink(_name.c_str());
+            }
+        }
+        _base = nullptr;
+        _size = 0;
+        _writer = false;
+        _name.clear();
+    }
+
+    bool is_open() const { return _base != nullptr; }
+    bool is_writer() const { return _writer; }
+    int slots() const { return header()->slots; }
+    size_t capacity() const { return header()->capacity; }
+
+    // Sequence of the latest published frame, 0 before the first one.
+    uint64_t sequence() const { return header()->sequence.load(std::memory_order_acquire); }
+
+    // Writer, opens the slot of the next frame. The slot still holds the frame published slots()
+    // frames ago, or zeros, so a writer may refresh it in place.
+    void begin_frame(MetaT*& meta, uint8_t*& data)
+    {
+        SlotHeader* slot = slot_header(_next);
+        slot->sequence.store(2 * _next - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        meta = slot_meta(_next);
+        data = slot_data(_next);
+    }
+
+    // Writer, publishes the frame opened by begin_frame.
+    void publish()
+    {
+        slot_header(_next)->sequence.store(2 * _next, std::memory_order_release);
+        header()->sequence.store(_next, std::memory_order_release);
+        _next++;
+    }
+
+    // Reader, the latest published frame. Fails before the first publish, or when the writer
+    // lapped the ring while looking up.
+    bool latest(Frame& frame) const
+    {
+        uint64_t sequence = this->sequence();
+        if (sequence == 0 || slot_header(sequence)->sequence.load(std::memory_order_acquire) != 2 * sequence) {
+            return false;
+        }
+        frame.meta = slot_meta(sequence);
+        frame.data = slot_data(sequence);
+        frame.sequence = sequence;
+        return true;
+    }
+
+    // Reader, whether frame was not overwritten up to now. Check after reading a frame, what was
+    // read is consistent if it still holds.
+    bool is_valid(const Frame& frame) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot_header(frame.sequence)->sequence.load(std::memory_order_relaxed) == 2 * frame.sequence;
+    }
+
+private:
+    struct RingHeader
+    {
+        char magic[4];                      // "UGSR".
+        uint32_t version;
+        uint32_t slots;
+        uint32_t meta_size;                 // sizeof(MetaT) of the writer.
+        uint64_t capacity;                  // Payload bytes per slot.
+        uint64_t stride;                    // Bytes per slot.
+        std::atomic<uint64_t> sequence;     // Latest published frame.
+    };
+
+    struct SlotHeader
+    {
+        std::atomic<uint64_t> sequence;     // 2 * frame sequence once published, odd while written.
+    };
+
+    // Slot layout: SlotHeader, MetaT and the payload, each starting on a cache line.
+    static const size_t HEADER_SIZE = 64;
+    static const size_t META_OFFSET = 64;
+    static constexpr size_t DATA_OFFSET = META_OFFSET + (sizeof(MetaT) + 63) / 64 * 64;
+
+    static_assert(sizeof(RingHeader) <= HEADER_SIZE && sizeof(SlotHeader) <= META_OFFSET, "See the slot layout.");
+
+    static size_t slot_stride(size_t capacity)
+    {
+        return DATA_OFFSET + (capacity + 63) / 64 * 64;
+    }
+
+    RingHeader* header() { return reinterpret_cast<RingHeader*>(_base); }
+    const RingHeader* header() const { return reinterpret_cast<const RingHeader*>(_base); }
+
+    uint8_t* slot_base(uint64_t sequence) const
+    {
+        const RingHeader* ring = header();
+        return _base + HEADER_SIZE + ring->stride * ((sequence - 1) % ring->slots);
+    }
+
+    SlotHeader* slot_header(uint64_t sequence) const { return reinterpret_cast<SlotHeader*>(slot_base(sequence)); }
+    MetaT* slot_meta(uint64_t sequence) const { return reinterpret_cast<MetaT*>(slot_base(sequence) + META_OFFSET); }
+    uint8_t* slot_data(uint64_t sequence) const { return slot_base(sequence) + DATA_OFFSET; }
+
+    uint8_t* _base;                 // Mapping of the ring.
+    size_t _size;
+    bool _writer;
+    std::string _name;              // Removed by the writer on close.
+    uint64_t _next;                 // Writer, sequence of the next frame.
+};
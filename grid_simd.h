@@ -0,0 +1,440 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "grid_bitmask.h"
+#include "grid_cell.h"
+
+// Instruction set of the bulk kernels, chosen at compile time.
+// Define GRID_MAP_NO_SIMD to force the scalar fallback.
+#if !defined(GRID_MAP_NO_SIMD) && defined(__AVX2__)
+#define GRID_SIMD_AVX2 1
+#include <immintrin.h>
+#elif !defined(GRID_MAP_NO_SIMD) && defined(__SSE2__)
+#define GRID_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif !defined(GRID_MAP_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define GRID_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Bulk log odds kernels over contiguous runs of cells.
+// The updates give the same result as calling GridCell::update on every cell of the run,
+// bit masks are in the GridBitmask row format and addressed by their starting bit.
+// The float overloads are hand vectorized, the fixed-point templates are written branch free
+// so the compiler can vectorize them.
+class GridKernel
+{
+public:
+    static const char* isa()
+    {
+#if defined(GRID_SIMD_AVX2)
+        return "avx2";
+#elif defined(GRID_SIMD_SSE2)
+        return "sse2";
+#elif defined(GRID_SIMD_NEON)
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+
+    // GridCell::update(mea_log_odds) on data[0, n).
+    static void saturating_add(float* data, int n, float mea_log_odds)
+    {
+        saturating_add(data, n, mea_log_odds, nullptr, 0);
+    }
+
+    // GridCell::update(mea_log_odds) on the cells of data[0, n) whose bit mask_pos + i is set.
+    // A null mask updates every cell.
+    static void saturating_add(float* data, int n, float mea_log_odds, const uint64_t* mask, int mask_pos)
+    {
+        if (mea_log_odds == 0.0f) return;
+
+        // v < 50 for a positive update and v > -50 for a negative one, both as (v * sign) < 50.
+        const bool positive = mea_log_odds > 0.0f;
+        int i = 0;
+#if defined(GRID_SIMD_AVX2)
+        const __m256 delta = _mm256_set1_ps(mea_log_odds);
+        const __m256 limit = _mm256_set1_ps(LOG_ODDS_LIMIT);
+        const __m256 sign = _mm256_set1_ps(positive ? 0.0f : -0.0f);
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(data + i);
+            __m256 m = _mm256_cmp_ps(_mm256_xor_ps(v, sign), limit, _CMP_LT_OQ);
+            if (mask != nullptr) {
+                __m256i bits = _mm256_set1_epi32(static_cast<int>(GridBitmask::read_bits(mask, mask_pos + i, 8)));
+                m = _mm256_and_ps(m, _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(_mm256_and_si256(bits, lane_bits), lane_bits)));
+            }
+            _mm256_storeu_ps(data + i, _mm256_add_ps(v, _mm256_and_ps(delta, m)));
+        }
+#elif defined(GRID_SIMD_SSE2)
+        const __m128 delta = _mm_set1_ps(mea_log_odds);
+        const __m128 limit = _mm_set1_ps(LOG_ODDS_LIMIT);
+        const __m128 sign = _mm_set1_ps(positive ? 0.0f : -0.0f);
+        const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(data + i);
+            __m128 m = _mm_cmplt_ps(_mm_xor_ps(v, sign), limit);
+            if (mask != nullptr) {
+                __m128i bits = _mm_set1_epi32(static_cast<int>(GridBitmask::read_bits(mask, mask_pos + i, 4)));
+                m = _mm_and_ps(m, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, lane_bits), lane_bits)));
+            }
+            _mm_storeu_ps(data + i, _mm_add_ps(v, _mm_and_ps(delta, m)));
+        }
+#elif defined(GRID_SIMD_NEON)
+        const float32x4_t delta = vdupq_n_f32(mea_log_odds);
+        const float32x4_t limit = vdupq_n_f32(positive ? LOG_ODDS_LIMIT : -LOG_ODDS_LIMIT);
+        const uint32_t lane_init[4] = {1, 2, 4, 8};
+        const uint32x4_t lane_bits = vld1q_u32(lane_init);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(data + i);
+            uint32x4_t m = positive ? vcltq_f32(v, limit) : vcgtq_f32(v, limit);
+            if (mask != nullptr) {
+                uint32x4_t bits = vdupq_n_u32(static_cast<uint32_t>(GridBitmask::read_bits(mask, mask_pos + i, 4)));
+                m = vandq_u32(m, vtstq_u32(bits, lane_bits));
+            }
+            float32x4_t add = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(delta), m));
+            vst1q_f32(data + i, vaddq_f32(v, add));
+        }
+#endif
+        for (; i < n; i++) {
+            if (mask != nullptr && !GridBitmask::read_bits(mask, mask_pos + i, 1)) continue;
+            if (positive ? data[i] < LOG_ODDS_LIMIT : data[i] > -LOG_ODDS_LIMIT) {
+                data[i] += mea_log_odds;
+            }
+        }
+    }
+
+    // Sets bit pos + i of occupied if data[i] > occupied_thre and of free if data[i] < free_thre.
+    // The bits are ORed in, so the destination rows are expected to be cleared.
+    static void classify(const float* data, int n, float occupied_thre, float free_thre,
+        uint64_t* occupied, uint64_t* free, int pos)
+    {
+        int i = 0;
+#if defined(GRID_SIMD_AVX2)
+        const __m256 occ_thre = _mm256_set1_ps(occupied_thre);
+        const __m256 fre_thre = _mm256_set1_ps(free_thre);
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(data + i);
+            uint64_t occ_bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(v, occ_thre, _CMP_GT_OQ)));
+            uint64_t fre_bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(v, fre_thre, _CMP_LT_OQ)));
+            if (occ_bits) GridBitmask::or_bits(occupied, pos + i, occ_bits, 8);
+            if (fre_bits) GridBitmask::or_bits(free, pos + i, fre_bits, 8);
+        }
+#elif defined(GRID_SIMD_SSE2)
+        const __m128 occ_thre = _mm_set1_ps(occupied_thre);
+        const __m128 fre_thre = _mm_set1_ps(free_thre);
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(data + i);
+            uint64_t occ_bits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(v, occ_thre)));
+            uint64_t fre_bits = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(v, fre_thre)));
+            if (occ_bits) GridBitmask::or_bits(occupied, pos + i, occ_bits, 4);
+            if (fre_bits) GridBitmask::or_bits(free, pos + i, fre_bits, 4);
+        }
+#elif defined(GRID_SIMD_NEON)
+        const float32x4_t occ_thre = vdupq_n_f32(occupied_thre);
+        const float32x4_t fre_thre = vdupq_n_f32(free_thre);
+        const uint32_t lane_init[4] = {1, 2, 4, 8};
+        const uint32x4_t lane_bits = vld1q_u32(lane_init);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(data + i);
+            uint64_t occ_bits = vaddvq_u32(vandq_u32(vcgtq_f32(v, occ_thre), lane_bits));
+            uint64_t fre_bits = vaddvq_u32(vandq_u32(vcltq_f32(v, fre_thre), lane_bits));
+            if (occ_bits) GridBitmask::or_bits(occupied, pos + i, occ_bits, 4);
+            if (fre_bits) GridBitmask::or_bits(free, pos + i, fre_bits, 4);
+        }
+#endif
+        for (; i < n; i++) {
+            if (data[i] > occupied_thre) GridBitmask::or_bits(occupied, pos + i, 1, 1);
+            if (data[i] < free_thre) GridBitmask::or_bits(free, pos + i, 1, 1);
+        }
+    }
+
+    // BasicGridCell<T>::update(mea_log_odds) on the masked cells of data[0, n) for fixed-point T.
+    template <typename T>
+    static void saturating_add(T* data, int n, T mea_log_odds, const uint64_t* mask = nullptr, int mask_pos = 0)
+    {
+        if (mea_log_odds == 0) return;
+
+        const int limit = GridCellTraits<T>::limit;
+        for (int i = 0; i < n; i++) {
+            int delta = mea_log_odds;
+            if (mask != nullptr) {
+                delta &= -static_cast<int>(GridBitmask::read_bits(mask, mask_pos + i, 1));
+            }
+            int sum = data[i] + delta;
+            sum = sum > limit ? limit : sum;
+            sum = sum < -limit ? -limit : sum;
+            data[i] = static_cast<T>(sum);
+        }
+    }
+
+    // Multiplies data[0, n) by factor in [0, 1], the dither of the fixed-point version is unused.
+    static void scale(float* data, int n, float factor, uint32_t)
+    {
+        for (int i = 0; i < n; i++) {
+            data[i] *= factor;
+        }
+    }
+
+    // Fixed-point version, rounded stochastically: v becomes floor(v * factor + u), u in [0, 1) from a
+    // low-discrepancy sequence started at dither. The expected result is v * factor however a decay
+    // is split into steps, and values still reach the prior exactly, where rounding to nearest would
+    // leave small values stuck for factors near 1. Q16 integer math for the auto vectorizer.
+    template <typename T>
+    static void scale(T* data, int n, float factor, uint32_t dither)
+    {
+        const int32_t f = static_cast<int32_t>(factor * 65536.0f + 0.5f);
+        for (int i = 0; i < n; i++) {
+            const int32_t u = static_cast<int32_t>((dither + static_cast<uint32_t>(i) * 40503u) & 0xFFFFu);
+            // Arithmetic shift, the floor for negative values too.
+            data[i] = static_cast<T>((data[i] * f + u) >> 16);
+        }
+    }
+
+    // Cell indices of the interleaved points xy[2 * i], xy[2 * i + 1] under the affine transform
+    // (cx, cy) = (c * x - s * y + offset_x, s * x + c * y + offset_y), floored and clamped to the
+    // width x height grid, into the interleaved cells. in_border[i] is set for points inside the
+    // grid, the number of them is returned. NaN coordinates land on cell 0 outside the grid.
+    static int points_to_cells(const double* xy, int n, double c, double s, double offset_x, double offset_y,
+        int width, int height, int* cells, uint8_t* in_border)
+    {
+        int i = 0;
+        int inside_count = 0;
+#if defined(GRID_SIMD_AVX2)
+        const __m256d vc = _mm256_set1_pd(c);
+        const __m256d vs = _mm256_set1_pd(s);
+        const __m256d vox = _mm256_set1_pd(offset_x);
+        const __m256d voy = _mm256_set1_pd(offset_y);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d w = _mm256_set1_pd(width);
+        const __m256d h = _mm256_set1_pd(height);
+        const __m256d w_last = _mm256_set1_pd(width - 1);
+        const __m256d h_last = _mm256_set1_pd(height - 1);
+        for (; i + 4 <= n; i += 4) {
+            __m256d p0 = _mm256_loadu_pd(xy + 2 * i);
+            __m256d p1 = _mm256_loadu_pd(xy + 2 * i + 4);
+            // Lanes x0 x2 x1 x3, put back in point order.
+            __m256d x = _mm256_permute4x64_pd(_mm256_unpacklo_pd(p0, p1), 0xD8);
+            __m256d y = _mm256_permute4x64_pd(_mm256_unpackhi_pd(p0, p1), 0xD8);
+            __m256d fx = _mm256_floor_pd(_mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(vc, x), _mm256_mul_pd(vs, y)), vox));
+            __m256d fy = _mm256_floor_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vs, x), _mm256_mul_pd(vc, y)), voy));
+            __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(fx, zero, _CMP_GE_OQ), _mm256_cmp_pd(fx, w, _CMP_LT_OQ)),
+                _mm256_and_pd(_mm256_cmp_pd(fy, zero, _CMP_GE_OQ), _mm256_cmp_pd(fy, h, _CMP_LT_OQ)));
+            __m128i ix = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(fx, zero), w_last));
+            __m128i iy = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(fy, zero), h_last));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cells + 2 * i), _mm_unpacklo_epi32(ix, iy));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cells + 2 * i + 4), _mm_unpackhi_epi32(ix, iy));
+            int bits = _mm256_movemask_pd(inside);
+            for (int j = 0; j < 4; j++) {
+                in_border[i + j] = (bits >> j) & 1;
+            }
+            inside_count += __builtin_popcount(bits);
+        }
+#elif defined(GRID_SIMD_SSE2)
+        const __m128d vc = _mm_set1_pd(c);
+        const __m128d vs = _mm_set1_pd(s);
+        const __m128d vox = _mm_set1_pd(offset_x);
+        const __m128d voy = _mm_set1_pd(offset_y);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d one = _mm_set1_pd(1.0);
+        const __m128d low = _mm_set1_pd(-1.0);
+        const __m128d w = _mm_set1_pd(width);
+        const __m128d h = _mm_set1_pd(height);
+        const __m128d w_last = _mm_set1_pd(width - 1);
+        const __m128d h_last = _mm_set1_pd(height - 1);
+        for (; i + 2 <= n; i += 2) {
+            __m128d p0 = _mm_loadu_pd(xy + 2 * i);
+            __m128d p1 = _mm_loadu_pd(xy + 2 * i + 2);
+            __m128d x = _mm_unpacklo_pd(p0, p1);
+            __m128d y = _mm_unpackhi_pd(p0, p1);
+            // Clamped one cell beyond the grid so the truncating conversion cannot overflow, then
+            // floored by stepping down where the truncation rounded up.
+            __m128d fx = _mm_min_pd(_mm_max_pd(_mm_add_pd(_mm_sub_pd(_mm_mul_pd(vc, x), _mm_mul_pd(vs, y)), vox), low), w);
+            __m128d fy = _mm_min_pd(_mm_max_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(vs, x), _mm_mul_pd(vc, y)), voy), low), h);
+            __m128d tx = _mm_cvtepi32_pd(_mm_cvttpd_epi32(fx));
+            __m128d ty = _mm_cvtepi32_pd(_mm_cvttpd_epi32(fy));
+            fx = _mm_sub_pd(tx, _mm_and_pd(_mm_cmplt_pd(fx, tx), one));
+            fy = _mm_sub_pd(ty, _mm_and_pd(_mm_cmplt_pd(fy, ty), one));
+            __m128d inside = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(fx, zero), _mm_cmplt_pd(fx, w)),
+                _mm_and_pd(_mm_cmpge_pd(fy, zero), _mm_cmplt_pd(fy, h)));
+            __m128i ix = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(fx, zero), w_last));
+            __m128i iy = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(fy, zero), h_last));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cells + 2 * i), _mm_unpacklo_epi32(ix, iy));
+            int bits = _mm_movemask_pd(inside);
+            in_border[i] = bits & 1;
+            in_border[i + 1] = bits >> 1;
+            inside_count += (bits & 1) + (bits >> 1);
+        }
+#endif
+        for (; i < n; i++) {
+            double fx = c * xy[2 * i] - s * xy[2 * i + 1] + offset_x;
+            double fy = s * xy[2 * i] + c * xy[2 * i + 1] + offset_y;
+            // Written so that NaN takes the -1 branch like in the vector paths.
+            fx = fx >= -1.0 ? (fx <= width ? fx : width) : -1.0;
+            fy = fy >= -1.0 ? (fy <= height ? fy : height) : -1.0;
+            int idx_x = static_cast<int>(fx);
+            int idx_y = static_cast<int>(fy);
+            idx_x -= fx < idx_x;
+            idx_y -= fy < idx_y;
+            int inside = (idx_x >= 0) & (idx_x < width) & (idx_y >= 0) & (idx_y < height);
+            cells[2 * i] = idx_x < 0 ? 0 : idx_x >= width ? width - 1 : idx_x;
+            cells[2 * i + 1] = idx_y < 0 ? 0 : idx_y >= height ? height - 1 : idx_y;
+            in_border[i] = static_cast<uint8_t>(inside);
+            inside_count += inside;
+        }
+        return inside_count;
+    }
+
+    // Fixed-point version of classify, 64 cells are compared per bit mask word.
+    template <typename T>
+    static void classify(const T* data, int n, T occupied_thre, T free_thre,
+        uint64_t* occupied, uint64_t* free, int pos)
+    {
+        for (int i = 0; i < n; i += 57) {
+            int m = n - i < 57 ? n - i : 57;
+            uint64_t occ_bits = 0;
+            uint64_t fre_bits = 0;
+            for (int j = 0; j < m; j++) {
+                occ_bits |= static_cast<uint64_t>(data[i + j] > occupied_thre) << j;
+                fre_bits |= static_cast<uint64_t>(data[i + j] < free_thre) << j;
+            }
+            GridBitmask::or_bits(occupied, pos + i, occ_bits, m);
+            GridBitmask::or_bits(free, pos + i, fre_bits, m);
+        }
+    }
+
+    // Table lookup of data[0, n) into out: -1 where |data[i]| <= band, otherwise entry
+    // data[i] * steps + bias of table, clamped to [0, top] and truncated. The entries are in [0, 127],
+    // and table is readable 3 bytes past entry top for the 32-bit gathers.
+    static void lookup(const float* data, int n, float steps, float bias, int top, float band,
+        const int8_t* table, int8_t* out)
+    {
+        int i = 0;
+#if defined(GRID_SIMD_AVX2)
+        const GridLookup8 lut(steps, bias, top, band, table);
+        for (; i + 8 <= n; i += 8) {
+            lut.store(_mm256_loadu_ps(data + i), out + i);
+        }
+#elif defined(GRID_SIMD_SSE2)
+        const __m128 steps4 = _mm_set1_ps(steps);
+        const __m128 bias4 = _mm_set1_ps(bias);
+        const __m128 top4 = _mm_set1_ps(static_cast<float>(top));
+        const __m128 band4 = _mm_set1_ps(band);
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        int32_t index[4];
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(data + i);
+            __m128 f = _mm_add_ps(_mm_mul_ps(v, steps4), bias4);
+            f = _mm_max_ps(_mm_min_ps(f, top4), _mm_setzero_ps());
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(f));
+            int unknown = _mm_movemask_ps(_mm_cmple_ps(_mm_and_ps(v, abs_mask), band4));
+            for (int j = 0; j < 4; j++) {
+                out[i + j] = (unknown >> j) & 1 ? -1 : table[index[j]];
+            }
+        }
+#elif defined(GRID_SIMD_NEON)
+        const float32x4_t steps4 = vdupq_n_f32(steps);
+        const float32x4_t bias4 = vdupq_n_f32(bias);
+        const float32x4_t top4 = vdupq_n_f32(static_cast<float>(top));
+        const float32x4_t band4 = vdupq_n_f32(band);
+        int32_t index[4];
+        uint32_t unknown[4];
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(data + i);
+            float32x4_t f = vaddq_f32(vmulq_f32(v, steps4), bias4);
+            // Compare and select rather than vminq/vmaxq, so NaN clamps to top as in the scalar loop.
+            f = vbslq_f32(vcltq_f32(f, top4), f, top4);
+            f = vbslq_f32(vcgtq_f32(f, vdupq_n_f32(0.0f)), f, vdupq_n_f32(0.0f));
+            vst1q_s32(index, vcvtq_s32_f32(f));
+            vst1q_u32(unknown, vcleq_f32(vabsq_f32(v), band4));
+            for (int j = 0; j < 4; j++) {
+                out[i + j] = unknown[j] ? -1 : table[index[j]];
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            out[i] = lookup(data[i], steps, bias, top, band, table);
+        }
+    }
+
+    // Fixed-point version of lookup, the raw values are converted to float. Only AVX2 has the gather
+    // that makes it worth vectorizing.
+    template <typename T>
+    static void lookup(const T* data, int n, float steps, float bias, int top, float band,
+        const int8_t* table, int8_t* out)
+    {
+        int i = 0;
+#if defined(GRID_SIMD_AVX2)
+        const GridLookup8 lut(steps, bias, top, band, table);
+        for (; i + 8 <= n; i += 8) {
+            lut.store(_mm256_cvtepi32_ps(GridLookup8::load(data + i)), out + i);
+        }
+#endif
+        for (; i < n; i++) {
+            out[i] = lookup(static_cast<float>(data[i]), steps, bias, top, band, table);
+        }
+    }
+
+    // One entry of lookup.
+    static int8_t lookup(float v, float steps, float bias, int top, float band, const int8_t* table)
+    {
+        if (std::fabs(v) <= band) return -1;
+        float f = v * steps + bias;
+        f = f < top ? f : static_cast<float>(top);
+        f = f > 0.0f ? f : 0.0f;
+        return table[static_cast<int>(f)];
+    }
+
+private:
+#if defined(GRID_SIMD_AVX2)
+    // Eight lanes of lookup with a gather. Clamping min before max sends NaN to top, as the scalar
+    // loop does.
+    struct GridLookup8
+    {
+        __m256 steps;
+        __m256 bias;
+        __m256 top;
+        __m256 band;
+        __m256 abs_mask;
+        __m256i byte_mask;
+        const int* table;
+
+        GridLookup8(float steps_, float bias_, int top_, float band_, const int8_t* table_)
+        {
+            steps = _mm256_set1_ps(steps_);
+            bias = _mm256_set1_ps(bias_);
+            top = _mm256_set1_ps(static_cast<float>(top_));
+            band = _mm256_set1_ps(band_);
+            abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+            byte_mask = _mm256_set1_epi32(0xFF);
+            table = reinterpret_cast<const int*>(table_);
+        }
+
+        static __m256i load(const int16_t* data)
+        {
+            return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+        }
+
+        static __m256i load(const int8_t* data)
+        {
+            return _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(data)));
+        }
+
+        void store(__m256 v, int8_t* out) const
+        {
+            __m256 f = _mm256_add_ps(_mm256_mul_ps(v, steps), bias);
+            f = _mm256_max_ps(_mm256_min_ps(f, top), _mm256_setzero_ps());
+            // Four bytes from the entry, the low one is kept.
+            __m256i p = _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_cvttps_epi32(f), 1), byte_mask);
+            // -1 in the unknown lanes.
+            p = _mm256_or_si256(p, _mm256_castps_si256(_mm256_cmp_ps(_mm256_and_ps(v, abs_mask), band, _CMP_LE_OQ)));
+            __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packs_epi16(w, w));
+        }
+    };
+#endif
+};
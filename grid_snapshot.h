@@ -0,0 +1,195 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+
+const int SNAPSHOT_TILE = 32;   // Snapshot tile edge [cells], a float tile is 4KB.
+
+// Immutable copy of a GridMap made of shared copy-on-write tiles, in logical cell order.
+// A snapshot is never modified after it has been published, so any number of threads can read it.
+template <typename CellT = GridCell>
+class BasicGridSnapshot
+{
+public:
+    struct Tile
+    {
+        CellT cells[SNAPSHOT_TILE * SNAPSHOT_TILE];    // Row-major inside the tile.
+    };
+    typedef std::shared_ptr<const Tile> TilePtr;
+
+    float resolution() const { return _resolution; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    Eigen::Vector2d origin() const { return _origin; }
+    uint64_t sequence() const { return _sequence; }
+    int tiles_x() const { return _tiles_x; }
+    int tiles_y() const { return _tiles_y; }
+
+    const CellT& operator()(int idx_x, int idx_y) const
+    {
+        const Tile& tile = *_tiles[(idx_y / SNAPSHOT_TILE) * _tiles_x + idx_x / SNAPSHOT_TILE];
+        return tile.cells[(idx_y % SNAPSHOT_TILE) * SNAPSHOT_TILE + idx_x % SNAPSHOT_TILE];
+    }
+
+    const TilePtr& tile(int tile_x, int tile_y) const
+    {
+        return _tiles[tile_y * _tiles_x + tile_x];
+    }
+
+    bool is_in_border(const int idx_x, const int idx_y) const
+    {
+        return (idx_x >= 0 && idx_x < _width && idx_y >= 0 && idx_y < _height);
+    }
+
+    bool idx_to_xy(const int idx_x, const int idx_y, double &x, double &y) const
+    {
+        x = _origin.x() + _resolution * (idx_x + 0.5);
+        y = _origin.y() + _resolution * (idx_y + 0.5);
+        return is_in_border(idx_x, idx_y);
+    }
+
+    bool xy_to_idx(const double x, const double y, int &idx_x, int &idx_y) const
+    {
+        idx_x = (x - _origin.x()) / _resolution;
+        idx_y = (y - _origin.y()) / _resolution;
+        if (is_in_border(idx_x, idx_y)) {
+            return true;
+        } else {
+            idx_x = std::max(0, std::min(idx_x, _width - 1));
+            idx_y = std::max(0, std::min(idx_y, _height - 1));
+            return false;
+        }
+    }
+
+private:
+    template <typename> friend class BasicGridSnapshotPublisher;
+
+    float _resolution;
+    int _width;
+    int _height;
+    Eigen::Vector2d _origin;
+    uint64_t _sequence;             // Number of the publish that produced the snapshot.
+    int _tiles_x;                   // Tile columns.
+    int _tiles_y;                   // Tile rows.
+    std::vector<TilePtr> _tiles;    // Row-major tile grid.
+};
+
+// Publishes snapshots of a map written by one thread to any number of reader threads.
+// publish() is called by the writer between updates, readers call snapshot() and keep the returned
+// pointer for as long as they need a consistent view. Neither side waits for a copy of the other:
+// only tiles overlapping the dirty regions of the map since the last publish are copied, the others
+// are shared with the previous snapshot. A window shift or resize republishes every tile.
+template <typename CellT = GridCell>
+class BasicGridSnapshotPublisher
+{
+public:
+    typedef BasicGridSnapshot<CellT> Snapshot;
+    typedef typename Snapshot::Tile Tile;
+    typedef typename Snapshot::TilePtr TilePtr;
+
+    BasicGridSnapshotPublisher()
+    {
+        _sequence = 0;
+        _copied_tiles = 0;
+        _last_epoch = 0;
+        _last_shift_x = 0;
+        _last_shift_y = 0;
+    }
+
+    // Returns the latest published snapshot, null before the first publish. Safe from any thread.
+    std::shared_ptr<const Snapshot> snapshot() const
+    {
+        return std::atomic_load(&_latest);
+    }
+
+    // Publishes the current state of map. Must be called from the thread writing the map.
+    std::shared_ptr<const Snapshot> publish(const BasicGridMap<CellT>& map)
+    {
+        const GridDirtyTracker& dirty = map.dirty();
+        std::shared_ptr<const Snapshot> prev = std::atomic_load(&_latest);
+        bool reuse = prev != nullptr && prev->width() == map.width() && prev->height() == map.height()
+            && dirty.shift_x() == _last_shift_x && dirty.shift_y() == _last_shift_y;
+
+        std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>();
+        next->_resolution = map.resolution();
+        next->_width = map.width();
+        next->_height = map.height();
+        next->_origin = map.origin();
+        next->_sequence = ++_sequence;
+        next->_tiles_x = (map.width() + SNAPSHOT_TILE - 1) / SNAPSHOT_TILE;
+        next->_tiles_y = (map.height() + SNAPSHOT_TILE - 1) / SNAPSHOT_TILE;
+
+        uint32_t now = dirty.checkpoint();
+        _copied_tiles = 0;
+        if (reuse) {
+            next->_tiles = prev->_tiles;
+            std::vector<bool> copied(next->_tiles.size(), false);
+            dirty.for_each_changed(_last_epoch, [&](const GridRegion& region) {
+                for (int ty = region.y_begin / SNAPSHOT_TILE; ty <= (region.y_end - 1) / SNAPSHOT_TILE; ty++) {
+                    for (int tx = region.x_begin / SNAPSHOT_TILE; tx <= (region.x_end - 1) / SNAPSHOT_TILE; tx++) {
+                        int i = ty * next->_tiles_x + tx;
+                        if (!copied[i]) {
+                            next->_tiles[i] = copy_tile(map, tx, ty);
+                            copied[i] = true;
+                            _copied_tiles++;
+                        }
+                    }
+                }
+            });
+        } else {
+            next->_tiles.resize(next->_tiles_x * next->_tiles_y);
+            for (int ty = 0; ty < next->_tiles_y; ty++) {
+                for (int tx = 0; tx < next->_tiles_x; tx++) {
+                    next->_tiles[ty * next->_tiles_x + tx] = copy_tile(map, tx, ty);
+                    _copied_tiles++;
+                }
+            }
+        }
+        _last_epoch = now;
+        _last_shift_x = dirty.shift_x();
+        _last_shift_y = dirty.shift_y();
+
+        std::shared_ptr<const Snapshot> result = next;
+        std::atomic_store(&_latest, result);
+        return result;
+    }
+
+    // Number of tiles copied by the last publish.
+    int copied_tiles() const { return _copied_tiles; }
+
+private:
+    std::shared_ptr<const Snapshot> _latest;
+    uint64_t _sequence;
+    int _copied_tiles;
+    uint32_t _last_epoch;           // Dirty epoch covered by the latest snapshot.
+    long long _last_shift_x;        // Window shift of the latest snapshot.
+    long long _last_shift_y;
+
+    static TilePtr copy_tile(const BasicGridMap<CellT>& map, int tx, int ty)
+    {
+        std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+        BasicGridMap<CellT>::fill_prior(tile->cells, SNAPSHOT_TILE * SNAPSHOT_TILE);
+        GridRegion region;
+        region.x_begin = tx * SNAPSHOT_TILE;
+        region.y_begin = ty * SNAPSHOT_TILE;
+        region.x_end = std::min(region.x_begin + SNAPSHOT_TILE, map.width());
+        region.y_end = std::min(region.y_begin + SNAPSHOT_TILE, map.height());
+        map.for_each_run(region, [&](const CellT* cell, int x, int y, int run) {
+            CellT* dst = &tile->cells[(y - region.y_begin) * SNAPSHOT_TILE + x - region.x_begin];
+            std::memcpy(dst, cell, sizeof(CellT) * run);
+        });
+        return tile;
+    }
+};
+
+typedef BasicGridSnapshot<GridCell> GridSnapshot;
+typedef BasicGridSnapshotPublisher<GridCell> GridSnapshotPublisher;
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "grid_cell.h"
+#include "grid_map.h"
+#include "grid_sensor.h"
+#include "grid_simd.h"
+
+// Default parameter values.
+const int SPARSE_CHUNK_SHIFT = 6;
+const int SPARSE_CHUNK = 1 << SPARSE_CHUNK_SHIFT;                // Chunk edge, 64cells * 0.1m/cell = 6.4m.
+const size_t DEFAULT_SPARSE_MEMORY_BUDGET = 16 << 20;            // 16MB, 1024 float chunks.
+
+// Unbounded occupancy grid map made of SPARSE_CHUNK x SPARSE_CHUNK chunks allocated on demand.
+// Cell indices are global, cell (0, 0) has its left-down corner at origin and indices may be negative,
+// so the map never shifts and memory scales with the observed area. When the memory budget is
+// exceeded the least recently used chunks are evicted, an eviction callback may persist them.
+// References to cells stay valid until the next chunk allocation.
+template <typename CellT = GridCell>
+class BasicSparseGridMap
+{
+public:
+    typedef typename CellT::value_type value_type;
+
+    struct Chunk
+    {
+        CellT cells[SPARSE_CHUNK * SPARSE_CHUNK];       // Row-major inside the chunk.
+        int chunk_x;                                    // Chunk index, cell (chunk_x * SPARSE_CHUNK, ...) is its first cell.
+        int chunk_y;
+        std::list<uint64_t>::iterator lru_pos;
+    };
+
+    typedef std::function<void(const Chunk&)> EvictionCallback;
+
+    BasicSparseGridMap(float resolution = RESOLUTION,
+        size_t memory_budget = DEFAULT_SPARSE_MEMORY_BUDGET,
+        const Eigen::Vector2d & origin = Eigen::Vector2d(0.0, 0.0))
+    {
+        _resolution = resolution;
+        _memory_budget = memory_budget;
+        _origin = origin;
+        _last_key = 0;
+        _last_chunk = nullptr;
+        _evictions = 0;
+    }
+
+    BasicSparseGridMap(const BasicSparseGridMap&) = delete;
+    BasicSparseGridMap& operator=(const BasicSparseGridMap&) = delete;
+
+    float resolution() const { return _resolution; }
+    Eigen::Vector2d origin() const { return _origin; }
+    size_t memory_budget() const { return _memory_budget; }
+    size_t chunk_count() const { return _chunks.size(); }
+    size_t memory_usage() const { return _chunks.size() * chunk_bytes(); }
+    size_t evictions() const { return _evictions; }
+
+    void set_memory_budget(size_t memory_budget)
+    {
+        _memory_budget = memory_budget;
+        evict_to_budget(0);
+    }
+
+    void set_eviction_callback(const EvictionCallback& callback)
+    {
+        _eviction_callback = callback;
+    }
+
+    // Cell (idx_x, idx_y), its chunk is allocated with prior cells if it was not observed yet.
+    CellT& operator()(int idx_x, int idx_y)
+    {
+        Chunk& chunk = chunk_at(idx_x >> SPARSE_CHUNK_SHIFT, idx_y >> SPARSE_CHUNK_SHIFT);
+        return chunk.cells[(idx_y & (SPARSE_CHUNK - 1)) * SPARSE_CHUNK + (idx_x & (SPARSE_CHUNK - 1))];
+    }
+
+    // Cell (idx_x, idx_y) or null if its chunk is not allocated, does not touch the LRU order.
+    const CellT* find(int idx_x, int idx_y) const
+    {
+        auto found = _chunks.find(make_key(idx_x >> SPARSE_CHUNK_SHIFT, idx_y >> SPARSE_CHUNK_SHIFT));
+        if (found == _chunks.end()) return nullptr;
+        return &found->second->cells[(idx_y & (SPARSE_CHUNK - 1)) * SPARSE_CHUNK + (idx_x & (SPARSE_CHUNK - 1))];
+    }
+
+    bool is_allocated(const int idx_x, const int idx_y) const
+    {
+        return find(idx_x, idx_y) != nullptr;
+    }
+
+    // The return value tells whether the cell was observed, the indices are valid either way.
+    bool idx_to_xy(const int idx_x, const int idx_y, double &x, double &y) const
+    {
+        x = _origin.x() + _resolution * (idx_x + 0.5);
+        y = _origin.y() + _resolution * (idx_y + 0.5);
+        return is_allocated(idx_x, idx_y);
+    }
+
+    bool xy_to_idx(const double x, const double y, int &idx_x, int &idx_y) const
+    {
+        idx_x = static_cast<int>(std::floor((x - _origin.x()) / _resolution));
+        idx_y = static_cast<int>(std::floor((y - _origin.y()) / _resolution));
+        return is_allocated(idx_x, idx_y);
+    }
+
+    bool pos_to_idx(const Eigen::Vector3d & pos, int &idx_x, int &idx_y) const
+    {
+        return xy_to_idx(pos.x(), pos.y(), idx_x, idx_y);
+    }
+
+    bool idx_to_pos(const int idx_x, const int idx_y, Eigen::Vector3d &pos) const
+    {
+        pos.setZero();
+        return idx_to_xy(idx_x, idx_y, pos.x(), pos.y());
+    }
+
+    // Sparse counterpart of BasicGridSensor::integrate_echo, the cone is rasterized once in a window
+    // around the sensor and applied as contiguous chunk row runs.
+    void integrate_echo(const BasicGridSensor<CellT>& sensor, const Eigen::Vector3d & sensor_pose,
+        float range, float fov, float max_range)
+    {
+        const double inv_res = 1.0 / _resolution;
+        const double px = (sensor_pose.x() - _origin.x()) * inv_res;
+        const double py = (sensor_pose.y() - _origin.y()) * inv_res;
+        const int r = static_cast<int>(std::ceil(max_range * inv_res)) + 1;
+        const int base_x = static_cast<int>(std::floor(px)) - r;
+        const int base_y = static_cast<int>(std::floor(py)) - r;
+
+        BasicGridSensor<CellT>::rasterize_cone(px - base_x, py - base_y, sensor_pose.z(), range * inv_res, fov,
+            max_range * inv_res, 2 * r + 1, 2 * r + 1,
+            [&](int idx_y, int x_begin, int x_end, bool is_hit) {
+                value_type increment = is_hit ? sensor._hit_increment : sensor._miss_increment;
+                int y = base_y + idx_y;
+                int x = base_x + x_begin;
+                int end = base_x + x_end;
+                while (x < end) {
+                    int run = std::min(end - x, SPARSE_CHUNK - (x & (SPARSE_CHUNK - 1)));
+                    GridKernel::saturating_add(&(*this)(x, y)._log_odds_val, run, increment);
+                    x += run;
+                }
+            });
+    }
+
+    // Calls fn(const Chunk&) for every allocated chunk, in no particular order.
+    template <typename ChunkFn>
+    void for_each_chunk(ChunkFn fn) const
+    {
+        for (const auto& entry : _chunks) {
+            fn(*entry.second);
+        }
+    }
+
+    void clear()
+    {
+        _chunks.clear();
+        _lru.clear();
+        _last_chunk = nullptr;
+    }
+
+    static size_t chunk_bytes()
+    {
+        // The chunk plus the hash map node and the LRU list node.
+        return sizeof(Chunk) + 2 * sizeof(void*) + sizeof(uint64_t) + sizeof(std::unique_ptr<Chunk>)
+            + 3 * sizeof(void*) + sizeof(uint64_t);
+    }
+
+private:
+    float _resolution;                                          // The map resolution [m/cell].
+    size_t _memory_budget;                                      // Upper bound of memory_usage() [bytes].
+    Eigen::Vector2d _origin;                                    // Left-down corner of cell (0, 0) [m, m].
+    std::unordered_map<uint64_t, std::unique_ptr<Chunk> > _chunks;
+    std::list<uint64_t> _lru;                                   // Chunk keys, most recently used first.
+    uint64_t _last_key;                                         // The last chunk accessed, skips the lookup
+    Chunk* _last_chunk;                                         // for consecutive cells of one chunk.
+    size_t _evictions;
+    EvictionCallback _eviction_callback;
+
+    static uint64_t make_key(int chunk_x, int chunk_y)
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(chunk_x)) << 32) | static_cast<uint32_t>(chunk_y);
+    }
+
+    Chunk& chunk_at(int chunk_x, int chunk_y)
+    {
+        uint64_t key = make_key(chunk_x, chunk_y);
+        if (_last_chunk != nullptr && key == _last_key) {
+            return *_last_chunk;
+        }
+
+        auto found = _chunks.find(key);
+        Chunk* chunk = nullptr;
+        if (found != _chunks.end()) {
+            chunk = found->second.get();
+            _lru.splice(_lru.begin(), _lru, chunk->lru_pos);
+        } else {
+            evict_to_budget(chunk_bytes());
+            std::unique_ptr<Chunk> created(new Chunk);
+            BasicGridMap<CellT>::fill_prior(created->cells, SPARSE_CHUNK * SPARSE_CHUNK);
+            created->chunk_x = chunk_x;
+            created->chunk_y = chunk_y;
+            _lru.push_front(key);
+            created->lru_pos = _lru.begin();
+            chunk = created.get();
+            _chunks.emplace(key, std::move(created));
+        }
+        _last_key = key;
+        _last_chunk = chunk;
+        return *chunk;
+    }
+
+    // Evicts least recently used chunks until extra_bytes more fit into the budget.
+    void evict_to_budget(size_t extra_bytes)
+    {
+        while (!_lru.empty() && memory_usage() + extra_bytes > _memory_budget) {
+            uint64_t key = _lru.back();
+            auto found = _chunks.find(key);
+            if (_eviction_callback) {
+                _eviction_callback(*found->second);
+            }
+            if (found->second.get() == _last_chunk) {
+                _last_chunk = nullptr;
+            }
+            _chunks.erase(found);
+            _lru.pop_back();
+            _evictions++;
+        }
+    }
+};
+
+typedef BasicSparseGridMap<GridCell> SparseGridMap;
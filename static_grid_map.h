@@ -0,0 +1,276 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#include "grid_bitmask.h"
+#include "grid_cell.h"
+#include "grid_dirty.h"
+#include "grid_map.h"
+#include "grid_simd.h"
+
+// Occupancy grid map with its geometry fixed at compile time, W x H cells of ResMm millimeters.
+// The resolution is given in millimeters because a float is not a template argument before C++20.
+// The cells are a member array in row-major order, so a map placed in static storage or on the stack
+// never touches the heap, and the index math folds into constant multiplies, shifts for power of two
+// sizes. There is no dirty tracking, rolling mode or tiled layout, use BasicGridMap for those and for
+// geometries configured at runtime.
+template <int W, int H, int ResMm = 100, typename CellT = GridCell>
+class StaticGridMap
+{
+public:
+    typedef CellT cell_type;
+    typedef typename CellT::value_type value_type;
+
+    static_assert(W > EXT_ZONE && H > EXT_ZONE, "The map must be larger than the extension zone.");
+    static_assert(ResMm > 0, "The resolution must be positive.");
+    static_assert(std::is_trivially_copyable<CellT>::value, "Maps are copied with memcpy.");
+
+    static constexpr int WIDTH_CELLS = W;
+    static constexpr int HEIGHT_CELLS = H;
+    static constexpr int SIZE = W * H;
+    static constexpr float RESOLUTION_M = ResMm * 0.001f;
+    static constexpr double INV_RESOLUTION = 1000.0 / ResMm;
+
+private:
+    Eigen::Vector2d _origin;            // The real-world position of the left-down of cell (0,0) [m, m].
+    alignas(64) CellT _map_data[SIZE];  // Row-major, width priority.
+
+public:
+    StaticGridMap(const Eigen::Vector3d & center_pos = Eigen::Vector3d(0.0, 0.0, 0.0))
+    {
+        reset_map(center_pos);
+    }
+
+    static constexpr float resolution() { return RESOLUTION_M; }
+    static constexpr int width() { return W; }
+    static constexpr int height() { return H; }
+    static constexpr int storage_size() { return SIZE; }
+    Eigen::Vector2d origin() const { return _origin; }
+    CellT* data() { return _map_data; }
+    const CellT* data() const { return _map_data; }
+
+    static constexpr int index_map(int idx_x, int idx_y)
+    {
+        return idx_y * W + idx_x;
+    }
+
+    static void index_map(int idx, int & idx_x, int & idx_y)
+    {
+        idx_y = idx / W;
+        idx_x = idx - idx_y * W;
+    }
+
+    CellT& operator()(int idx_x, int idx_y)
+    {
+        return _map_data[index_map(idx_x, idx_y)];
+    }
+
+    const CellT& operator()(int idx_x, int idx_y) const
+    {
+        return _map_data[index_map(idx_x, idx_y)];
+    }
+
+    CellT& operator()(int idx)
+    {
+        return _map_data[idx];
+    }
+
+    const CellT& operator()(int idx) const
+    {
+        return _map_data[idx];
+    }
+
+    void set_origin(const Eigen::Vector3d & pos)
+    {
+        _origin << pos.x() - RESOLUTION_M * W / 2,
+                   pos.y() - RESOLUTION_M * H / 2;
+    }
+
+    void set_origin(const Eigen::Vector2d & origin)
+    {
+        _origin = origin;
+    }
+
+    void reset_map_data()
+    {
+        BasicGridMap<CellT>::fill_prior(_map_data, SIZE);
+    }
+
+    void reset_map(const Eigen::Vector3d & pos)
+    {
+        set_origin(pos);
+        reset_map_data();
+    }
+
+    // Same as BasicGridMap::for_each_run, the rows of the region are single runs.
+    template <typename RunFn>
+    void for_each_run(const GridRegion& region, RunFn fn)
+    {
+        for (int y = region.y_begin; y < region.y_end; y++) {
+            fn(&(*this)(region.x_begin, y), region.x_begin, y, region.x_end - region.x_begin);
+        }
+    }
+
+    template <typename RunFn>
+    void for_each_run(const GridRegion& region, RunFn fn) const
+    {
+        for (int y = region.y_begin; y < region.y_end; y++) {
+            fn(&(*this)(region.x_begin, y), region.x_begin, y, region.x_end - region.x_begin);
+        }
+    }
+
+    void reset_region(int x_begin, int y_begin, int x_end, int y_end)
+    {
+        for (int y = y_begin; y < y_end; y++) {
+            BasicGridMap<CellT>::fill_prior(&(*this)(x_begin, y), x_end - x_begin);
+        }
+    }
+
+    // See BasicGridMap::update_region.
+    void update_region(int x_begin, int y_begin, int x_end, int y_end, value_type mea_log_odds,
+        const GridBitmask* mask = nullptr)
+    {
+        for (int y = y_begin; y < y_end; y++) {
+            const uint64_t* mask_row = mask != nullptr ? mask->row(y) : nullptr;
+            GridKernel::saturating_add(&(*this)(x_begin, y)._log_odds_val, x_end - x_begin, mea_log_odds,
+                mask_row, x_begin);
+        }
+    }
+
+    // See BasicGridMap::classify.
+    void classify(GridBitmask& occupied, GridBitmask& free) const
+    {
+        if (occupied.width() != W || occupied.height() != H) {
+            occupied.resize(W, H);
+        } else {
+            occupied.clear();
+        }
+        if (free.width() != W || free.height() != H) {
+            free.resize(W, H);
+        } else {
+            free.clear();
+        }
+
+        const value_type occupied_thre = CellT::log_odds_occupied_thre();
+        const value_type free_thre = CellT::log_odds_free_thre();
+        for (int y = 0; y < H; y++) {
+            GridKernel::classify(&(*this)(0, y)._log_odds_val, W, occupied_thre, free_thre,
+                occupied.row(y), free.row(y), 0);
+        }
+    }
+
+    static constexpr bool is_in_border(const int idx_x, const int idx_y)
+    {
+        return (idx_x >= 0 && idx_x < W && idx_y >= 0 && idx_y < H);
+    }
+
+    bool is_in_border(const double x, const double y) const
+    {
+        int idx_x = 0;
+        int idx_y = 0;
+        return xy_to_idx(x, y, idx_x, idx_y);
+    }
+
+    bool is_in_border(const Eigen::Vector3d & pos) const
+    {
+        return is_in_border(pos.x(), pos.y());
+    }
+
+    bool idx_to_xy(const int idx_x, const int idx_y, double &x, double &y) const
+    {
+        x = _origin.x() + RESOLUTION_M * (idx_x + 0.5);
+        y = _origin.y() + RESOLUTION_M * (idx_y + 0.5);
+        return is_in_border(idx_x, idx_y);
+    }
+
+    // Same truncation as BasicGridMap::xy_to_idx, with a multiply by the constant inverse resolution.
+    // The inverse is exact in millimeters, so a position within float rounding of a cell edge may fall
+    // into the neighbor of the cell a BasicGridMap with resolution 0.1f picks.
+    bool xy_to_idx(const double x, const double y, int &idx_x, int &idx_y) const
+    {
+        idx_x = (x - _origin.x()) * INV_RESOLUTION;
+        idx_y = (y - _origin.y()) * INV_RESOLUTION;
+        if (is_in_border(idx_x, idx_y)) {
+            return true;
+        } else {
+            idx_x = std::max(0, std::min(idx_x, W - 1));
+            idx_y = std::max(0, std::min(idx_y, H - 1));
+            return false;
+        }
+    }
+
+    bool pos_to_idx(const Eigen::Vector3d & pos, int &idx_x, int &idx_y) const
+    {
+        return xy_to_idx(pos.x(), pos.y(), idx_x, idx_y);
+    }
+
+    bool idx_to_pos(const int idx_x, const int idx_y, Eigen::Vector3d &pos) const
+    {
+        pos.setZero();
+        return idx_to_xy(idx_x, idx_y, pos.x(), pos.y());
+    }
+
+    uint8_t is_in_ext_zone(const Eigen::Vector3d & pos) const
+    {
+        uint8_t ext_zone_type = ExtZoneType::NONE;
+        int idx_x = 0;
+        int idx_y = 0;
+        if (pos_to_idx(pos, idx_x, idx_y)) {
+            if (idx_x < EXT_ZONE) {
+                ext_zone_type |= ExtZoneType::LEFT;
+            }
+            if (idx_x >= (W - EXT_ZONE)) {
+                ext_zone_type |= ExtZoneType::RIGHT;
+            }
+            if (idx_y < EXT_ZONE) {
+                ext_zone_type |= ExtZoneType::DOWN;
+            }
+            if (idx_y >= (H - EXT_ZONE)) {
+                ext_zone_type |= ExtZoneType::TOP;
+            }
+        }
+        return ext_zone_type;
+    }
+
+    // See BasicGridMap::extend_map.
+    void extend_map(uint8_t ext_zone_type)
+    {
+        BasicGridMap<CellT>::extension_shifts(ext_zone_type, [this](int dx, int dy) { shift_map(dx, dy); });
+    }
+
+    // See BasicGridMap::shift_map, each row is moved with one memmove.
+    void shift_map(int dx, int dy)
+    {
+        if (dx == 0 && dy == 0)
+            return;
+
+        _origin.x() += dx * RESOLUTION_M;
+        _origin.y() += dy * RESOLUTION_M;
+        if (std::abs(dx) >= W || std::abs(dy) >= H) {
+            reset_map_data();
+            return;
+        }
+        BasicGridMap<CellT>::shift_rows(_map_data, W, H, dx, dy, [](CellT* cell, int size) {
+            BasicGridMap<CellT>::fill_prior(cell, size);
+        });
+    }
+};
+
+template <int W, int H, int ResMm, typename CellT>
+constexpr int StaticGridMap<W, H, ResMm, CellT>::WIDTH_CELLS;
+template <int W, int H, int ResMm, typename CellT>
+constexpr int StaticGridMap<W, H, ResMm, CellT>::HEIGHT_CELLS;
+template <int W, int H, int ResMm, typename CellT>
+constexpr int StaticGridMap<W, H, ResMm, CellT>::SIZE;
+template <int W, int H, int ResMm, typename CellT>
+constexpr float StaticGridMap<W, H, ResMm, CellT>::RESOLUTION_M;
+template <int W, int H, int ResMm, typename CellT>
+constexpr double StaticGridMap<W, H, ResMm, CellT>::INV_RESOLUTION;
+
+// The default geometry of GridMap, WIDTH x HEIGHT cells of RESOLUTION.
+typedef StaticGridMap<WIDTH, HEIGHT, 100> DefaultStaticGridMap;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks of the regression tests, one executable per area run by ctest. A failed check
+// prints its location and the executable returns non-zero, the remaining checks still run.
+inline int& grid_test_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define GRID_CHECK(condition)                                                                   \
+    do {                                                                                        \
+        if (!(condition)) {                                                                     \
+            std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n";    \
+            grid_test_failures()++;                                                             \
+        }                                                                                       \
+    } while (0)
+
+#define GRID_CHECK_EQ(a, b)                                                                     \
+    do {                                                                                        \
+        if (!((a) == (b))) {                                                                    \
+            std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #a " == " #b        \
+                << " (" << (a) << " vs " << (b) << ")\n";                                       \
+            grid_test_failures()++;                                                             \
+        }                                                                                       \
+    } while (0)
+
+inline int grid_test_result()
+{
+    if (grid_test_failures() != 0) {
+        std::cout << grid_test_failures() << " checks failed\n";
+    }
+    return grid_test_failures() != 0;
+}
@@ -0,0 +1,194 @@
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "grid_delta.h"
+#include "grid_map.h"
+#include "grid_sensor.h"
+#include "grid_test.h"
+
+const float TEST_QUANT_STEP = 0.5f;
+
+static GridDeltaHeader read_header(const std::vector<uint8_t>& message)
+{
+    GridDeltaHeader header;
+    std::memcpy(&header, message.data(), sizeof(header));
+    return header;
+}
+
+static void write_header(std::vector<uint8_t>& message, const GridDeltaHeader& header)
+{
+    std::memcpy(message.data(), &header, sizeof(header));
+}
+
+static bool apply(GridDeltaDecoder& decoder, const std::vector<uint8_t>& message, GridMap& map)
+{
+    return decoder.apply(message.data(), message.size(), map);
+}
+
+// Log odds the receiver holds for a sender cell, see BasicGridDeltaEncoder.
+static float quantized(float log_odds)
+{
+    const float q = std::max(-127.0f, std::min(127.0f, std::nearbyint(log_odds / TEST_QUANT_STEP)));
+    return std::max(-LOG_ODDS_LIMIT, std::min(LOG_ODDS_LIMIT, q * TEST_QUANT_STEP));
+}
+
+static void integrate_random_echoes(GridMap& map, GridSensor& sensor, std::mt19937& rng)
+{
+    for (int e = 0; e < 12; e++) {
+        const Eigen::Vector3d pose(map.origin().x() + 10.0 + (rng() % 50) * 0.1,
+            map.origin().y() + 7.0 + (rng() % 30) * 0.1, (rng() % 628) * 0.01);
+        sensor.integrate_echo(map, pose, 0.3f + (rng() % 300) * 0.01f, 0.5f, 4.0f);
+    }
+}
+
+// Every message of a shifting rolling sender applies, the receiver then holds the quantized cells
+// and the origin of the sender.
+static void test_round_trip()
+{
+    std::mt19937 rng(11);
+    GridMap sender(RESOLUTION, 200, 150, Eigen::Vector3d::Zero());
+    GRID_CHECK(sender.set_rolling(true));
+    GridMap receiver(RESOLUTION, 10, 10, Eigen::Vector3d::Zero());
+    GridSensor sensor;
+    GridDeltaEncoder encoder(TEST_QUANT_STEP, 10);
+    GridDeltaDecoder decoder;
+    std::vector<uint8_t> message;
+    int failed = 0;
+    int keyframes = 0;
+    for (int frame = 0; frame < 200; frame++) {
+        integrate_random_echoes(sender, sensor, rng);
+        if (frame % 3 == 0) {
+            sender.shift_map(static_cast<int>(rng() % 7) - 3, static_cast<int>(rng() % 7) - 3);
+        }
+        keyframes += encoder.encode(sender, message);
+        failed += !apply(decoder, message, receiver);
+
+        int mismatches = 0;
+        for (int y = 0; y < sender.height(); y++) {
+            for (int x = 0; x < sender.width(); x++) {
+                mismatches += receiver(x, y).log_odds() != quantized(sender(x, y).log_odds());
+            }
+        }
+        failed += mismatches != 0 || (receiver.origin() - sender.origin()).norm() > 1e-9;
+    }
+    GRID_CHECK_EQ(failed, 0);
+    GRID_CHECK_EQ(keyframes, 20);
+    GRID_CHECK_EQ(decoder.sequence(), 200u);
+}
+
+// Stale, partial, oversized and malformed messages are refused and leave the decoder state as is.
+static void test_refused_messages()
+{
+    std::mt19937 rng(13);
+    GridMap sender(RESOLUTION, 120, 90, Eigen::Vector3d::Zero());
+    GridMap receiver(RESOLUTION, 10, 10, Eigen::Vector3d::Zero());
+    GridSensor sensor;
+    GridDeltaEncoder encoder(TEST_QUANT_STEP, 100);
+    GridDeltaDecoder decoder;
+    std::vector<uint8_t> first_keyframe;
+    std::vector<uint8_t> message;
+    integrate_random_echoes(sender, sensor, rng);
+    GRID_CHECK(encoder.encode(sender, first_keyframe));
+    GRID_CHECK(apply(decoder, first_keyframe, receiver));
+    for (int frame = 0; frame < 3; frame++) {
+        integrate_random_echoes(sender, sensor, rng);
+        GRID_CHECK(!encoder.encode(sender, message));
+        GRID_CHECK(apply(decoder, message, receiver));
+    }
+    const uint32_t sequence = decoder.sequence();
+
+    // A replayed message, keyframe or not, is older than the state.
+    GRID_CHECK(!apply(decoder, first_keyframe, receiver));
+    GRID_CHECK(!apply(decoder, message, receiver));
+    GRID_CHECK_EQ(decoder.sequence(), sequence);
+
+    encoder.request_keyframe();
+    GRID_CHECK(encoder.encode(sender, message));
+    std::vector<uint8_t> broken = message;
+    GridDeltaHeader header = read_header(message);
+    header.regions = 2;
+    write_header(broken, header);
+    GRID_CHECK(!apply(decoder, broken, receiver));
+
+    header = read_header(message);
+    header.width = 1 << 20;
+    header.height = 1 << 20;
+    write_header(broken, header);
+    GRID_CHECK(!apply(decoder, broken, receiver));
+
+    header = read_header(message);
+    header.resolution = NAN;
+    write_header(broken, header);
+    GRID_CHECK(!apply(decoder, broken, receiver));
+
+    // A keyframe region short of the map.
+    broken = message;
+    GridDeltaRegion region;
+    std::memcpy(&region, broken.data() + sizeof(GridDeltaHeader), sizeof(region));
+    region.x_end--;
+    std::memcpy(broken.data() + sizeof(GridDeltaHeader), &region, sizeof(region));
+    GRID_CHECK(!apply(decoder, broken, receiver));
+    GRID_CHECK_EQ(decoder.sequence(), sequence);
+    GRID_CHECK(apply(decoder, message, receiver));
+
+    // A delta shifting by more than the map.
+    sender.update_region(3, 3, 9, 9, 1.0f);
+    GRID_CHECK(!encoder.encode(sender, message));
+    broken = message;
+    header = read_header(message);
+    header.shift_x = INT32_MIN;
+    write_header(broken, header);
+    const uint32_t before_delta = decoder.sequence();
+    GRID_CHECK(!apply(decoder, broken, receiver));
+    GRID_CHECK_EQ(decoder.sequence(), before_delta);
+    GRID_CHECK(apply(decoder, message, receiver));
+
+    // The stream of a restarted encoder applies after reset.
+    GridDeltaEncoder restarted(TEST_QUANT_STEP);
+    GRID_CHECK(restarted.encode(sender, message));
+    GRID_CHECK(!apply(decoder, message, receiver));
+    decoder.reset();
+    GRID_CHECK(apply(decoder, message, receiver));
+    GRID_CHECK_EQ(decoder.sequence(), 1u);
+}
+
+// Corrupted and truncated messages never write outside the map, run it under ASAN and UBSAN.
+static void test_corrupted_messages()
+{
+    std::mt19937 rng(17);
+    GridMap sender(RESOLUTION, 60, 40, Eigen::Vector3d::Zero());
+    GridSensor sensor;
+    integrate_random_echoes(sender, sensor, rng);
+    GridDeltaEncoder encoder(TEST_QUANT_STEP);
+    std::vector<uint8_t> message;
+    encoder.encode(sender, message);
+    for (int t = 0; t < 2000; t++) {
+        std::vector<uint8_t> corrupted = message;
+        const int flips = 1 + rng() % 4;
+        for (int i = 0; i < flips; i++) {
+            corrupted[rng() % corrupted.size()] ^= static_cast<uint8_t>(1u << (rng() % 8));
+        }
+        if (rng() % 4 == 0) {
+            corrupted.resize(rng() % (corrupted.size() + 1));
+        }
+        GridDeltaDecoder decoder;
+        GridMap receiver(RESOLUTION, 10, 10, Eigen::Vector3d::Zero());
+        if (decoder.apply(corrupted.data(), corrupted.size(), receiver)) {
+            const GridDeltaHeader header = read_header(corrupted);
+            GRID_CHECK_EQ(receiver.width() * receiver.height(), header.width * header.height);
+        }
+    }
+}
+
+int main()
+{
+    test_round_trip();
+    test_refused_messages();
+    test_corrupted_messages();
+    return grid_test_result();
+}
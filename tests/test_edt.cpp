@@ -0,0 +1,124 @@
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "grid_edt.h"
+#include "grid_map.h"
+#include "grid_test.h"
+
+const int TEST_WIDTH = 97;
+const int TEST_HEIGHT = 83;
+
+// Checks every cell of field against the nearest occupied cell of map found by brute force. The
+// brushfire may hand a cell over to a marginally farther obstacle, see BasicGridDistanceField, so
+// the squared distance may exceed the exact one by 2% plus one cell. Returns the bad cells.
+static int check_field(const GridDistanceField& field, const GridMap& map)
+{
+    std::vector<std::pair<int, int> > obstacles;
+    for (int y = 0; y < map.height(); y++) {
+        for (int x = 0; x < map.width(); x++) {
+            if (map(x, y).is_occupied()) obstacles.push_back(std::make_pair(x, y));
+        }
+    }
+    int bad = 0;
+    for (int y = 0; y < map.height(); y++) {
+        for (int x = 0; x < map.width(); x++) {
+            int32_t best = GridDistanceField::INF_SQ_DIST;
+            for (const auto& obstacle : obstacles) {
+                const int32_t ox = obstacle.first - x;
+                const int32_t oy = obstacle.second - y;
+                best = std::min(best, ox * ox + oy * oy);
+            }
+            const int32_t d = field.squared_distance(x, y);
+            if (d != best && (best == GridDistanceField::INF_SQ_DIST || d == GridDistanceField::INF_SQ_DIST
+                || d > best * 1.02 + 1 || d < best)) {
+                bad++;
+            }
+            const int32_t nearest = field.nearest_obstacle(x, y);
+            if (nearest != GridDistanceField::NO_OBSTACLE) {
+                const int nx = nearest % map.width();
+                const int ny = nearest / map.width();
+                bad += !map(nx, ny).is_occupied() || (nx - x) * (nx - x) + (ny - y) * (ny - y) != d;
+            }
+        }
+    }
+    return bad;
+}
+
+// The incremental field, updated after random obstacle changes, shifts and resets of the map in
+// every storage mode, stays within the brushfire tolerance of the brute force distances.
+static void test_incremental_matches_brute_force()
+{
+    std::mt19937 rng(5);
+    for (int mode = 0; mode < 3; mode++) {
+        GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+        if (mode == 1) GRID_CHECK(map.set_rolling(true));
+        if (mode == 2) GRID_CHECK(map.set_layout(GridLayout::TILED));
+        GridDistanceField field(1);
+        field.update(map);
+        int bad = 0;
+        for (int it = 0; it < 150; it++) {
+            const int changes = rng() % 6;
+            for (int k = 0; k < changes; k++) {
+                const int x = rng() % TEST_WIDTH;
+                const int y = rng() % TEST_HEIGHT;
+                const int x_end = std::min(TEST_WIDTH, x + 1 + static_cast<int>(rng() % 4));
+                const int y_end = std::min(TEST_HEIGHT, y + 1 + static_cast<int>(rng() % 4));
+                map.update_region(x, y, x_end, y_end, (rng() % 3) ? 3.0f : -6.0f);
+            }
+            const int step = rng() % 10;
+            if (step < 6) {
+                map.shift_map(static_cast<int>(rng() % 15) - 7, static_cast<int>(rng() % 15) - 7);
+            } else if (step == 6 && rng() % 4 == 0) {
+                map.reset_map(Eigen::Vector3d::Zero());
+            }
+            field.update(map);
+            bad += check_field(field, map);
+        }
+        GRID_CHECK_EQ(bad, 0);
+    }
+}
+
+// A full rebuild, forced with mark_all, gives the exact distances.
+static void test_rebuild_is_exact()
+{
+    std::mt19937 rng(7);
+    GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+    for (int k = 0; k < 40; k++) {
+        const int x = rng() % (TEST_WIDTH - 2);
+        const int y = rng() % (TEST_HEIGHT - 2);
+        map.update_region(x, y, x + 2, y + 2, 3.0f);
+    }
+    GridDistanceField field(2);
+    field.update(map);
+    const size_t rebuilds = field.rebuilds();
+    map.dirty().mark_all();
+    field.update(map);
+    GRID_CHECK_EQ(field.rebuilds(), rebuilds + 1);
+
+    int inexact = 0;
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            int32_t best = GridDistanceField::INF_SQ_DIST;
+            for (int oy = 0; oy < TEST_HEIGHT; oy++) {
+                for (int ox = 0; ox < TEST_WIDTH; ox++) {
+                    if (map(ox, oy).is_occupied()) {
+                        best = std::min(best, (ox - x) * (ox - x) + (oy - y) * (oy - y));
+                    }
+                }
+            }
+            inexact += field.squared_distance(x, y) != best;
+        }
+    }
+    GRID_CHECK_EQ(inexact, 0);
+}
+
+int main()
+{
+    test_incremental_matches_brute_force();
+    test_rebuild_is_exact();
+    return grid_test_result();
+}
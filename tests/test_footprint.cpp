@@ -0,0 +1,53 @@
+#include <Eigen/Core>
+#include <vector>
+
+#include "grid_footprint.h"
+#include "grid_map.h"
+#include "grid_sensor.h"
+#include "grid_test.h"
+
+static int changed_cells(const GridMap& map, const GridMap& before)
+{
+    int changed = 0;
+    for (int y = 0; y < map.height(); y++) {
+        for (int x = 0; x < map.width(); x++) {
+            changed += map(x, y).log_odds() != before(x, y).log_odds();
+        }
+    }
+    return changed;
+}
+
+// Echoes of registered sensors update the map, negative, out of range and unregistered ids are
+// refused without touching it, and lookup gives them an empty footprint.
+static void test_sensor_ids()
+{
+    GridSensor sensor;
+    BeamFootprintCache cache;
+    GRID_CHECK(!cache.set_sensor(-1, 0.5f, 4.0f));
+    GRID_CHECK(!cache.set_sensor(FOOTPRINT_MAX_SENSORS, 0.5f, 4.0f));
+    GRID_CHECK(cache.set_sensor(3, 0.5f, 4.0f));
+    GRID_CHECK(cache.has_sensor(3));
+    GRID_CHECK(!cache.has_sensor(0));
+    GRID_CHECK(!cache.has_sensor(-1));
+
+    GridMap map(RESOLUTION, WIDTH, HEIGHT, Eigen::Vector3d::Zero());
+    const GridMap empty = map;
+    const Eigen::Vector3d pose(1.0, -2.0, 0.4);
+    GRID_CHECK(cache.integrate_echo(map, sensor, 3, pose, 1.5f));
+    GRID_CHECK(changed_cells(map, empty) > 0);
+
+    const GridMap before = map;
+    const int invalid_ids[] = {-1, 0, 2, 4, 1000, FOOTPRINT_MAX_SENSORS};
+    for (int id : invalid_ids) {
+        GRID_CHECK(!cache.integrate_echo(map, sensor, id, pose, 1.5f));
+        GRID_CHECK(cache.lookup(sensor, id, 1.5f, pose.z(), map.resolution()).cells.empty());
+    }
+    GRID_CHECK_EQ(changed_cells(map, before), 0);
+    GRID_CHECK(!cache.lookup(sensor, 3, 1.5f, pose.z(), map.resolution()).cells.empty());
+}
+
+int main()
+{
+    test_sensor_ids();
+    return grid_test_result();
+}
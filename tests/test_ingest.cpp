@@ -0,0 +1,155 @@
+#include <Eigen/Core>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "grid_fusion.h"
+#include "grid_ingest.h"
+#include "grid_map.h"
+#include "grid_metrics.h"
+#include "grid_sensor.h"
+#include "grid_test.h"
+
+const int TEST_ECHOES = 3000;
+const double TEST_ECHO_PERIOD = 0.001;      // [s].
+
+static Eigen::Vector3d vehicle_pose(double stamp)
+{
+    return Eigen::Vector3d(2.0 * stamp, 1.0 * stamp, 0.3 * stamp);
+}
+
+// Echoes pushed by one thread and odometry by another, integrated by the worker, give the same map
+// bit for bit as one integrate_echoes pass with the poses interpolated from the same samples.
+// Build with -fsanitize=thread to check the queues and the per-thread metrics for races.
+static void test_threaded_ingest_is_bit_identical()
+{
+    GridSensor sensor;
+    GridMap map(RESOLUTION, WIDTH, HEIGHT, Eigen::Vector3d::Zero());
+    GridMap expected_map(RESOLUTION, WIDTH, HEIGHT, Eigen::Vector3d::Zero());
+    GridEchoIngest ingest(map, sensor, 4096, DEFAULT_INGEST_BATCH, 4096);
+    GridFrameFusion fusion(1);
+    // Even ids only, so the odd ones are gaps of the mount table.
+    for (int id = 0; id < 12; id += 2) {
+        const Eigen::Vector3d mount(std::cos(0.5 * id), std::sin(0.5 * id), 0.5 * id);
+        ingest.fusion().set_sensor(id, mount, 0.5f, 4.0f);
+        fusion.set_sensor(id, mount, 0.5f, 4.0f);
+    }
+
+    std::mt19937 rng(5);
+    std::vector<GridTimedEcho> echoes;
+    for (int i = 0; i < TEST_ECHOES; i++) {
+        echoes.push_back(GridTimedEcho{TEST_ECHO_PERIOD * (i + 0.5), static_cast<int>(rng() % 6) * 2,
+            0.3f + (rng() % 300) * 0.01f});
+    }
+    const int invalid_ids[] = {-1, 1, 11, 12, 1000};
+    int invalid_refused = 0;
+
+    ingest.start();
+    std::thread odometry([&] {
+        for (int i = 0; i <= TEST_ECHOES; i++) {
+            const GridOdometrySample sample = {TEST_ECHO_PERIOD * i, vehicle_pose(TEST_ECHO_PERIOD * i)};
+            while (!ingest.push_odometry(sample)) std::this_thread::yield();
+        }
+    });
+    std::thread producer([&] {
+        for (const GridTimedEcho& echo : echoes) {
+            while (!ingest.push_echo(echo)) std::this_thread::yield();
+        }
+        for (int id : invalid_ids) {
+            invalid_refused += !ingest.push_echo(GridTimedEcho{0.5, id, 1.0f});
+        }
+    });
+    // Instrumented code on this thread while the worker runs its own.
+    GRID_METRICS_ADD(echoes, 1);
+    producer.join();
+    odometry.join();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (ingest.stats().integrated + ingest.stats().dropped_stale < echoes.size()
+        && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ingest.stop();
+
+    const GridIngestStats stats = ingest.stats();
+    GRID_CHECK_EQ(stats.received, echoes.size() + 5);
+    GRID_CHECK_EQ(stats.integrated, echoes.size());
+    GRID_CHECK_EQ(stats.dropped_stale, 0u);
+    GRID_CHECK_EQ(stats.dropped_sensor, 5u);
+    GRID_CHECK_EQ(invalid_refused, 5);
+
+    GridOdometryHistory history(4096);
+    for (int i = 0; i <= TEST_ECHOES; i++) {
+        history.add(GridOdometrySample{TEST_ECHO_PERIOD * i, vehicle_pose(TEST_ECHO_PERIOD * i)});
+    }
+    std::vector<GridEcho> batch;
+    std::vector<Eigen::Vector3d> poses;
+    for (const GridTimedEcho& echo : echoes) {
+        Eigen::Vector3d pose;
+        GRID_CHECK(history.interpolate(echo.stamp, pose));
+        batch.push_back(GridEcho{echo.sensor_id, echo.range});
+        poses.push_back(pose);
+    }
+    fusion.integrate_echoes(expected_map, sensor, poses, batch);
+    int different = 0;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            different += std::memcmp(&map(x, y), &expected_map(x, y), sizeof(GridCell)) != 0;
+        }
+    }
+    GRID_CHECK_EQ(different, 0);
+}
+
+// integrate_frame skips the echoes of unregistered and negative ids, the other echoes give the same map
+// as a frame without them.
+static void test_fusion_skips_unregistered_sensors()
+{
+    GridSensor sensor;
+    GridFrameFusion fusion(2);
+    GRID_CHECK(!fusion.set_sensor(-1, Eigen::Vector3d::Zero(), 0.5f, 4.0f));
+    GRID_CHECK(fusion.set_sensor(0, Eigen::Vector3d(1.0, 0.0, 0.0), 0.5f, 4.0f));
+    GRID_CHECK(fusion.set_sensor(2, Eigen::Vector3d(0.0, 1.0, 1.5), 0.5f, 4.0f));
+    const Eigen::Vector3d vehicle(1.0, -2.0, 0.2);
+    const std::vector<GridEcho> valid = {{0, 1.5f}, {2, 2.0f}, {0, 0.8f}};
+    const std::vector<GridEcho> mixed = {{0, 1.5f}, {-5, 1.0f}, {2, 2.0f}, {1, 1.0f}, {0, 0.8f}, {1000, 1.0f}};
+    GridMap expected(RESOLUTION, 300, 200, Eigen::Vector3d::Zero());
+    GridMap map(RESOLUTION, 300, 200, Eigen::Vector3d::Zero());
+    GRID_CHECK(fusion.integrate_frame(expected, sensor, vehicle, valid));
+    GRID_CHECK(!fusion.integrate_frame(map, sensor, vehicle, mixed));
+    const GridMap empty(RESOLUTION, 300, 200, Eigen::Vector3d::Zero());
+    int different = 0;
+    int touched = 0;
+    for (int y = 0; y < map.height(); y++) {
+        for (int x = 0; x < map.width(); x++) {
+            different += map(x, y).log_odds() != expected(x, y).log_odds();
+            touched += map(x, y).log_odds() != empty(x, y).log_odds();
+        }
+    }
+    GRID_CHECK_EQ(different, 0);
+    GRID_CHECK(touched > 0);
+}
+
+// Odometry samples refused by a full queue are counted.
+static void test_odometry_drops_are_counted()
+{
+    GridSensor sensor;
+    GridMap map(RESOLUTION, 50, 50, Eigen::Vector3d::Zero());
+    GridEchoIngest ingest(map, sensor, 4, 4, 4);
+    int refused = 0;
+    for (int i = 0; i < 10; i++) {
+        refused += !ingest.push_odometry(GridOdometrySample{static_cast<double>(i), Eigen::Vector3d::Zero()});
+    }
+    GRID_CHECK_EQ(refused, 6);
+    GRID_CHECK_EQ(ingest.stats().dropped_odometry, 6u);
+}
+
+int main()
+{
+    test_threaded_ingest_is_bit_identical();
+    test_fusion_skips_unregistered_sensors();
+    test_odometry_drops_are_counted();
+    return grid_test_result();
+}
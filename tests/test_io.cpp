@@ -0,0 +1,93 @@
+#include <Eigen/Core>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "grid_io.h"
+#include "grid_map.h"
+#include "grid_test.h"
+
+const int TEST_WIDTH = 77;
+const int TEST_HEIGHT = 45;
+
+static GridMap make_test_map(GridLayout layout, bool rolling, std::mt19937& rng)
+{
+    GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+    GRID_CHECK(map.set_layout(layout));
+    GRID_CHECK(map.set_rolling(rolling));
+    map.shift_map(5, -3);
+    for (int k = 0; k < 50; k++) {
+        const int x = rng() % (TEST_WIDTH - 7);
+        const int y = rng() % (TEST_HEIGHT - 5);
+        map.update_region(x, y, x + 5, y + 3, (rng() % 2) ? 2.0f : -1.5f);
+    }
+    return map;
+}
+
+// A saved map loads back with its cells, layout and rolling mode, and the loaded cells are dirty.
+static void test_round_trip()
+{
+    std::mt19937 rng(2);
+    for (int mode = 0; mode < 8; mode++) {
+        const GridLayout layout = (mode & 1) ? GridLayout::TILED : GridLayout::ROW_MAJOR;
+        const bool rolling = (mode & 2) != 0;
+        const GridFileCompression compression = static_cast<GridFileCompression>((mode >> 2) & 1);
+        GridMap map = make_test_map(layout, rolling, rng);
+        std::vector<uint8_t> file;
+        serialize_grid_map(map, file, compression);
+
+        GridMap loaded(0.2f, 10, 10, Eigen::Vector3d::Zero());
+        const uint32_t epoch = loaded.dirty().epoch();
+        GRID_CHECK(deserialize_grid_map(file.data(), file.size(), loaded));
+        GRID_CHECK_EQ(loaded.width(), TEST_WIDTH);
+        GRID_CHECK_EQ(loaded.height(), TEST_HEIGHT);
+        GRID_CHECK(loaded.layout() == layout);
+        GRID_CHECK_EQ(loaded.is_rolling(), rolling);
+        GRID_CHECK(!loaded.dirty().changed(epoch - 1).empty());
+        int mismatches = 0;
+        for (int y = 0; y < TEST_HEIGHT; y++) {
+            for (int x = 0; x < TEST_WIDTH; x++) {
+                mismatches += loaded(x, y).log_odds() != map(x, y).log_odds();
+            }
+        }
+        GRID_CHECK_EQ(mismatches, 0);
+    }
+}
+
+// A corrupted or truncated file either loads or is refused with the map left untouched, run it
+// under ASAN and UBSAN.
+static void test_corrupted_files()
+{
+    std::mt19937 rng(3);
+    for (int compression = 0; compression < 2; compression++) {
+        GridMap map = make_test_map(GridLayout::TILED, true, rng);
+        std::vector<uint8_t> file;
+        serialize_grid_map(map, file, static_cast<GridFileCompression>(compression));
+        int untouched = 0;
+        for (int t = 0; t < 2000; t++) {
+            std::vector<uint8_t> corrupted = file;
+            const int flips = 1 + rng() % 4;
+            for (int i = 0; i < flips; i++) {
+                // Every third flip lands in the header.
+                const size_t at = (rng() % 3 == 0) ? rng() % 64 : rng() % corrupted.size();
+                corrupted[at] ^= static_cast<uint8_t>(1u << (rng() % 8));
+            }
+            if (rng() % 10 == 0) {
+                corrupted.resize(rng() % corrupted.size());
+            }
+            GridMap target(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+            target.update_region(0, 0, 3, 3, 4.0f);
+            if (!deserialize_grid_map(corrupted.data(), corrupted.size(), target)) {
+                untouched += target.width() != TEST_WIDTH || target(1, 1).log_odds() != 4.0f;
+            }
+        }
+        GRID_CHECK_EQ(untouched, 0);
+    }
+}
+
+int main()
+{
+    test_round_trip();
+    test_corrupted_files();
+    return grid_test_result();
+}
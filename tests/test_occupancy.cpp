@@ -0,0 +1,83 @@
+#include <Eigen/Core>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "grid_cell.h"
+#include "grid_map.h"
+#include "grid_occupancy.h"
+#include "grid_sensor_model.h"
+#include "grid_test.h"
+
+const int TEST_WIDTH = 97;
+const int TEST_HEIGHT = 61;
+const float TEST_UNKNOWN_BAND = 0.05f;
+
+// The export of every cell type equals the rounded percent of BasicGridProbabilityLut::prob(), and
+// stays within one percent of the exact log_odds_to_prob.
+template <typename CellT>
+static void test_export_matches_lut()
+{
+    std::mt19937 rng(1);
+    BasicGridMap<CellT> map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+    for (int i = 0; i < 20000; i++) {
+        const float increment = (static_cast<int>(rng() % 200) - 100) * 0.07f;
+        map(rng() % TEST_WIDTH, rng() % TEST_HEIGHT).update(CellT::to_raw(increment));
+    }
+    BasicGridProbabilityLut<CellT> lut;
+    BasicGridOccupancyExporter<CellT> exporter(TEST_UNKNOWN_BAND);
+    std::vector<int8_t> out(TEST_WIDTH * TEST_HEIGHT);
+    GRID_CHECK(exporter.export_map(map, out.data(), out.size()));
+
+    int different = 0;
+    int inexact = 0;
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            const float log_odds = map(x, y).log_odds();
+            const bool unknown = std::fabs(log_odds) <= TEST_UNKNOWN_BAND;
+            const int expected = unknown ? -1 : static_cast<int>(std::lround(100.0f * lut.prob(map(x, y))));
+            const int exact = unknown ? -1 : static_cast<int>(std::lround(100.0f * CellT::log_odds_to_prob(log_odds)));
+            const int value = out[y * TEST_WIDTH + x];
+            different += value != expected || value != lut.occupancy(map(x, y)._log_odds_val, TEST_UNKNOWN_BAND);
+            inexact += std::abs(value - exact) > 1;
+        }
+    }
+    GRID_CHECK_EQ(different, 0);
+    GRID_CHECK_EQ(inexact, 0);
+}
+
+// export_changed after shifts and updates gives the same buffer as a full export.
+static void test_export_changed_matches_full()
+{
+    std::mt19937 rng(3);
+    GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+    GRID_CHECK(map.set_rolling(true));
+    GridOccupancyExporter exporter;
+    GridOccupancyStamp stamp = {};
+    std::vector<int8_t> changed(TEST_WIDTH * TEST_HEIGHT);
+    std::vector<int8_t> full(TEST_WIDTH * TEST_HEIGHT);
+    int different = 0;
+    for (int it = 0; it < 100; it++) {
+        for (int k = 0; k < 5; k++) {
+            const int x = rng() % (TEST_WIDTH - 4);
+            const int y = rng() % (TEST_HEIGHT - 4);
+            map.update_region(x, y, x + 4, y + 4, (rng() % 2) ? 1.5f : -0.8f);
+        }
+        map.shift_map(static_cast<int>(rng() % 9) - 4, static_cast<int>(rng() % 9) - 4);
+        GRID_CHECK(exporter.export_changed(map, changed.data(), changed.size(), stamp));
+        GRID_CHECK(exporter.export_map(map, full.data(), full.size()));
+        different += changed != full;
+    }
+    GRID_CHECK_EQ(different, 0);
+}
+
+int main()
+{
+    test_export_matches_lut<GridCell>();
+    test_export_matches_lut<GridCell16>();
+    test_export_matches_lut<GridCell8>();
+    test_export_changed_matches_full();
+    return grid_test_result();
+}
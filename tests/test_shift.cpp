@@ -0,0 +1,308 @@
+#include <Eigen/Core>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "grid_layers.h"
+#include "grid_map.h"
+#include "grid_test.h"
+#include "static_grid_map.h"
+
+const int TEST_WIDTH = 130;
+const int TEST_HEIGHT = 97;
+
+static float prior_log_odds()
+{
+    GridCell prior;
+    prior.reset_value();
+    return prior.log_odds();
+}
+
+// The per-cell extend_map of the original row-major GridMap, on a copy of the logical cells.
+static void legacy_extend_map(std::vector<float>& cells, int width, int height, float resolution,
+    uint8_t ext_zone_type, Eigen::Vector2d& origin)
+{
+    const float prior = prior_log_odds();
+    if (ext_zone_type & ExtZoneType::LEFT) {
+        origin.x() -= EXT_ZONE * resolution;
+        for (int y = 0; y < height; y++) {
+            for (int x = width - 1; x >= 0; x--) {
+                cells[y * width + x] = x < EXT_ZONE ? prior : cells[y * width + (x - EXT_ZONE)];
+            }
+        }
+    }
+    if (ext_zone_type & ExtZoneType::RIGHT) {
+        origin.x() += EXT_ZONE * resolution;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                cells[y * width + x] = x >= width - EXT_ZONE ? prior : cells[y * width + (x + EXT_ZONE)];
+            }
+        }
+    }
+    if (ext_zone_type & ExtZoneType::DOWN) {
+        origin.y() -= EXT_ZONE * resolution;
+        for (int y = height - 1; y >= 0; y--) {
+            for (int x = 0; x < width; x++) {
+                cells[y * width + x] = y < EXT_ZONE ? prior : cells[(y - EXT_ZONE) * width + x];
+            }
+        }
+    }
+    if (ext_zone_type & ExtZoneType::TOP) {
+        origin.y() += EXT_ZONE * resolution;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                cells[y * width + x] = y >= height - EXT_ZONE ? prior : cells[(y + EXT_ZONE) * width + x];
+            }
+        }
+    }
+}
+
+// Layout and rolling mode of the test maps, mode 0 to 3.
+template <typename MapT>
+static void set_mode(MapT& map, int mode)
+{
+    GRID_CHECK(map.set_layout((mode & 1) ? GridLayout::TILED : GridLayout::ROW_MAJOR));
+    GRID_CHECK(map.set_rolling((mode & 2) != 0));
+}
+
+static void fill_random(GridMap& map, std::mt19937& rng)
+{
+    for (int y = 0; y < map.height(); y++) {
+        for (int x = 0; x < map.width(); x++) {
+            map(x, y)._log_odds_val = static_cast<float>(static_cast<int>(rng() % 41) - 20) * 0.25f;
+        }
+    }
+}
+
+// extend_map gives the cells and origin of the legacy passes for every zone combination, in every
+// storage mode.
+static void test_extend_matches_legacy()
+{
+    std::mt19937 rng(13);
+    for (int mode = 0; mode < 4; mode++) {
+        for (int zone = ExtZoneType::NONE; zone <= 0xF; zone++) {
+            GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+            set_mode(map, mode);
+            // A few shifts first, so a rolling map starts from a non-zero wrap offset.
+            map.shift_map(7, -3);
+            fill_random(map, rng);
+
+            std::vector<float> legacy(TEST_WIDTH * TEST_HEIGHT);
+            for (int y = 0; y < TEST_HEIGHT; y++) {
+                for (int x = 0; x < TEST_WIDTH; x++) {
+                    legacy[y * TEST_WIDTH + x] = map(x, y).log_odds();
+                }
+            }
+            Eigen::Vector2d legacy_origin = map.origin();
+            legacy_extend_map(legacy, TEST_WIDTH, TEST_HEIGHT, map.resolution(), static_cast<uint8_t>(zone),
+                legacy_origin);
+            map.extend_map(static_cast<uint8_t>(zone));
+
+            int mismatches = 0;
+            for (int y = 0; y < TEST_HEIGHT; y++) {
+                for (int x = 0; x < TEST_WIDTH; x++) {
+                    mismatches += map(x, y).log_odds() != legacy[y * TEST_WIDTH + x];
+                }
+            }
+            GRID_CHECK_EQ(mismatches, 0);
+            GRID_CHECK((map.origin() - legacy_origin).norm() < 1e-9);
+        }
+    }
+}
+
+// Drops the reference values of the world cells outside the window at (origin_x, origin_y).
+static void drop_outside(std::map<std::pair<long, long>, float>& reference, long origin_x, long origin_y)
+{
+    for (auto it = reference.begin(); it != reference.end();) {
+        const long x = it->first.first - origin_x;
+        const long y = it->first.second - origin_y;
+        if (x < 0 || x >= TEST_WIDTH || y < 0 || y >= TEST_HEIGHT) {
+            it = reference.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Shifts of any size keep every world cell still in view and reset the others, in every mode,
+// checked against a map keyed by world cell.
+static void test_shift_map_model()
+{
+    std::mt19937 rng(17);
+    const float prior = prior_log_odds();
+    for (int mode = 0; mode < 4; mode++) {
+        GridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+        set_mode(map, mode);
+        std::map<std::pair<long, long>, float> reference;
+        long origin_x = 0;
+        long origin_y = 0;
+        int mismatches = 0;
+        for (int it = 0; it < 200; it++) {
+            for (int k = 0; k < 20; k++) {
+                const int x = rng() % TEST_WIDTH;
+                const int y = rng() % TEST_HEIGHT;
+                const float value = 0.5f * (1 + it % 7);
+                map(x, y)._log_odds_val = value;
+                reference[std::make_pair(origin_x + x, origin_y + y)] = value;
+            }
+            int dx = static_cast<int>(rng() % 17) - 8;
+            int dy = static_cast<int>(rng() % 17) - 8;
+            if (it % 25 == 0) {
+                dx = static_cast<int>(rng() % (3 * TEST_WIDTH)) - 3 * TEST_WIDTH / 2;
+                dy = static_cast<int>(rng() % (3 * TEST_HEIGHT)) - 3 * TEST_HEIGHT / 2;
+            }
+            map.shift_map(dx, dy);
+            origin_x += dx;
+            origin_y += dy;
+            drop_outside(reference, origin_x, origin_y);
+            for (int y = 0; y < TEST_HEIGHT; y++) {
+                for (int x = 0; x < TEST_WIDTH; x++) {
+                    auto found = reference.find(std::make_pair(origin_x + x, origin_y + y));
+                    mismatches += map(x, y).log_odds() != (found == reference.end() ? prior : found->second);
+                }
+            }
+        }
+        GRID_CHECK_EQ(mismatches, 0);
+    }
+}
+
+// The planes of a layered map follow its window like the cells, through shift_map, extend_map and
+// recenter_to.
+static void test_layered_planes()
+{
+    std::mt19937 rng(19);
+    for (int mode = 0; mode < 4; mode++) {
+        LayeredGridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+        set_mode(map, mode);
+        std::map<std::pair<long, long>, float> reference;
+        long origin_x = 0;
+        long origin_y = 0;
+        uint32_t stamp = 1;
+        int mismatches = 0;
+        for (int it = 0; it < 200; it++) {
+            for (int k = 0; k < 20; k++) {
+                const int x = rng() % TEST_WIDTH;
+                const int y = rng() % TEST_HEIGHT;
+                map.timestamp(x, y) = stamp;
+                map.hit_count(x, y) = static_cast<uint16_t>(stamp);
+                map.height_class(x, y) = static_cast<uint8_t>(stamp);
+                reference[std::make_pair(origin_x + x, origin_y + y)] = static_cast<float>(stamp);
+                stamp++;
+            }
+            auto replay = [&](int dx, int dy) {
+                origin_x += dx;
+                origin_y += dy;
+                drop_outside(reference, origin_x, origin_y);
+            };
+            const Eigen::Vector2d before = map.origin();
+            const int step = rng() % 3;
+            if (step == 0) {
+                // Extensions of opposite zones shift twice, replay the same passes on the reference.
+                const uint8_t zone = static_cast<uint8_t>(rng() % 16);
+                map.extend_map(zone);
+                BasicGridMap<GridCell>::extension_shifts(zone, replay);
+            } else {
+                if (step == 1) {
+                    const double x = before.x() + (rng() % 200) * 0.1;
+                    const double y = before.y() + (rng() % 200) * 0.1;
+                    map.recenter_to(Eigen::Vector3d(x, y, 0.0));
+                } else {
+                    map.shift_map(static_cast<int>(rng() % 17) - 8, static_cast<int>(rng() % 17) - 8);
+                }
+                replay(static_cast<int>(std::lround((map.origin().x() - before.x()) / map.resolution())),
+                    static_cast<int>(std::lround((map.origin().y() - before.y()) / map.resolution())));
+            }
+            for (int y = 0; y < TEST_HEIGHT; y++) {
+                for (int x = 0; x < TEST_WIDTH; x++) {
+                    auto found = reference.find(std::make_pair(origin_x + x, origin_y + y));
+                    const uint32_t expected = found == reference.end() ? 0 : static_cast<uint32_t>(found->second);
+                    mismatches += map.timestamp(x, y) != expected
+                        || map.hit_count(x, y) != static_cast<uint16_t>(expected)
+                        || map.height_class(x, y) != static_cast<uint8_t>(expected) || map.sensor_mask(x, y) != 0;
+                }
+            }
+        }
+        GRID_CHECK_EQ(mismatches, 0);
+    }
+}
+
+// integrate_echo marks the bit of sensor ids up to 15, and refuses the others without touching the
+// map or its planes.
+static void test_layered_sensor_ids()
+{
+    GridSensor sensor;
+    LayeredGridMap map(RESOLUTION, TEST_WIDTH, TEST_HEIGHT, Eigen::Vector3d::Zero());
+    const Eigen::Vector3d pose(map.origin().x() + 6.0, map.origin().y() + 4.0, 0.3);
+    GRID_CHECK(map.integrate_echo(sensor, 15, pose, 1.5f, 0.5f, 4.0f, 7));
+    int marked = 0;
+    int hits = 0;
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            marked += map.sensor_mask(x, y) == 0x8000;
+            hits += map.hit_count(x, y) != 0;
+        }
+    }
+    GRID_CHECK(marked > 0);
+    GRID_CHECK(hits > 0);
+
+    const LayeredGridMap before = map;
+    const int invalid_ids[] = {-1, 16, 31, 32, 1000};
+    for (int id : invalid_ids) {
+        GRID_CHECK(!map.integrate_echo(sensor, id, pose, 1.5f, 0.5f, 4.0f, 8));
+    }
+    int changed = 0;
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            changed += map.log_odds()(x, y).log_odds() != before.log_odds()(x, y).log_odds()
+                || map.timestamp(x, y) != before.timestamp(x, y) || map.hit_count(x, y) != before.hit_count(x, y)
+                || map.sensor_mask(x, y) != before.sensor_mask(x, y);
+        }
+    }
+    GRID_CHECK_EQ(changed, 0);
+}
+
+// StaticGridMap shifts and extends like a row-major GridMap.
+static void test_static_map()
+{
+    std::mt19937 rng(23);
+    StaticGridMap<120, 80, 100> fixed;
+    GridMap map(0.1f, 120, 80, Eigen::Vector3d::Zero());
+    int mismatches = 0;
+    for (int it = 0; it < 200; it++) {
+        for (int k = 0; k < 10; k++) {
+            const int x = rng() % 120;
+            const int y = rng() % 80;
+            fixed(x, y).update(0.5f);
+            map(x, y).update(0.5f);
+        }
+        if (it % 7 == 0) {
+            const uint8_t zone = static_cast<uint8_t>(rng() % 16);
+            fixed.extend_map(zone);
+            map.extend_map(zone);
+        } else {
+            const int dx = static_cast<int>(rng() % 11) - 5;
+            const int dy = static_cast<int>(rng() % 11) - 5;
+            fixed.shift_map(dx, dy);
+            map.shift_map(dx, dy);
+        }
+        for (int y = 0; y < 80; y++) {
+            for (int x = 0; x < 120; x++) {
+                mismatches += fixed(x, y).log_odds() != map(x, y).log_odds();
+            }
+        }
+    }
+    GRID_CHECK_EQ(mismatches, 0);
+}
+
+int main()
+{
+    test_extend_matches_legacy();
+    test_shift_map_model();
+    test_layered_planes();
+    test_layered_sensor_ids();
+    test_static_map();
+    return grid_test_result();
+}